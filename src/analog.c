@@ -0,0 +1,435 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define CALIB_IN_PROGRESS 0
+#define CALIB_DONE 1
+#define CALIB_ERROR 2
+
+#define CALIB_DAC_CH_OFFSET ADC_CH_NO // DAC channels are [9..12] in calibration commands
+#define CALIB_POLL_FIRST_US 2000 // status poll backoff start
+#define CALIB_POLL_MAX_US 100000 // status poll backoff limit
+#define CALIB_TIMEOUT_MS 5000
+#define CALIB_VERIFY_SAMPLES 16
+#define CALIB_VERIFY_PERIOD_US 2000
+#define CALIB_VERIFY_TOL_MV 10
+#define CALIB_LINE_MAX 256
+
+#ifndef PLCPI_CLI
+int adcGet(int dev, int ch, float *val)
+{
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > ADC_CH_NR_MAX) || (NULL == val))
+	{
+		return ERROR;
+	}
+	if (OK
+		!= i2cReadWordAS(dev, I2C_MEM_ADC_VAL_MV_ADD + ADC_RAW_VAL_SIZE * (ch - 1),
+			&raw))
+	{
+		return ERROR;
+	}
+	*val = (float)raw / VOLT_TO_MILIVOLT;
+	return OK;
+}
+
+int dacGet(int dev, int ch, float *val)
+{
+	u8 buff[2];
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > DAC_CH_NR_MAX) || (NULL == val))
+	{
+		return ERROR;
+	}
+	if (OK
+		!= i2cMem8Read(dev, I2C_MEM_DAC_VAL_MV_ADD + DAC_MV_VAL_SIZE * (ch - 1), buff,
+			DAC_MV_VAL_SIZE))
+	{
+		return ERROR;
+	}
+	memcpy(&raw, buff, 2);
+	*val = (float)raw / VOLT_TO_MILIVOLT;
+	return OK;
+}
+
+int dacSet(int dev, int ch, float val)
+{
+	u8 buff[2];
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > DAC_CH_NR_MAX) || (val < 0))
+	{
+		return ERROR;
+	}
+	raw = (u16) (val * VOLT_TO_MILIVOLT + 0.5);
+	memcpy(buff, &raw, 2);
+	return i2cMem8Write(dev, I2C_MEM_DAC_VAL_MV_ADD + DAC_MV_VAL_SIZE * (ch - 1),
+		buff, DAC_MV_VAL_SIZE);
+}
+
+/**
+ * Wait for the calibration status with exponential backoff
+ */
+static int calibWait(int dev)
+{
+	u8 buff[1];
+	int waitUs = CALIB_POLL_FIRST_US;
+	uint64_t deadline = getTimeUs() + (uint64_t)CALIB_TIMEOUT_MS * 1000;
+
+	while (1)
+	{
+		busyWaitUs(waitUs);
+		if (OK != i2cMem8Read(dev, I2C_MEM_CALIB_STATUS, buff, 1))
+		{
+			return ERROR;
+		}
+		if (buff[0] == CALIB_DONE)
+		{
+			return OK;
+		}
+		if ( (buff[0] != CALIB_IN_PROGRESS) || (getTimeUs() > deadline))
+		{
+			return ERROR;
+		}
+		waitUs *= 2;
+		if (waitUs > CALIB_POLL_MAX_US)
+		{
+			waitUs = CALIB_POLL_MAX_US;
+		}
+	}
+}
+
+/**
+ * Send one calibration point
+ * Params:
+ * 	dev - I2C port
+ * 	ch - calibration channel, ADC [1..8], DAC [9..12]
+ * 	mV - the reference value applied to the ADC channel or measured on the DAC output
+ */
+int calibPointSet(int dev, int ch, int mV)
+{
+	u8 buff[4];
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > ADC_CH_NO + DAC_CH_NO) || (mV < 0)
+		|| (mV > 0xffff))
+	{
+		return ERROR;
+	}
+	// value, channel and key are contiguous, one transfer
+	raw = (u16)mV;
+	memcpy(buff, &raw, 2);
+	buff[2] = (u8)ch;
+	buff[3] = CALIBRATION_KEY;
+	if (OK != i2cMem8Write(dev, I2C_MEM_CALIB_VALUE, buff, 4))
+	{
+		return ERROR;
+	}
+	return calibWait(dev);
+}
+
+int calibReset(int dev, int ch)
+{
+	u8 buff[2];
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > ADC_CH_NO + DAC_CH_NO))
+	{
+		return ERROR;
+	}
+	buff[0] = (u8)ch;
+	buff[1] = RESET_CALIBRATION_KEY;
+	if (OK != i2cMem8Write(dev, I2C_MEM_CALIB_CHANNEL, buff, 2))
+	{
+		return ERROR;
+	}
+	return calibWait(dev);
+}
+
+/**
+ * Average ADC readings after calibration
+ */
+int adcGetAvg(int dev, int ch, int samples, float *val)
+{
+	float sum = 0;
+	float v = 0;
+	int i = 0;
+
+	if ( (samples <= 0) || (NULL == val))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < samples; i++)
+	{
+		if (i != 0)
+		{
+			busyWaitUs(CALIB_VERIFY_PERIOD_US);
+		}
+		if (OK != adcGet(dev, ch, &v))
+		{
+			return ERROR;
+		}
+		sum += v;
+	}
+	*val = sum / samples;
+	return OK;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+static int calibCmd(int argc, char *argv[], int offset, int maxCh)
+{
+	int dev = 0;
+	int ch = 0;
+	float val = 0;
+
+	if (argc != 5)
+	{
+		return ARG_CNT_ERR;
+	}
+	ch = atoi(argv[3]);
+	if ( (ch < CHANNEL_NR_MIN) || (ch > maxCh))
+	{
+		printf("Channel number out of range [1..%d]!\n", maxCh);
+		return ARG_ERR;
+	}
+	val = atof(argv[4]);
+	if (val < 0)
+	{
+		printf("Invalid calibration value!\n");
+		return ARG_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != calibPointSet(dev, ch + offset, (int) (val * VOLT_TO_MILIVOLT + 0.5)))
+	{
+		printf("Fail to calibrate!\n");
+		return ERROR;
+	}
+	printf("done\n");
+	return OK;
+}
+
+static int calibRstCmd(int argc, char *argv[], int offset, int maxCh)
+{
+	int dev = 0;
+	int ch = 0;
+
+	if (argc != 4)
+	{
+		return ARG_CNT_ERR;
+	}
+	ch = atoi(argv[3]);
+	if ( (ch < CHANNEL_NR_MIN) || (ch > maxCh))
+	{
+		printf("Channel number out of range [1..%d]!\n", maxCh);
+		return ARG_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != calibReset(dev, ch + offset))
+	{
+		printf("Fail to reset the calibration!\n");
+		return ERROR;
+	}
+	printf("done\n");
+	return OK;
+}
+
+int doAdcCal(int argc, char *argv[])
+{
+	return calibCmd(argc, argv, 0, ADC_CH_NR_MAX);
+}
+
+int doAdcCalRst(int argc, char *argv[])
+{
+	return calibRstCmd(argc, argv, 0, ADC_CH_NR_MAX);
+}
+
+int doDacCal(int argc, char *argv[])
+{
+	return calibCmd(argc, argv, CALIB_DAC_CH_OFFSET, DAC_CH_NR_MAX);
+}
+
+int doDacCalRst(int argc, char *argv[])
+{
+	return calibRstCmd(argc, argv, CALIB_DAC_CH_OFFSET, DAC_CH_NR_MAX);
+}
+
+/**
+ * Calibration plan, one step per line:
+ * 	<board> <adc1..adc8|dac1..dac4> point <mV>
+ * 	<board> <adc1..adc8|dac1..dac4> reset
+ * 	<board> <dac1..dac4> set <mV>
+ * <board> is <stack> or <bus>:<stack>. For ADC points <mV> is the reference applied to the input and the result is
+ * verified with averaged readings, for DAC points <mV> is the value measured
+ * on the output after a "set" step. Empty lines and lines starting with '#'
+ * are ignored.
+ */
+int doCalBatch(int argc, char *argv[])
+{
+	FILE *f = NULL;
+	char line[CALIB_LINE_MAX];
+	char board[16];
+	char chName[16];
+	char op[16];
+	int bus = 0;
+	int stack = 0;
+	int lastBus = -1;
+	int lastStack = -1;
+	int lockBus = I2C_BUS_DEFAULT;
+	int dev = -1;
+	int ch = 0;
+	int mV = 0;
+	int n = 0;
+	int lineNr = 0;
+	int steps = 0;
+	int failed = 0;
+	int isDac = 0;
+	float val = 0;
+	uint64_t start = getTimeUs();
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	f = fopen(argv[2], "r");
+	if (NULL == f)
+	{
+		printf("Fail to open the calibration plan \"%s\"!\n", argv[2]);
+		return ERROR;
+	}
+	while (fgets(line, sizeof(line), f))
+	{
+		lineNr++;
+		mV = 0;
+		n = sscanf(line, "%15s %15s %15s %d", board, chName, op, &mV);
+		if ( (n <= 0) || (line[0] == '#'))
+		{
+			continue;
+		}
+		bus = I2C_BUS_DEFAULT;
+		if ( (n < 3) || (OK != boardIdParse(board, &bus, &stack)))
+		{
+			printf("line %d: invalid step\n", lineNr);
+			failed++;
+			continue;
+		}
+		isDac = (strncasecmp(chName, "dac", 3) == 0);
+		ch = atoi(chName + 3);
+		if ( (!isDac && strncasecmp(chName, "adc", 3) != 0)
+			|| (ch < CHANNEL_NR_MIN)
+			|| (ch > (isDac ? DAC_CH_NR_MAX : ADC_CH_NR_MAX)))
+		{
+			printf("line %d: invalid channel \"%s\"\n", lineNr, chName);
+			failed++;
+			continue;
+		}
+		if ( (bus != lastBus) || (stack != lastStack))
+		{
+			if (dev > 0)
+			{
+				devClose(dev);
+			}
+			// the steps of a board run under the lock of its adapter
+			if (bus != lockBus)
+			{
+				busUnlock(lockBus);
+				busLock(bus);
+				lockBus = bus;
+			}
+			dev = doBoardOpen(bus, stack);
+			lastBus = bus;
+			lastStack = stack;
+		}
+		if (dev <= 0)
+		{
+			printf("line %d: board %d:%d not available\n", lineNr, bus, stack);
+			failed++;
+			continue;
+		}
+		steps++;
+		printf("line %d: board %d:%d %s %s", lineNr, bus, stack, chName, op);
+		if (strcasecmp(op, "reset") == 0)
+		{
+			if (OK != calibReset(dev, ch + (isDac ? CALIB_DAC_CH_OFFSET : 0)))
+			{
+				printf(" FAIL\n");
+				failed++;
+				continue;
+			}
+		}
+		else if ( (strcasecmp(op, "set") == 0) && isDac && (n == 4))
+		{
+			printf(" %d mV", mV);
+			if (OK != dacSet(dev, ch, (float)mV / VOLT_TO_MILIVOLT))
+			{
+				printf(" FAIL\n");
+				failed++;
+				continue;
+			}
+		}
+		else if ( (strcasecmp(op, "point") == 0) && (n == 4))
+		{
+			printf(" %d mV", mV);
+			if (OK
+				!= calibPointSet(dev, ch + (isDac ? CALIB_DAC_CH_OFFSET : 0), mV))
+			{
+				printf(" FAIL\n");
+				failed++;
+				continue;
+			}
+			if (!isDac)
+			{
+				if (OK != adcGetAvg(dev, ch, CALIB_VERIFY_SAMPLES, &val))
+				{
+					printf(" verify read FAIL\n");
+					failed++;
+					continue;
+				}
+				val = val * VOLT_TO_MILIVOLT - mV;
+				printf(" verify %+0.1f mV", val);
+				if ( (val > CALIB_VERIFY_TOL_MV) || (val < -CALIB_VERIFY_TOL_MV))
+				{
+					printf(" FAIL\n");
+					failed++;
+					continue;
+				}
+			}
+		}
+		else
+		{
+			printf(" invalid operation\n");
+			failed++;
+			continue;
+		}
+		printf(" OK\n");
+	}
+	fclose(f);
+	if (dev > 0)
+	{
+		devClose(dev);
+	}
+	if (lockBus != I2C_BUS_DEFAULT)
+	{
+		busUnlock(lockBus);
+		busLock(I2C_BUS_DEFAULT);
+	}
+	printf("%d step(s), %d failed, %0.1f s\n", steps, failed,
+		(float) (getTimeUs() - start) / 1000000);
+	return failed == 0 ? OK : ERROR;
+}
+#endif // PLCPI_LIB
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+/*
+ * Read cache with a freshness budget per register class. i2cMem8Read() and
+ * consRead() answer from the last snapshot of the board when every register
+ * asked is younger than the budget of its class and go to the bus otherwise.
+ * The budgets are process wide, the snapshots belong to the device context.
+ * A write drops the registers written and the input and diagnostic classes,
+ * an output or counter reset command changes them; a recovery drops all.
+ */
+
+#define CACHE_CONFIG_AGE_US 1000000 // the configuration is also written by other processes
+
+static uint64_t gCacheAge[CACHE_NR];
+static u8 gCacheClass[SLAVE_BUFF_SIZE + 1];
+static pthread_once_t gCacheOnce = PTHREAD_ONCE_INIT;
+
+static void cacheRangeSet(int add, int size, u8 cls)
+{
+	memset(&gCacheClass[add], cls, size);
+}
+
+static void cacheDefaults(void)
+{
+	// commands, watchdog, calibration and 1-wire registers: always read
+	cacheRangeSet(0, SLAVE_BUFF_SIZE + 1, CACHE_LIVE);
+	// inputs and counters: fresh reads unless a budget is set
+	cacheRangeSet(I2C_MEM_RELAY_VAL_ADD, 1, CACHE_INPUT);
+	cacheRangeSet(I2C_MEM_OPTO_IN_ADD, 2, CACHE_INPUT);
+	cacheRangeSet(I2C_MEM_ADC_VAL_RAW_ADD, 2 * ADC_CH_NO * ADC_RAW_VAL_SIZE,
+		CACHE_INPUT);
+	cacheRangeSet(I2C_MEM_OPTO_EDGE_COUNT_ADD, COUNTER_SIZE * OPTO_CH_NO,
+		CACHE_INPUT);
+	cacheRangeSet(I2C_MEM_GPIO_EDGE_COUNT_ADD,
+		I2C_MEM_GPIO_ENC_COUNT_END_ADD - I2C_MEM_GPIO_EDGE_COUNT_ADD, CACHE_INPUT);
+	cacheRangeSet(I2C_MEM_DIAG_TEMPERATURE_ADD, 3, CACHE_DIAG);
+	// configuration written by the host and read back at the same address
+	cacheRangeSet(I2C_MEM_GPIO_DIR_ADD, 1, CACHE_CONFIG);
+	cacheRangeSet(I2C_MEM_OPTO_IT_RISING_ADD,
+		I2C_MEM_GPIO_EXT_IT_FALLING_ADD - I2C_MEM_OPTO_IT_RISING_ADD + 1,
+		CACHE_CONFIG);
+	cacheRangeSet(I2C_MEM_OPTO_ENC_ENABLE_ADD, 2, CACHE_CONFIG);
+	cacheRangeSet(I2C_MEM_OD_PWM_FREQUENCY_CH1, OD_CH_NO * 2, CACHE_CONFIG);
+	cacheRangeSet(I2C_MEM_OD_PWM_FREQUENCY, 2, CACHE_CONFIG);
+	cacheRangeSet(I2C_MEM_REVISION_HW_MAJOR_ADD, 4, CACHE_REVISION);
+
+	gCacheAge[CACHE_LIVE] = 0;
+	gCacheAge[CACHE_INPUT] = 0;
+	gCacheAge[CACHE_DIAG] = 0;
+	gCacheAge[CACHE_CONFIG] = CACHE_CONFIG_AGE_US;
+	gCacheAge[CACHE_REVISION] = CACHE_FOREVER;
+}
+
+/**
+ * Freshness budget of a class, 0 to always read, CACHE_FOREVER to read once
+ */
+int cacheAgeSet(int cls, uint64_t maxAgeUs)
+{
+	if ( (cls <= CACHE_LIVE) || (cls >= CACHE_NR))
+	{
+		return ERROR;
+	}
+	pthread_once(&gCacheOnce, cacheDefaults);
+	gCacheAge[cls] = maxAgeUs;
+	return OK;
+}
+
+/**
+ * Move the registers [add, add + size) to a class
+ */
+int cacheClassSet(int add, int size, int cls)
+{
+	if ( (add < 0) || (size < 1) || (add + size > SLAVE_BUFF_SIZE + 1)
+		|| (cls < 0) || (cls >= CACHE_NR))
+	{
+		return ERROR;
+	}
+	pthread_once(&gCacheOnce, cacheDefaults);
+	cacheRangeSet(add, size, (u8)cls);
+	return OK;
+}
+
+static int cacheRange(int add, int size)
+{
+	return (add >= 0) && (size >= 1) && (add + size <= SLAVE_BUFF_SIZE + 1);
+}
+
+/**
+ * Copy [add, add + size) from the snapshot if all of it is fresh enough
+ * Return OK on a hit, ERROR if the bus must be read
+ */
+int cacheGet(int dev, int add, u8 *buff, int size)
+{
+	DevCtxType *ctx = devGet(dev);
+	uint64_t now = 0;
+	uint64_t age = 0;
+	int cls = CACHE_LIVE;
+	int i = 0;
+
+	if ( (NULL == ctx) || (NULL == buff) || !cacheRange(add, size))
+	{
+		return ERROR;
+	}
+	pthread_once(&gCacheOnce, cacheDefaults);
+	cls = gCacheClass[add];
+	if (gCacheAge[cls] == 0)
+	{
+		return ERROR;
+	}
+	now = getTimeUs();
+	for (i = add; i < add + size; i++)
+	{
+		age = gCacheAge[gCacheClass[i]];
+		if ( (ctx->cacheUs[i] == 0) || ( (age != CACHE_FOREVER)
+			&& (now - ctx->cacheUs[i] > age)))
+		{
+			ctx->cache[cls].misses++;
+			return ERROR;
+		}
+	}
+	memcpy(buff, &ctx->cacheVal[add], size);
+	ctx->cache[cls].hits++;
+	return OK;
+}
+
+/**
+ * Store the registers just read, only the classes with a budget
+ */
+void cachePut(int dev, int add, const u8 *buff, int size)
+{
+	DevCtxType *ctx = devGet(dev);
+	uint64_t now = 0;
+	int i = 0;
+
+	if ( (NULL == ctx) || (NULL == buff) || !cacheRange(add, size))
+	{
+		return;
+	}
+	pthread_once(&gCacheOnce, cacheDefaults);
+	now = getTimeUs();
+	for (i = add; i < add + size; i++)
+	{
+		if (gCacheAge[gCacheClass[i]] != 0)
+		{
+			ctx->cacheVal[i] = buff[i - add];
+			ctx->cacheUs[i] = now;
+		}
+	}
+}
+
+/**
+ * Forget the registers written and the ones a write may change
+ */
+void cacheDrop(int dev, int add, int size)
+{
+	DevCtxType *ctx = devGet(dev);
+	u8 cls = CACHE_LIVE;
+	int i = 0;
+
+	if (NULL == ctx)
+	{
+		return;
+	}
+	pthread_once(&gCacheOnce, cacheDefaults);
+	for (i = 0; i <= SLAVE_BUFF_SIZE; i++)
+	{
+		cls = gCacheClass[i];
+		if ( (cls == CACHE_INPUT) || (cls == CACHE_DIAG)
+			|| ( (i >= add) && (i < add + size)))
+		{
+			ctx->cacheUs[i] = 0;
+		}
+	}
+}
+
+void cacheClear(int dev)
+{
+	DevCtxType *ctx = devGet(dev);
+
+	if (NULL != ctx)
+	{
+		memset(ctx->cacheUs, 0, sizeof(ctx->cacheUs));
+	}
+}
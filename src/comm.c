@@ -9,13 +9,23 @@
  ***********************************************************************
  */
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/i2c-dev.h>
+#include <linux/i2c.h>
+#include <semaphore.h>
+#include <pthread.h>
 #include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "trace.h"
+
+#define THREAD_SAFE
 
 #define I2C_SLAVE	0x0703
 #define I2C_SMBUS	0x0720	/* SMBus-level access */
@@ -35,34 +45,181 @@
 #define I2C_SMBUS_BLOCK_PROC_CALL   7		/* SMBus 2.0 */
 #define I2C_SMBUS_I2C_BLOCK_DATA    8
 
-// SMBus messages
-
+// SMBus messages, the plain I2C transfers are not limited to the SMBus block size
+#undef I2C_SMBUS_BLOCK_MAX
+#undef I2C_SMBUS_I2C_BLOCK_MAX
 #define I2C_SMBUS_BLOCK_MAX	512	/* As specified in SMBus standard */
 #define I2C_SMBUS_I2C_BLOCK_MAX	512	/* Not specified but we use same structure */
 
-int i2cSetup(int addr)
+#define I2C_PATH_ENV "PLCPI_I2C_PATH"
+#define I2C_PATH_DEFAULT "/dev/i2c-"
+
+/*
+ * Trace the transaction started at t0, 0 when the tracer was off
+ */
+static void commTrace(int dev, int add, int size, int dir, uint64_t t0,
+	int ret)
+{
+	if (t0)
+	{
+		traceAdd(dev, add, size, dir, t0, ret == 0 ? 0 : (errno ? errno : EIO));
+	}
+}
+
+#ifdef THREAD_SAFE
+static sem_t *gSemaphore[I2C_BUS_MAX];
+static pthread_mutex_t gSemMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static sem_t* busSemGet(int bus)
+{
+	char name[32];
+	sem_t *sem = NULL;
+
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return NULL;
+	}
+	pthread_mutex_lock(&gSemMutex);
+	if (NULL == gSemaphore[bus])
+	{
+		// bus 1 keep the name used by the other Sequent Microsystems tools
+		if (bus == I2C_BUS_DEFAULT)
+		{
+			snprintf(name, sizeof(name), "/SMI2C_SEM");
+		}
+		else
+		{
+			snprintf(name, sizeof(name), "/SMI2C_SEM_%d", bus);
+		}
+		sem = sem_open(name, O_CREAT, 0666, 1);
+		if (SEM_FAILED != sem)
+		{
+			gSemaphore[bus] = sem;
+		}
+	}
+	sem = gSemaphore[bus];
+	pthread_mutex_unlock(&gSemMutex);
+	return sem;
+}
+#endif
+
+/*
+ * busLock / busUnlock:
+ *	Serialize the I2C access between plcpi processes and libplcpi users, the
+ *	resident commands release the bus while they sleep. Every adapter has its
+ *	own lock so the transfers on different buses run in parallel.
+ */
+void busLock(int bus)
+{
+#ifdef THREAD_SAFE
+	sem_t *sem = busSemGet(bus);
+
+	if (NULL == sem)
+	{
+		return;
+	}
+	sem_wait(sem);
+#endif
+}
+
+void busUnlock(int bus)
+{
+#ifdef THREAD_SAFE
+	int semVal = 2;
+	sem_t *sem = busSemGet(bus);
+
+	if (NULL == sem)
+	{
+		return;
+	}
+	sem_getvalue(sem, &semVal);
+	if (semVal < 1)
+	{
+		sem_post(sem);
+	}
+#endif
+}
+
+/*
+ * envGet:
+ *	Value of an environment variable, NULL when plcpi runs setuid or setgid:
+ *	the variables name files opened with the owner privileges
+ */
+const char *envGet(const char *name)
+{
+	if ( (getuid() != geteuid()) || (getgid() != getegid()))
+	{
+		return NULL;
+	}
+	return getenv(name);
+}
+
+/*
+ * privDrop / privRestore:
+ *	Run as the real user while a file named by the caller is opened, so a
+ *	setuid plcpi cannot be used to create or truncate files of the owner.
+ *	privDrop() returns the effective uid to give back to privRestore(),
+ *	(uid_t)-1 if the switch failed
+ */
+uid_t privDrop(void)
+{
+	uid_t euid = geteuid();
+
+	if ( (euid != getuid()) && (seteuid(getuid()) < 0))
+	{
+		return (uid_t)-1;
+	}
+	return euid;
+}
+
+int privRestore(uid_t euid)
+{
+	if ( (euid == (uid_t)-1) || (euid == geteuid()))
+	{
+		return OK;
+	}
+	return seteuid(euid) < 0 ? ERROR : OK;
+}
+
+/*
+ * i2cSetup:
+ *	Open the adapter /dev/i2c-<bus> and select the slave, the path prefix can
+ *	be changed with the PLCPI_I2C_PATH environment variable when not setuid
+ */
+int i2cSetup(int bus, int addr)
 {
 	int file;
-	char filename[40];
-	sprintf(filename, "/dev/i2c-1");
+	char filename[128];
+	const char *path = envGet(I2C_PATH_ENV);
+
+	traceEnvInit();
+	if ( (NULL == path) || (0 == *path))
+	{
+		path = I2C_PATH_DEFAULT;
+	}
+	snprintf(filename, sizeof(filename), "%s%d", path, bus);
 
 	if ( (file = open(filename, O_RDWR)) < 0)
 	{
-		printf("Failed to open the bus.");
 		return -1;
 	}
 	if (ioctl(file, I2C_SLAVE, addr) < 0)
 	{
-		printf("Failed to acquire bus access and/or talk to slave.\n");
+		close(file);
 		return -1;
 	}
 
 	return file;
 }
 
-int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+/*
+ * i2cMem8ReadBus:
+ *	Read a register block from the board, never from the cache
+ */
+int i2cMem8ReadBus(int dev, int add, uint8_t* buff, int size)
 {
 	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	uint64_t t0 = 0;
 
 	if (NULL == buff)
 	{
@@ -73,25 +230,51 @@ int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
 	{
 		return -1;
 	}
+	if (0 != devBusAllow(dev))
+	{
+		return -1;
+	}
 
 	intBuff[0] = 0xff & add;
+	t0 = traceOn() ? getTimeUs() : 0;
 
 	if (write(dev, intBuff, 1) != 1)
 	{
 		//printf("Fail to select mem add!\n");
+		commTrace(dev, add, size, TRACE_READ, t0, -1);
+		devStatAdd(dev, 0, 0, -1);
 		return -1;
 	}
 	if (read(dev, buff, size) != size)
 	{
 		//printf("Fail to read memory!\n");
+		commTrace(dev, add, size, TRACE_READ, t0, -1);
+		devStatAdd(dev, 0, 0, -1);
 		return -1;
 	}
+	commTrace(dev, add, size, TRACE_READ, t0, 0);
+	devStatAdd(dev, 0, size, 0);
 	return 0; //OK
 }
 
+int i2cMem8Read(int dev, int add, uint8_t* buff, int size)
+{
+	if (OK == cacheGet(dev, add, buff, size))
+	{
+		return 0;
+	}
+	if (0 != i2cMem8ReadBus(dev, add, buff, size))
+	{
+		return -1;
+	}
+	cachePut(dev, add, buff, size);
+	return 0;
+}
+
 int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
 {
 	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	uint64_t t0 = 0;
 
 	if (NULL == buff)
 	{
@@ -102,89 +285,253 @@ int i2cMem8Write(int dev, int add, uint8_t* buff, int size)
 	{
 		return -1;
 	}
+	if (0 != devBusAllow(dev))
+	{
+		return -1;
+	}
+	cacheDrop(dev, add, size);
 
 	intBuff[0] = 0xff & add;
 	memcpy(&intBuff[1], buff, size);
+	t0 = traceOn() ? getTimeUs() : 0;
 
 	if (write(dev, intBuff, size + 1) != size + 1)
 	{
 		//printf("Fail to write memory!\n");
+		commTrace(dev, add, size, TRACE_WRITE, t0, -1);
+		devStatAdd(dev, 1, 0, -1);
 		return -1;
 	}
+	commTrace(dev, add, size, TRACE_WRITE, t0, 0);
+	devStatAdd(dev, 1, size, 0);
 	return 0;
 }
-#define SPURIOUS_RETRY	10 
-int i2cReadByteAS(int dev, int add, uint8_t* val)
+/*
+ * i2cMem8WriteBlocks:
+ *	Write several register blocks in one I2C transaction, a repeated start
+ *	between the blocks and one stop at the end
+ */
+int i2cMem8WriteBlocks(int dev, I2cBlockType* blk, int count)
 {
-	uint8_t read = 255;
-	int valA = 256;
-	int retry = SPURIOUS_RETRY;
+	uint8_t intBuff[I2C_BLOCKS_SIZE_MAX];
+	struct i2c_msg msg[I2C_BLOCKS_MAX];
+	struct i2c_rdwr_ioctl_data rdwr;
+	DevCtxType *ctx = devGet(dev);
+	uint64_t t0 = 0;
+	int used = 0;
+	int total = 0;
+	int i = 0;
 
-	while ( (read != valA) && (retry > 0))
+	if ( (NULL == blk) || (NULL == ctx) || (count < 1)
+		|| (count > I2C_BLOCKS_MAX))
 	{
-		retry--;
-		valA = read;
-		if (0 != i2cMem8Read(dev, add, &read, 1))
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (NULL == blk[i].buff) || (blk[i].size < 1)
+			|| (used + blk[i].size + 1 > I2C_BLOCKS_SIZE_MAX))
 		{
 			return -1;
 		}
+		intBuff[used] = 0xff & blk[i].add;
+		memcpy(&intBuff[used + 1], blk[i].buff, blk[i].size);
+		msg[i].addr = (uint16_t)ctx->addr;
+		msg[i].flags = 0;
+		msg[i].len = (uint16_t) (blk[i].size + 1);
+		msg[i].buf = &intBuff[used];
+		used += blk[i].size + 1;
+		total += blk[i].size;
 	}
-	if (retry == 0)
+	if (0 != devBusAllow(dev))
 	{
 		return -1;
 	}
-	*val = read;
+	for (i = 0; i < count; i++)
+	{
+		cacheDrop(dev, blk[i].add, blk[i].size);
+	}
+	rdwr.msgs = msg;
+	rdwr.nmsgs = (uint32_t)count;
+	t0 = traceOn() ? getTimeUs() : 0;
+	if (ioctl(dev, I2C_RDWR, &rdwr) != count)
+	{
+		commTrace(dev, blk[0].add, total, TRACE_WRITE, t0, -1);
+		devStatAdd(dev, 1, 0, -1);
+		return -1;
+	}
+	commTrace(dev, blk[0].add, total, TRACE_WRITE, t0, 0);
+	devStatAdd(dev, 1, total, 0);
 	return 0;
 }
 
-int i2cReadWordAS(int dev, int add, uint16_t* val)
+/*
+ * i2cMem8ReadBlocks:
+ *	Read several register blocks, one I2C transaction per block: an address
+ *	write followed by a read with a repeated start. The adapters like the
+ *	Raspberry Pi i2c-bcm2835 accept a read message only at the end of a
+ *	transaction, so the blocks can not be chained in one I2C_RDWR; the caller
+ *	holds the bus lock to keep the other processes off the bus in between.
+ *	Stop at the first block that fail.
+ */
+int i2cMem8ReadBlocks(int dev, I2cBlockType* blk, int count)
 {
-	uint8_t buff[2];
-	uint16_t read = 50000;
-	int valA = 60000;
-	int retry = SPURIOUS_RETRY;
-	
-	while ( ((read & 0xfffc) != (valA & 0xfffc)) && (retry > 0))
-	{
-		retry--;
-		valA = read;
-		if (0 != i2cMem8Read(dev, add, buff, 2))
+	uint8_t addBuff;
+	struct i2c_msg msg[2];
+	struct i2c_rdwr_ioctl_data rdwr;
+	DevCtxType *ctx = devGet(dev);
+	uint64_t t0 = 0;
+	int i = 0;
+
+	if ( (NULL == blk) || (NULL == ctx) || (count < 1)
+		|| (count > I2C_BLOCKS_MAX))
+	{
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (NULL == blk[i].buff) || (blk[i].size < 1)
+			|| (blk[i].size > I2C_BLOCKS_SIZE_MAX))
 		{
 			return -1;
 		}
-		memcpy(&read, buff, 2);
 	}
-	if (retry == 0)
+	if (0 != devBusAllow(dev))
 	{
 		return -1;
 	}
-	*val = read;
+	for (i = 0; i < count; i++)
+	{
+		addBuff = 0xff & blk[i].add;
+		msg[0].addr = (uint16_t)ctx->addr;
+		msg[0].flags = 0;
+		msg[0].len = 1;
+		msg[0].buf = &addBuff;
+		msg[1].addr = (uint16_t)ctx->addr;
+		msg[1].flags = I2C_M_RD;
+		msg[1].len = (uint16_t)blk[i].size;
+		msg[1].buf = blk[i].buff;
+		rdwr.msgs = msg;
+		rdwr.nmsgs = 2;
+		t0 = traceOn() ? getTimeUs() : 0;
+		if (ioctl(dev, I2C_RDWR, &rdwr) != 2)
+		{
+			commTrace(dev, blk[i].add, blk[i].size, TRACE_READ, t0, -1);
+			devStatAdd(dev, 0, 0, -1);
+			return -1;
+		}
+		commTrace(dev, blk[i].add, blk[i].size, TRACE_READ, t0, 0);
+		devStatAdd(dev, 0, blk[i].size, 0);
+	}
 	return 0;
 }
 
-
-int i2cReadDWordAS(int dev, int add, uint32_t* val)
+/*
+ * i2cMem8WriteVerify:
+ *	Write a register block and read it back in the same I2C transaction,
+ *	repeat until the read back match, at most retries times and not after
+ *	timeoutUs, so the worst case is retries + 1 transactions
+ *	mask - bits compared, NULL for all, the input bits of a mixed register
+ *	can not be verified
+ */
+int i2cMem8WriteVerify(int dev, int add, uint8_t* buff, const uint8_t* mask,
+	int size, int retries, int timeoutUs)
 {
-	uint8_t buff[4];
-	uint32_t read = 50000;
-	uint32_t valA = 60000;
-	int retry = SPURIOUS_RETRY;
-	
-	while ( ((read & 0xfffffffc) != (valA & 0xfffffffc)) && (retry > 0))
-	{
-		retry--;
-		valA = read;
-		if (0 != i2cMem8Read(dev, add, buff, 4))
+	uint8_t intBuff[I2C_SMBUS_BLOCK_MAX];
+	uint8_t rdBuff[I2C_SMBUS_BLOCK_MAX];
+	struct i2c_msg msg[3];
+	struct i2c_rdwr_ioctl_data rdwr;
+	DevCtxType *ctx = devGet(dev);
+	uint64_t deadline = getTimeUs() + (uint64_t)timeoutUs;
+	uint64_t t0 = 0;
+	int attempt = 0;
+	int i = 0;
+
+	if ( (NULL == buff) || (NULL == ctx) || (size < 1)
+		|| (size > I2C_SMBUS_BLOCK_MAX - 1) || (retries < 0))
+	{
+		return -1;
+	}
+	intBuff[0] = 0xff & add;
+	memcpy(&intBuff[1], buff, size);
+	msg[0].addr = (uint16_t)ctx->addr;
+	msg[0].flags = 0;
+	msg[0].len = (uint16_t) (size + 1);
+	msg[0].buf = intBuff;
+	msg[1].addr = (uint16_t)ctx->addr;
+	msg[1].flags = 0;
+	msg[1].len = 1;
+	msg[1].buf = intBuff;
+	msg[2].addr = (uint16_t)ctx->addr;
+	msg[2].flags = I2C_M_RD;
+	msg[2].len = (uint16_t)size;
+	msg[2].buf = rdBuff;
+	rdwr.msgs = msg;
+	rdwr.nmsgs = 3;
+	cacheDrop(dev, add, size);
+
+	for (attempt = 0; attempt <= retries; attempt++)
+	{
+		if ( ( (attempt > 0) && (getTimeUs() > deadline))
+			|| (0 != devBusAllow(dev)))
 		{
-			return -1;
+			break;
+		}
+		t0 = traceOn() ? getTimeUs() : 0;
+		if (ioctl(dev, I2C_RDWR, &rdwr) != 3)
+		{
+			commTrace(dev, add, size, TRACE_WRITE_READ, t0, -1);
+			devStatAdd(dev, 1, 0, -1);
+			continue;
+		}
+		commTrace(dev, add, size, TRACE_WRITE_READ, t0, 0);
+		devStatAdd(dev, 1, size, 0);
+		for (i = 0; i < size; i++)
+		{
+			if ( (buff[i] ^ rdBuff[i]) & (mask ? mask[i] : 0xff))
+			{
+				break;
+			}
+		}
+		if (i == size)
+		{
+			return 0;
 		}
-		memcpy(&read, buff, 4);
 	}
-	if (retry == 0)
+	return -1;
+}
+
+/*
+ * Anti spurious reads, the redundancy is selected by the consistency policy
+ * of the register, see cons.c
+ */
+int i2cReadByteAS(int dev, int add, uint8_t* val)
+{
+	return consRead(dev, add, val, 1, 0);
+}
+
+int i2cReadWordAS(int dev, int add, uint16_t* val)
+{
+	uint8_t buff[2];
+
+	if (0 != consRead(dev, add, buff, 2, 0x03))
 	{
 		return -1;
 	}
-	*val = read;
+	memcpy(val, buff, 2);
+	return 0;
+}
+
+
+int i2cReadDWordAS(int dev, int add, uint32_t* val)
+{
+	uint8_t buff[4];
+
+	if (0 != consRead(dev, add, buff, 4, 0x03))
+	{
+		return -1;
+	}
+	memcpy(val, buff, 4);
 	return 0;
 }
 
@@ -206,24 +553,11 @@ int i2cReadDWord(int dev, int add, uint32_t* val)
 int i2cReadIntAS(int dev, int add, int* val)
 {
 	uint8_t buff[4];
-	int read = 50000;
-	int valA = 60000;
-	int retry = SPURIOUS_RETRY;
-	
-	while ( ((read & 0xfffffffc) != (valA & 0xfffffffc)) && (retry > 0))
-	{
-		retry--;
-		valA = read;
-		if (0 != i2cMem8Read(dev, add, buff, 4))
-		{
-			return -1;
-		}
-		memcpy(&read, buff, 4);
-	}
-	if (retry == 0)
+
+	if (0 != consRead(dev, add, buff, 4, 0x03))
 	{
 		return -1;
 	}
-	*val = read;
+	memcpy(val, buff, 4);
 	return 0;
 }
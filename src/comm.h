@@ -2,10 +2,31 @@
 #define COMM_H_
 
 #include <stdint.h>
+#include <sys/types.h>
 
-int i2cSetup(int addr);
+#define I2C_BLOCKS_MAX 16 // blocks in one transaction
+#define I2C_BLOCKS_SIZE_MAX 512 // bytes in one transaction, register addresses included
+
+typedef struct
+{
+	int add; // register address
+	uint8_t *buff;
+	int size;
+} I2cBlockType;
+
+const char *envGet(const char *name);
+uid_t privDrop(void);
+int privRestore(uid_t euid);
+void busLock(int bus);
+void busUnlock(int bus);
+int i2cSetup(int bus, int addr);
 int i2cMem8Read(int dev, int add, uint8_t* buff, int size);
+int i2cMem8ReadBus(int dev, int add, uint8_t* buff, int size);
 int i2cMem8Write(int dev, int add, uint8_t* buff, int size);
+int i2cMem8WriteBlocks(int dev, I2cBlockType* blk, int count);
+int i2cMem8ReadBlocks(int dev, I2cBlockType* blk, int count);
+int i2cMem8WriteVerify(int dev, int add, uint8_t* buff, const uint8_t* mask,
+	int size, int retries, int timeoutUs);
 int i2cReadByteAS(int dev, int add, uint8_t* val);
 int i2cReadWordAS(int dev, int add, uint16_t* val);
 int i2cReadDWord(int dev, int add, uint32_t* val);
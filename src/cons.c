@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+/*
+ * Read consistency policies, one per register address, applied by the
+ * i2cRead*AS() functions. The value policies (agreement, monotonic) apply to
+ * the reads up to 4 bytes, a longer read use one read unless its policy is
+ * CONS_BLOCK. The policies are process wide, set them before the boards are
+ * used from several threads. A read answered by the cache skips the policy,
+ * only the values that passed it are cached.
+ */
+
+#define CONS_SPURIOUS_RETRY 10
+#define CONS_COUNT_RATE 20000 // opto and gpio edges per second
+#define CONS_COUNT_SLACK 16
+
+static ConsPolicyType gConsPolicy[SLAVE_BUFF_SIZE + 1];
+static pthread_once_t gConsOnce = PTHREAD_ONCE_INIT;
+
+static void consRangeSet(int add, int size, int step, u8 type, u8 n, u8 m,
+	u32 limit)
+{
+	int i = 0;
+
+	for (i = add; i < add + size; i += step)
+	{
+		gConsPolicy[i].type = type;
+		gConsPolicy[i].n = n;
+		gConsPolicy[i].m = m;
+		gConsPolicy[i].limit = limit;
+	}
+}
+
+static void consDefaults(void)
+{
+	// inputs, outputs and encoders: two equal reads, the historic behavior
+	consRangeSet(0, SLAVE_BUFF_SIZE + 1, 1, CONS_AGREE, 2, CONS_SPURIOUS_RETRY, 0);
+	// configuration written by the host, no redundancy needed
+	consRangeSet(I2C_MEM_GPIO_DIR_ADD, 1, 1, CONS_SINGLE, 1, 1, 0);
+	consRangeSet(I2C_MEM_OD_PWM_VAL_RAW_ADD, OD_CH_NO * 2, 1, CONS_SINGLE, 1, 1,
+		0);
+	consRangeSet(I2C_MEM_OPTO_IT_RISING_ADD,
+		I2C_MEM_GPIO_EXT_IT_FALLING_ADD - I2C_MEM_OPTO_IT_RISING_ADD + 1, 1,
+		CONS_SINGLE, 1, 1, 0);
+	consRangeSet(I2C_MEM_OPTO_ENC_ENABLE_ADD, 2, 1, CONS_SINGLE, 1, 1, 0);
+	consRangeSet(I2C_MEM_OD_PWM_FREQUENCY, 2, 1, CONS_SINGLE, 1, 1, 0);
+	// edge counters only go up
+	consRangeSet(I2C_MEM_OPTO_EDGE_COUNT_ADD, COUNTER_SIZE * OPTO_CH_NO,
+	COUNTER_SIZE, CONS_MONOTONIC, 2, CONS_SPURIOUS_RETRY, CONS_COUNT_RATE);
+	consRangeSet(I2C_MEM_GPIO_EDGE_COUNT_ADD, COUNTER_SIZE * GPIO_CH_NO,
+	COUNTER_SIZE, CONS_MONOTONIC, 2, CONS_SPURIOUS_RETRY, CONS_COUNT_RATE);
+}
+
+/**
+ * Set the policy of the registers [add, add + size), a CONS_BLOCK policy
+ * needs at least two reads to compare
+ */
+int consPolicySet(int add, int size, ConsPolicyType *policy)
+{
+	if ( (NULL == policy) || (add < 0) || (size < 1)
+		|| (add + size > SLAVE_BUFF_SIZE + 1) || (policy->type >= CONS_NR)
+		|| (policy->m < 1) || (policy->m > CONS_READ_MAX) || (policy->n < 1)
+		|| (policy->n > policy->m)
+		|| ( (policy->type == CONS_BLOCK) && (policy->m < 2)))
+	{
+		return ERROR;
+	}
+	pthread_once(&gConsOnce, consDefaults);
+	consRangeSet(add, size, 1, policy->type, policy->n, policy->m, policy->limit);
+	return OK;
+}
+
+int consPolicyGet(int add, ConsPolicyType *policy)
+{
+	if ( (NULL == policy) || (add < 0) || (add > SLAVE_BUFF_SIZE))
+	{
+		return ERROR;
+	}
+	pthread_once(&gConsOnce, consDefaults);
+	memcpy(policy, &gConsPolicy[add], sizeof(ConsPolicyType));
+	return OK;
+}
+
+static u32 consVal(const u8 *buff, int size, u32 ignore)
+{
+	u32 val = 0;
+
+	memcpy(&val, buff, size);
+	return val & ~ignore;
+}
+
+/**
+ * Read until n values agree, at most m reads
+ * Params:
+ * 	done - reads already in vals
+ */
+static int consAgree(int dev, int add, u8 *buff, int size, u32 ignore,
+	int n, int m, u32 *vals, int done, int *reads)
+{
+	int i = 0;
+	int j = 0;
+	int equal = 0;
+	u8 rd[4];
+
+	for (i = done; i < m; i++)
+	{
+		if (OK != i2cMem8ReadBus(dev, add, rd, size))
+		{
+			return ERROR;
+		}
+		(*reads)++;
+		vals[i] = consVal(rd, size, ignore);
+		equal = 1;
+		for (j = 0; j < i; j++)
+		{
+			if (vals[j] == vals[i])
+			{
+				equal++;
+			}
+		}
+		if (equal >= n)
+		{
+			memcpy(buff, rd, size);
+			return OK;
+		}
+	}
+	return ERROR;
+}
+
+static int consMonotonic(int dev, DevCtxType *ctx, int add, u8 *buff,
+	ConsPolicyType *p, int *reads)
+{
+	ConsLastType *last = &ctx->consLast[add];
+	u32 vals[CONS_READ_MAX];
+	uint64_t now = 0;
+	uint64_t allowed = 0;
+	u32 val = 0;
+	int ret = OK;
+
+	if (last->valid)
+	{
+		if (OK != i2cMem8ReadBus(dev, add, buff, COUNTER_SIZE))
+		{
+			return ERROR;
+		}
+		(*reads)++;
+		now = getTimeUs();
+		val = consVal(buff, COUNTER_SIZE, 0);
+		allowed = (uint64_t)p->limit * (now - last->us) / 1000000
+			+ CONS_COUNT_SLACK;
+		if ( (u32) (val - last->val) <= allowed)
+		{
+			last->val = val;
+			last->us = now;
+			return OK;
+		}
+		// reset or spurious value, the agreement decide
+		vals[0] = val;
+		ret = consAgree(dev, add, buff, COUNTER_SIZE, 0, 2, p->m, vals, 1, reads);
+	}
+	else
+	{
+		ret = consAgree(dev, add, buff, COUNTER_SIZE, 0, 2, p->m, vals, 0, reads);
+	}
+	if (ret == OK)
+	{
+		last->val = consVal(buff, COUNTER_SIZE, 0);
+		last->us = getTimeUs();
+		last->valid = 1;
+	}
+	return ret;
+}
+
+static int consBlock(int dev, int add, u8 *buff, int size, int m, int *reads)
+{
+	u8 rd[SLAVE_BUFF_SIZE + 1];
+	int i = 0;
+
+	if (OK != i2cMem8ReadBus(dev, add, buff, size))
+	{
+		return ERROR;
+	}
+	(*reads)++;
+	for (i = 1; i < m; i++)
+	{
+		if (OK != i2cMem8ReadBus(dev, add, rd, size))
+		{
+			return ERROR;
+		}
+		(*reads)++;
+		if (0 == memcmp(rd, buff, size))
+		{
+			return OK;
+		}
+		memcpy(buff, rd, size);
+	}
+	return ERROR;
+}
+
+/**
+ * Read a register with the policy of its address
+ * Params:
+ * 	ignore - low bits of a value up to 4 bytes that may differ between reads
+ */
+int consRead(int dev, int add, u8 *buff, int size, u32 ignore)
+{
+	DevCtxType *ctx = devGet(dev);
+	ConsPolicyType *p = NULL;
+	u32 vals[CONS_READ_MAX];
+	int type = CONS_SINGLE;
+	int reads = 0;
+	int min = 1;
+	int ret = OK;
+
+	if ( (NULL == buff) || (add < 0) || (size < 1)
+		|| (add + size > SLAVE_BUFF_SIZE + 1))
+	{
+		return ERROR;
+	}
+	if (OK == cacheGet(dev, add, buff, size))
+	{
+		return OK;
+	}
+	pthread_once(&gConsOnce, consDefaults);
+	p = &gConsPolicy[add];
+	type = p->type;
+	if ( (size > 4) && (type != CONS_BLOCK))
+	{
+		type = CONS_SINGLE;
+	}
+	if ( (type == CONS_MONOTONIC) && ( (size != COUNTER_SIZE) || (NULL == ctx)))
+	{
+		type = CONS_AGREE;
+	}
+	switch (type)
+	{
+	case CONS_AGREE:
+		min = p->n;
+		ret = consAgree(dev, add, buff, size, ignore, p->n, p->m, vals, 0,
+			&reads);
+		break;
+	case CONS_MONOTONIC:
+		ret = consMonotonic(dev, ctx, add, buff, p, &reads);
+		break;
+	case CONS_BLOCK:
+		min = 2;
+		ret = consBlock(dev, add, buff, size, p->m, &reads);
+		break;
+	default:
+		ret = i2cMem8ReadBus(dev, add, buff, size);
+		reads = 1;
+		break;
+	}
+	if (ctx)
+	{
+		ctx->cons[type].calls++;
+		ctx->cons[type].reads += (u32)reads;
+		if (reads > min)
+		{
+			ctx->cons[type].retries += (u32) (reads - min);
+		}
+		if (ret != OK)
+		{
+			ctx->cons[type].failures++;
+		}
+	}
+	if (ret == OK)
+	{
+		cachePut(dev, add, buff, size);
+	}
+	return ret;
+}
@@ -0,0 +1,1428 @@
+#define _GNU_SOURCE // struct ucred
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "scan.h"
+#include "evloop.h"
+#include "daemon.h"
+
+/*
+ * Resident service: one event loop thread serves the clients of a unix
+ * socket and polls the boards periodically, one I/O thread per adapter does
+ * all the transfers. The clients send text lines and get one line back:
+ * 	read <bus>:<stack> <add> <size>		ok <hex byte>...
+ * 	write <bus>:<stack> <add> <hex byte>...	ok
+ * 	image <bus>:<stack> <add> <size>	ok <age_ms> <hex byte>...
+ * 	stat					ok <counters>
+ * 	sub <bus>:<stack> <bit signal> <mask>	ok <filter>
+ * 	sub <bus>:<stack> <value signal> <ch> <deadband>
+ * 	subpolicy <drop/coalesce>		ok
+ * 	substat					ok <counters>
+ * 	unsub					ok
+ * 	ring <bus>:<stack>			ok <shared memory name> <slots>
+ * 	metrics					ok <lines>, followed by the text metrics
+ * 	quit
+ * "image" answers from the last poll without using the bus. The requests of
+ * one client are answered in order, errors are "err <reason>". The reads of
+ * several clients on the same board, gathered during the coalescing window or
+ * while the previous merged read was on the bus, are served by one transfer
+ * covering all of them when their union spans DMN_MERGE_SPAN registers at
+ * most; the transfer starts after every one of them arrived. The changes
+ * that pass the filters of a subscriber are sent between the answers as
+ * "ev <bus>:<stack> <signal> <ch> <value>" lines, see sub.c. A client that
+ * needs faster output writes asks for a command ring in shared memory, see
+ * ring.c; the ring is removed when the client disconnects. The boards of an
+ * adapter are polled together, every period the output stage writes the
+ * commands queued in the rings and the "write" requests received for all of
+ * them back to back in one bus lock session, by stack level, before their
+ * images are read; a "write" is answered once the next stage is done. The
+ * lists of rings and writes belong to the loop thread, the stage is a copy
+ * taken when it starts.
+ */
+
+static DmnType gDmn;
+
+static DmnBoardType* dmnBoardFind(DmnType *d, const char *id)
+{
+	int bus = I2C_BUS_DEFAULT;
+	int stack = 0;
+	int i = 0;
+
+	if (OK != boardIdParse(id, &bus, &stack))
+	{
+		return NULL;
+	}
+	for (i = 0; i < d->boards; i++)
+	{
+		if ( (d->board[i].bus == bus) && (d->board[i].stack == stack))
+		{
+			return &d->board[i];
+		}
+	}
+	return NULL;
+}
+
+static void dmnClientEvents(DmnClientType *c)
+{
+	u32 events = 0;
+
+	if (c->inLen < DMN_LINE_MAX)
+	{
+		events |= EPOLLIN;
+	}
+	if (c->outLen > 0)
+	{
+		events |= EPOLLOUT;
+	}
+	if (events != c->events)
+	{
+		evMod(&c->dmn->loop, c->fd, events);
+		c->events = events;
+	}
+}
+
+static void dmnSubUnlink(DmnClientType *c)
+{
+	DmnClientType **p = &c->dmn->subs;
+
+	if (!c->subscribed)
+	{
+		return;
+	}
+	while ( (NULL != *p) && (*p != c))
+	{
+		p = & (*p)->subNext;
+	}
+	if (NULL != *p)
+	{
+		*p = c->subNext;
+	}
+	c->subNext = NULL;
+	c->subscribed = 0;
+}
+
+static void dmnRingRelease(DmnClientType *c)
+{
+	DmnBoardType *b = c->ringBoard;
+	DmnClientType **p = NULL;
+
+	if ( (NULL == c->ring) || (NULL == b))
+	{
+		return;
+	}
+	for (p = &b->rings; (NULL != *p) && (*p != c); p = & (*p)->ringNext)
+		;
+	if (NULL != *p)
+	{
+		*p = c->ringNext;
+	}
+	c->ringNext = NULL;
+	c->ringBoard = NULL;
+	if (c->ringStaged)
+	{
+		// the output stage in progress still drains it
+		c->ringRelease = 1;
+		return;
+	}
+	ringDestroy(c->ring, c->ringName);
+	c->ring = NULL;
+}
+
+static void dmnClientFree(DmnClientType *c)
+{
+	c->dmn->clients--;
+	free(c);
+}
+
+/**
+ * Close the connection, the client memory is released when its bus request
+ * and the output stage draining its ring complete
+ */
+static void dmnClientClose(DmnClientType *c)
+{
+	dmnSubUnlink(c);
+	dmnRingRelease(c);
+	if (c->fd >= 0)
+	{
+		evDel(&c->dmn->loop, c->fd);
+		close(c->fd);
+		c->fd = -1;
+	}
+	if (!c->busy && !c->ringStaged)
+	{
+		dmnClientFree(c);
+	}
+}
+
+/**
+ * Send the pending output, return ERROR if the client is gone
+ */
+static int dmnClientFlush(DmnClientType *c)
+{
+	ssize_t n = 0;
+
+	while (c->outLen > 0)
+	{
+		n = send(c->fd, c->out, (size_t)c->outLen, MSG_NOSIGNAL);
+		if (n < 0)
+		{
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK))
+			{
+				break;
+			}
+			return ERROR;
+		}
+		memmove(c->out, &c->out[n], (size_t) (c->outLen - n));
+		c->outLen -= (int)n;
+	}
+	return OK;
+}
+
+static void dmnReply(DmnClientType *c, const char *fmt, ...)
+{
+	va_list ap;
+	int n = 0;
+
+	if (c->fd < 0)
+	{
+		return;
+	}
+	va_start(ap, fmt);
+	n = vsnprintf(&c->out[c->outLen], (size_t) (DMN_OUT_MAX - c->outLen), fmt,
+		ap);
+	va_end(ap);
+	if ( (n < 0) || (c->outLen + n >= DMN_OUT_MAX))
+	{
+		// a client that does not read its answers is dropped
+		c->overflow = 1;
+		return;
+	}
+	c->outLen += n;
+}
+
+static void dmnReplyHex(DmnClientType *c, const u8 *buff, int size)
+{
+	int i = 0;
+
+	for (i = 0; i < size; i++)
+	{
+		dmnReply(c, " %02x", buff[i]);
+	}
+	dmnReply(c, "\n");
+}
+
+/**
+ * Move the queued events to the output while it has room, the others stay
+ * in the bounded subscriber queue
+ */
+static void dmnSubDrain(DmnClientType *c)
+{
+	DmnType *d = c->dmn;
+	DmnBoardType *b = NULL;
+	SubEventType ev;
+
+	while ( (c->outLen < DMN_OUT_MAX - DMN_EV_LINE_MAX)
+		&& (OK == subPop(&c->sub, &ev)))
+	{
+		b = &d->board[ev.board];
+		dmnReply(c, "ev %d:%d %s %d %d\n", b->bus, b->stack, subSigName(ev.sig),
+			ev.ch, (int)ev.val);
+	}
+}
+
+static void dmnClientWork(EvJobType *job)
+{
+	DmnClientType *c = (DmnClientType*)job->arg;
+
+	job->ret = i2cMem8Read(c->board->dev, c->add, c->data, c->size);
+}
+
+static void dmnClientInput(DmnClientType *c);
+
+static void dmnClientDone(EvJobType *job)
+{
+	DmnClientType *c = (DmnClientType*)job->arg;
+
+	c->busy = 0;
+	if (c->fd < 0)
+	{
+		if (!c->ringStaged)
+		{
+			dmnClientFree(c);
+		}
+		return;
+	}
+	if (job->ret != OK)
+	{
+		dmnReply(c, "err transfer failed\n");
+	}
+	else if (c->isWrite)
+	{
+		dmnReply(c, "ok\n");
+	}
+	else
+	{
+		dmnReply(c, "ok");
+		dmnReplyHex(c, c->data, c->size);
+	}
+	dmnClientInput(c);
+}
+
+static void dmnReadWork(EvJobType *job)
+{
+	DmnBoardType *b = (DmnBoardType*)job->arg;
+
+	job->ret = i2cMem8Read(b->dev, b->flLo, &b->rdData[b->flLo],
+		b->flHi - b->flLo);
+}
+
+static void dmnReadStart(DmnBoardType *b)
+{
+	b->rdFlight = b->rdWait;
+	b->flLo = b->rdLo;
+	b->flHi = b->rdHi;
+	b->rdWait = NULL;
+	b->rdBusy = 1;
+	b->transfers++;
+	evIoSubmit(b->io, &b->rdJob);
+}
+
+/**
+ * Fan the merged read out to its waiters, their next requests are gathered
+ * for the following transfer
+ */
+static void dmnReadDone(EvJobType *job)
+{
+	DmnBoardType *b = (DmnBoardType*)job->arg;
+	DmnClientType *c = NULL;
+	DmnClientType *next = NULL;
+
+	for (c = b->rdFlight; c != NULL; c = next)
+	{
+		next = c->rdNext;
+		c->rdNext = NULL;
+		c->busy = 0;
+		if (c->fd < 0)
+		{
+			dmnClientFree(c);
+			continue;
+		}
+		if (job->ret != OK)
+		{
+			dmnReply(c, "err transfer failed\n");
+		}
+		else
+		{
+			dmnReply(c, "ok");
+			dmnReplyHex(c, &b->rdData[c->add], c->size);
+		}
+		dmnClientInput(c);
+	}
+	b->rdFlight = NULL;
+	b->rdBusy = 0;
+	if ( (NULL != b->rdWait) && !b->rdArmed)
+	{
+		dmnReadStart(b);
+	}
+}
+
+static void dmnReadTimerCb(EvLoopType *loop UNU, int fd UNU, u32 events UNU,
+	void *arg)
+{
+	DmnBoardType *b = (DmnBoardType*)arg;
+
+	b->rdArmed = 0;
+	if ( (NULL != b->rdWait) && !b->rdBusy)
+	{
+		dmnReadStart(b);
+	}
+}
+
+/**
+ * Add the read of a client to the one gathered for its board
+ * Return ERROR if the union of the ranges would be too large
+ */
+static int dmnReadMerge(DmnClientType *c, DmnBoardType *b)
+{
+	int lo = c->add;
+	int hi = c->add + c->size;
+
+	if (NULL != b->rdWait)
+	{
+		lo = lo < b->rdLo ? lo : b->rdLo;
+		hi = hi > b->rdHi ? hi : b->rdHi;
+		if (hi - lo > DMN_MERGE_SPAN)
+		{
+			return ERROR;
+		}
+	}
+	else if ( (c->dmn->windowUs > 0)
+		&& (OK == evTimerArm(b->rdTimer, c->dmn->windowUs)))
+	{
+		b->rdArmed = 1;
+	}
+	c->rdNext = b->rdWait;
+	b->rdWait = c;
+	b->rdLo = lo;
+	b->rdHi = hi;
+	if (!b->rdArmed && !b->rdBusy)
+	{
+		dmnReadStart(b);
+	}
+	return OK;
+}
+
+static int dmnArgRange(char *add, char *size, int *a, int *s)
+{
+	*a = (int)strtol(add, NULL, 0);
+	*s = (int)strtol(size, NULL, 0);
+	if ( (*a < 0) || (*s < 1) || (*s > DMN_DATA_MAX)
+		|| (*a + *s > SCAN_MEM_SIZE))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+/**
+ * sub <bus>:<stack> <signal> <mask> | sub <bus>:<stack> <signal> <ch> <deadband>
+ */
+static void dmnSubRequest(DmnClientType *c, int argc, char *argv[])
+{
+	DmnType *d = c->dmn;
+	DmnBoardType *b = NULL;
+	int sig = 0;
+	int idx = 0;
+
+	b = argc > 1 ? dmnBoardFind(d, argv[1]) : NULL;
+	sig = argc > 2 ? subSigParse(argv[2]) : ERROR;
+	if ( (NULL == b) || (sig < 0))
+	{
+		dmnReply(c, "err unknown board or signal\n");
+		return;
+	}
+	if (subSigChannels(sig) == 0)
+	{
+		idx = argc == 4 ?
+			subFilterAdd(&c->sub, b->idx, sig, 0,
+				(u32)strtoul(argv[3], NULL, 0)) : ERROR;
+	}
+	else
+	{
+		idx = argc == 5 ?
+			subFilterAdd(&c->sub, b->idx, sig, atoi(argv[3]),
+				(u32)strtoul(argv[4], NULL, 0)) : ERROR;
+	}
+	if (idx < 0)
+	{
+		dmnReply(c, "err invalid filter\n");
+		return;
+	}
+	if (!c->subscribed)
+	{
+		c->subNext = d->subs;
+		d->subs = c;
+		c->subscribed = 1;
+	}
+	dmnReply(c, "ok %d\n", idx);
+}
+
+/**
+ * ring <bus>:<stack>
+ */
+static void dmnRingRequest(DmnClientType *c, DmnBoardType *b)
+{
+	DmnType *d = c->dmn;
+	DmnClientType **p = NULL;
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (NULL != c->ring)
+	{
+		dmnReply(c, "err ring already open\n");
+		return;
+	}
+	// the ring belongs to the client process, not to the service user
+	if (0 != getsockopt(c->fd, SOL_SOCKET, SO_PEERCRED, &cred, &len))
+	{
+		dmnReply(c, "err can not create the ring\n");
+		return;
+	}
+	snprintf(c->ringName, sizeof(c->ringName), "/plcpi-%d-%u", (int)getpid(),
+		(unsigned int)d->ringSeq++);
+	c->ring = ringCreate(c->ringName, b->bus, b->stack, cred.uid, cred.gid);
+	if (NULL == c->ring)
+	{
+		dmnReply(c, "err can not create the ring\n");
+		return;
+	}
+	c->ringBoard = b;
+	// appended, the rings of a board are drained in creation order
+	for (p = &b->rings; NULL != *p; p = & (*p)->ringNext)
+		;
+	c->ringNext = NULL;
+	*p = c;
+	dmnReply(c, "ok %s %d\n", c->ringName, RING_SLOTS);
+}
+
+/**
+ * Cycle timing of every adapter as text metrics
+ */
+static void dmnMetrics(DmnClientType *c)
+{
+	DmnType *d = c->dmn;
+	CycleStatType cyc[SCAN_BUS_MAX];
+	char label[SCAN_BUS_MAX][16];
+	const char *labels[SCAN_BUS_MAX];
+	char m[DMN_OUT_MAX];
+	int lines = 0;
+	int len = 0;
+	int i = 0;
+
+	for (i = 0; i < d->adapters; i++)
+	{
+		memcpy(&cyc[i], &d->adapter[i].cyc, sizeof(CycleStatType));
+		snprintf(label[i], sizeof(label[i]), "bus=\"%d\"", d->adapter[i].bus);
+		labels[i] = label[i];
+	}
+	len = cycleStatExport(m, sizeof(m), cyc, labels, d->adapters);
+	if ( (len < 0) || (c->outLen + len + DMN_EV_LINE_MAX >= DMN_OUT_MAX))
+	{
+		dmnReply(c, "err metrics too large for the output buffer\n");
+		return;
+	}
+	for (i = 0; i < len; i++)
+	{
+		lines += m[i] == '\n';
+	}
+	dmnReply(c, "ok %d\n%s", lines, m);
+}
+
+/**
+ * Read cache counters of a board, all classes
+ */
+static void dmnCacheStat(DmnClientType *c, DmnBoardType *b)
+{
+	DevCtxType *ctx = devGet(b->dev);
+	u32 hits = 0;
+	u32 misses = 0;
+	int i = 0;
+
+	for (i = 0; (NULL != ctx) && (i < CACHE_NR); i++)
+	{
+		hits += ctx->cache[i].hits;
+		misses += ctx->cache[i].misses;
+	}
+	dmnReply(c, " cache hits %u misses %u", (unsigned int)hits,
+		(unsigned int)misses);
+}
+
+/**
+ * Execute one request line, the bus requests complete later
+ */
+static void dmnRequest(DmnClientType *c, char *line)
+{
+	DmnType *d = c->dmn;
+	DmnAdapterType *a = NULL;
+	DmnBoardType *b = NULL;
+	DmnClientType **p = NULL;
+	char *argv[DMN_ARG_MAX];
+	char *save = NULL;
+	int argc = 0;
+	int i = 0;
+
+	for (argv[argc] = strtok_r(line, " \t\r", &save);
+		(argv[argc] != NULL) && (argc < DMN_ARG_MAX - 1);
+		argv[++argc] = strtok_r(NULL, " \t\r", &save))
+		;
+	if (argc == 0)
+	{
+		return;
+	}
+	d->requests++;
+	if (strcasecmp(argv[0], "quit") == 0)
+	{
+		c->quit = 1;
+		return;
+	}
+	if (strcasecmp(argv[0], "stat") == 0)
+	{
+		dmnReply(c, "ok clients %d requests %u", d->clients,
+			(unsigned int)d->requests);
+		for (i = 0; i < d->boards; i++)
+		{
+			b = &d->board[i];
+			dmnReply(c, " %d:%d polls %u errors %u overruns %u reads %u"
+				" transfers %u", b->bus, b->stack, (unsigned int)b->polls,
+				(unsigned int)b->errors, (unsigned int)b->overruns,
+				(unsigned int)b->reads, (unsigned int)b->transfers);
+			dmnCacheStat(c, b);
+			dmnReply(c, " ring commands %u failed %u writes %u",
+				(unsigned int)b->ringCmds, (unsigned int)b->ringErrors,
+				(unsigned int)b->writes);
+			if (b->kaOn)
+			{
+				dmnReply(c, " wdt reloads %u failed %u",
+					(unsigned int)b->kaReloads, (unsigned int)b->kaErrors);
+			}
+		}
+		for (i = 0; i < d->adapters; i++)
+		{
+			a = &d->adapter[i];
+			dmnReply(c, " bus %d output stages %u multi-board %u skew us last %u"
+				" p99 %u max %u", a->bus, (unsigned int)a->stages,
+				(unsigned int)a->multi, (unsigned int)a->skewUs,
+				(unsigned int)histPercentile(&a->skew, 99),
+				(unsigned int)a->skew.max);
+		}
+		dmnReply(c, "\n");
+		return;
+	}
+	if (strcasecmp(argv[0], "metrics") == 0)
+	{
+		dmnMetrics(c);
+		return;
+	}
+	if (strcasecmp(argv[0], "sub") == 0)
+	{
+		dmnSubRequest(c, argc, argv);
+		return;
+	}
+	if (strcasecmp(argv[0], "unsub") == 0)
+	{
+		dmnSubUnlink(c);
+		subInit(&c->sub);
+		dmnReply(c, "ok\n");
+		return;
+	}
+	if ( (strcasecmp(argv[0], "subpolicy") == 0) && (argc == 2))
+	{
+		if (strcasecmp(argv[1], "drop") == 0)
+		{
+			c->sub.policy = SUB_DROP_OLDEST;
+		}
+		else if (strcasecmp(argv[1], "coalesce") == 0)
+		{
+			c->sub.policy = SUB_COALESCE;
+		}
+		else
+		{
+			dmnReply(c, "err invalid policy\n");
+			return;
+		}
+		dmnReply(c, "ok\n");
+		return;
+	}
+	if (strcasecmp(argv[0], "substat") == 0)
+	{
+		dmnReply(c, "ok filters %d events %u dropped %u coalesced %u queued %d\n",
+			c->sub.filters, (unsigned int)c->sub.events,
+			(unsigned int)c->sub.dropped, (unsigned int)c->sub.coalesced,
+			c->sub.count);
+		return;
+	}
+	if (argc < 2)
+	{
+		dmnReply(c, "err invalid request\n");
+		return;
+	}
+	b = dmnBoardFind(d, argv[1]);
+	if (NULL == b)
+	{
+		dmnReply(c, "err unknown board\n");
+		return;
+	}
+	if ( (strcasecmp(argv[0], "ring") == 0) && (argc == 2))
+	{
+		dmnRingRequest(c, b);
+		return;
+	}
+	if ( (strcasecmp(argv[0], "image") == 0) && (argc == 4))
+	{
+		if (OK != dmnArgRange(argv[2], argv[3], &c->add, &c->size))
+		{
+			dmnReply(c, "err invalid range\n");
+			return;
+		}
+		dmnReply(c, "ok %u",
+			b->polls ? (unsigned int) ( (getTimeUs() - b->stampUs) / 1000) : 0);
+		dmnReplyHex(c, &b->mem[c->add], c->size);
+		return;
+	}
+	if ( (strcasecmp(argv[0], "read") == 0) && (argc == 4))
+	{
+		if (OK != dmnArgRange(argv[2], argv[3], &c->add, &c->size))
+		{
+			dmnReply(c, "err invalid range\n");
+			return;
+		}
+		c->isWrite = 0;
+	}
+	else if ( (strcasecmp(argv[0], "write") == 0) && (argc >= 4)
+		&& (argc - 3 <= DMN_DATA_MAX))
+	{
+		c->add = (int)strtol(argv[2], NULL, 0);
+		c->size = argc - 3;
+		if ( (c->add < 0) || (c->add + c->size > SCAN_MEM_SIZE))
+		{
+			dmnReply(c, "err invalid range\n");
+			return;
+		}
+		for (i = 0; i < c->size; i++)
+		{
+			c->data[i] = (u8)strtol(argv[3 + i], NULL, 16);
+		}
+		c->isWrite = 1;
+	}
+	else
+	{
+		dmnReply(c, "err invalid request\n");
+		return;
+	}
+	c->board = b;
+	c->busy = 1;
+	if (c->isWrite)
+	{
+		// executed by the next output stage of the adapter, after the rings
+		for (p = &b->wrWait; NULL != *p; p = & (*p)->wrNext)
+			;
+		c->wrNext = NULL;
+		*p = c;
+		c->job.arg = c;
+		return;
+	}
+	b->reads++;
+	if (OK == dmnReadMerge(c, b))
+	{
+		return;
+	}
+	b->transfers++;
+	c->job.work = dmnClientWork;
+	c->job.done = dmnClientDone;
+	c->job.arg = c;
+	evIoSubmit(b->io, &c->job);
+}
+
+/**
+ * Execute the complete lines received, one bus request at a time
+ */
+static void dmnClientInput(DmnClientType *c)
+{
+	char *nl = NULL;
+	int len = 0;
+
+	while (!c->busy && !c->quit && !c->overflow
+		&& (NULL != (nl = memchr(c->in, '\n', (size_t)c->inLen))))
+	{
+		*nl = 0;
+		len = (int) (nl - c->in) + 1;
+		dmnRequest(c, c->in);
+		memmove(c->in, &c->in[len], (size_t) (c->inLen - len));
+		c->inLen -= len;
+	}
+	if ( (c->inLen == DMN_LINE_MAX)
+		&& (NULL == memchr(c->in, '\n', (size_t)c->inLen)))
+	{
+		dmnReply(c, "err line too long\n");
+		c->quit = 1;
+	}
+	dmnSubDrain(c);
+	if (c->overflow || (OK != dmnClientFlush(c))
+		|| (c->quit && (c->outLen == 0)))
+	{
+		dmnClientClose(c);
+		return;
+	}
+	dmnClientEvents(c);
+}
+
+static void dmnClientCb(EvLoopType *loop UNU, int fd, u32 events, void *arg)
+{
+	DmnClientType *c = (DmnClientType*)arg;
+	ssize_t n = 0;
+
+	if (events & (EPOLLERR | EPOLLHUP))
+	{
+		dmnClientClose(c);
+		return;
+	}
+	if ( (events & EPOLLIN) && (c->inLen < DMN_LINE_MAX))
+	{
+		n = read(fd, &c->in[c->inLen], (size_t) (DMN_LINE_MAX - c->inLen));
+		if ( (n == 0) || ( (n < 0) && (errno != EAGAIN)))
+		{
+			dmnClientClose(c);
+			return;
+		}
+		if (n > 0)
+		{
+			c->inLen += (int)n;
+		}
+	}
+	dmnClientInput(c);
+}
+
+static void dmnAcceptCb(EvLoopType *loop, int fd, u32 events UNU, void *arg)
+{
+	DmnType *d = (DmnType*)arg;
+	DmnClientType *c = NULL;
+	int cfd = -1;
+
+	while ( (cfd = accept(fd, NULL, NULL)) >= 0)
+	{
+		c = calloc(1, sizeof(DmnClientType));
+		if ( (NULL == c) || (d->clients >= DMN_CLIENT_MAX)
+			|| (0 != fcntl(cfd, F_SETFL, O_NONBLOCK))
+			|| (OK != evAdd(loop, cfd, EPOLLIN, dmnClientCb, c)))
+		{
+			free(c);
+			close(cfd);
+			continue;
+		}
+		c->fd = cfd;
+		c->dmn = d;
+		c->events = EPOLLIN;
+		d->clients++;
+	}
+}
+
+static void dmnPollWork(EvJobType *job)
+{
+	DmnBoardType *b = (DmnBoardType*)job->arg;
+	uint64_t t0 = getTimeUs();
+
+	job->ret = scanAreasRead(b->dev, b->rd);
+	b->adapter->cycBusUs += getTimeUs() - t0;
+}
+
+/**
+ * Output stage of an adapter: the ring commands and socket writes staged for
+ * all its boards, written back to back by stack level with the bus locked
+ * once. Only the stage entries are touched here, the loop thread accounts
+ * them when the stage is done.
+ */
+static void dmnOutWork(EvJobType *job)
+{
+	DmnAdapterType *a = (DmnAdapterType*)job->arg;
+	DmnStageType *e = NULL;
+	DmnBoardType *prev = NULL;
+	DmnBoardType *b = NULL;
+	uint64_t t0 = getTimeUs();
+	uint64_t first = 0;
+	uint64_t last = 0;
+	int updated = 0;
+	int i = 0;
+
+	a->outBoards = 0;
+	for (i = 0; i < a->staged; i++)
+	{
+		e = &a->stage[i];
+		if (e->board != prev)
+		{
+			prev = e->board;
+			updated = 0;
+		}
+		e->errors = 0;
+		if (e->isRing)
+		{
+			e->ret = ringDrain(e->client->ring, e->board->dev, &e->errors);
+		}
+		else
+		{
+			e->ret = i2cMem8Write(e->board->dev, e->client->add, e->client->data,
+				e->client->size);
+		}
+		if ( (e->isRing && (e->ret > 0)) || (!e->isRing && (e->ret == OK)))
+		{
+			last = getTimeUs();
+			if (!updated && (a->outBoards++ == 0))
+			{
+				first = last;
+			}
+			updated = 1;
+		}
+	}
+	a->outSkewUs = a->outBoards > 1 ? (u32) (last - first) : 0;
+	for (i = 0; i < a->boards; i++)
+	{
+		b = a->board[i];
+		// the watchdog reload, when due, share the output bus session
+		b->kaRet = b->kaOn ? wdtKaService(&b->ka, getTimeUs()) : 0;
+	}
+	a->cycBusUs += getTimeUs() - t0;
+	job->ret = OK;
+}
+
+/**
+ * Take the rings and the waiting socket writes of the boards in the stage,
+ * by stack level; a write that does not fit waits for the next stage
+ */
+static void dmnStageTake(DmnAdapterType *a)
+{
+	DmnStageType *e = NULL;
+	DmnBoardType *b = NULL;
+	DmnClientType *c = NULL;
+	int i = 0;
+
+	a->staged = 0;
+	for (i = 0; i < a->boards; i++)
+	{
+		b = a->board[i];
+		for (c = b->rings; (c != NULL) && (a->staged < DMN_STAGE_MAX);
+			c = c->ringNext)
+		{
+			e = &a->stage[a->staged++];
+			e->board = b;
+			e->client = c;
+			e->isRing = 1;
+			c->ringStaged = 1;
+		}
+		while ( (b->wrWait != NULL) && (a->staged < DMN_STAGE_MAX))
+		{
+			c = b->wrWait;
+			b->wrWait = c->wrNext;
+			c->wrNext = NULL;
+			e = &a->stage[a->staged++];
+			e->board = b;
+			e->client = c;
+			e->isRing = 0;
+		}
+	}
+}
+
+/**
+ * One job of the cycle done, the last one ends the cycle
+ */
+static void dmnCycleJobDone(DmnAdapterType *a)
+{
+	if ( (a->cycJobs > 0) && (--a->cycJobs == 0))
+	{
+		cycleStatAdd(&a->cyc, a->cycSchedUs, a->cycStartUs, a->cycBusUs,
+			getTimeUs());
+	}
+}
+
+static void dmnOutDone(EvJobType *job)
+{
+	DmnAdapterType *a = (DmnAdapterType*)job->arg;
+	DmnStageType *e = NULL;
+	DmnBoardType *b = NULL;
+	DmnClientType *c = NULL;
+	int i = 0;
+
+	a->outPending = 0;
+	if (a->outBoards > 0)
+	{
+		a->stages++;
+	}
+	if (a->outBoards > 1)
+	{
+		a->multi++;
+		a->skewUs = a->outSkewUs;
+		histAdd(&a->skew, a->skewUs);
+	}
+	for (i = 0; i < a->staged; i++)
+	{
+		e = &a->stage[i];
+		c = e->client;
+		if (!e->isRing)
+		{
+			e->board->writes++;
+			c->job.ret = e->ret;
+			dmnClientDone(&c->job);
+			continue;
+		}
+		e->board->ringCmds += (u32)e->ret;
+		e->board->ringErrors += e->errors;
+		c->ringStaged = 0;
+		if (c->ringRelease)
+		{
+			ringDestroy(c->ring, c->ringName);
+			c->ring = NULL;
+			c->ringRelease = 0;
+		}
+		if ( (c->fd < 0) && !c->busy)
+		{
+			dmnClientFree(c);
+		}
+	}
+	a->staged = 0;
+	for (i = 0; i < a->boards; i++)
+	{
+		b = a->board[i];
+		if (b->kaRet == ERROR)
+		{
+			b->kaErrors++;
+		}
+		else if (b->kaRet > 0)
+		{
+			b->kaReloads++;
+		}
+	}
+	dmnCycleJobDone(a);
+}
+
+static void dmnPollDone(EvJobType *job)
+{
+	DmnBoardType *b = (DmnBoardType*)job->arg;
+	DmnClientType *c = NULL;
+	DmnClientType *next = NULL;
+
+	b->pending = 0;
+	if (job->ret != OK)
+	{
+		b->errors++;
+		dmnCycleJobDone(b->adapter);
+		return;
+	}
+	memcpy(b->mem, b->rd, SCAN_MEM_SIZE);
+	b->stampUs = getTimeUs();
+	b->polls++;
+	// the filters are evaluated once per scan, in the loop thread
+	for (c = b->dmn->subs; c != NULL; c = next)
+	{
+		next = c->subNext;
+		if (subEval(&c->sub, b->idx, b->mem, b->stampUs) > 0)
+		{
+			dmnClientInput(c);
+		}
+	}
+	dmnCycleJobDone(b->adapter);
+}
+
+static void dmnPollCb(EvLoopType *loop UNU, int fd UNU, u32 events, void *arg)
+{
+	DmnAdapterType *a = (DmnAdapterType*)arg;
+	DmnBoardType *b = NULL;
+	uint64_t now = getTimeUs();
+	int i = 0;
+
+	// the last of the expirations is the start of this cycle
+	a->cycSchedUs = a->schedUs + (uint64_t) (events - 1) * a->periodUs;
+	a->schedUs = a->cycSchedUs + a->periodUs;
+	// more than one expiration or the last cycle not done: periods skipped
+	if (a->cycJobs > 0)
+	{
+		a->cyc.overruns += events;
+		for (i = 0; i < a->boards; i++)
+		{
+			a->board[i]->overruns += events;
+		}
+		return;
+	}
+	a->cyc.overruns += events - 1;
+	a->cycStartUs = now;
+	a->cycBusUs = 0;
+	// the outputs first, the images read afterwards show them
+	dmnStageTake(a);
+	a->outPending = 1;
+	a->cycJobs = 1;
+	evIoSubmit(&a->io, &a->out);
+	for (i = 0; i < a->boards; i++)
+	{
+		b = a->board[i];
+		b->overruns += events - 1;
+		b->pending = 1;
+		a->cycJobs++;
+		evIoSubmit(b->io, &b->poll);
+	}
+}
+
+static void dmnSignalCb(EvLoopType *loop, int fd UNU, u32 events UNU,
+	void *arg UNU)
+{
+	evStop(loop);
+}
+
+/*
+ * Remove the socket file of the service, any other file is left alone. Called
+ * as the user who started the service
+ */
+static void dmnSockRemove(const char *path)
+{
+	struct stat st;
+
+	if ( (0 == lstat(path, &st)) && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+}
+
+static int dmnListen(const char *path)
+{
+	struct sockaddr_un sa;
+	mode_t mask = 0;
+	uid_t euid = 0;
+	int fd = -1;
+	int ret = 0;
+
+	if (strlen(path) >= sizeof(sa.sun_path))
+	{
+		return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		return -1;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, path, sizeof(sa.sun_path) - 1);
+	// the socket of a previous run is replaced, the new one is owned by the
+	// user who started the service
+	euid = privDrop();
+	if (euid == (uid_t)-1)
+	{
+		close(fd);
+		return -1;
+	}
+	dmnSockRemove(path);
+	mask = umask((mode_t) ~DMN_SOCK_MODE & 0777);
+	ret = bind(fd, (struct sockaddr*)&sa, sizeof(sa));
+	umask(mask);
+	if ( (privRestore(euid) != OK) || (0 != ret)
+		|| (0 != listen(fd, DMN_BACKLOG)))
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * I/O thread and poll timer of an adapter, the timer is started once all the
+ * boards are open
+ */
+static DmnAdapterType* dmnAdapterGet(DmnType *d, int bus, int periodUs)
+{
+	DmnAdapterType *a = NULL;
+	int i = 0;
+
+	for (i = 0; i < d->adapters; i++)
+	{
+		if (d->adapter[i].bus == bus)
+		{
+			return &d->adapter[i];
+		}
+	}
+	if (d->adapters >= SCAN_BUS_MAX)
+	{
+		return NULL;
+	}
+	a = &d->adapter[d->adapters];
+	a->dmn = d;
+	a->bus = bus;
+	a->pollFd = -1;
+	a->periodUs = periodUs;
+	histInit(&a->skew);
+	a->out.work = dmnOutWork;
+	a->out.done = dmnOutDone;
+	a->out.arg = a;
+	if (OK != evIoStart(&d->loop, &a->io, bus))
+	{
+		return NULL;
+	}
+	d->adapters++;
+	a->pollFd = evTimerAdd(&d->loop, 0, dmnPollCb, a);
+	if (a->pollFd < 0)
+	{
+		return NULL;
+	}
+	return a;
+}
+
+/**
+ * Start the poll timers, the cycles are scheduled from now on
+ */
+static int dmnAdaptersStart(DmnType *d)
+{
+	DmnAdapterType *a = NULL;
+	int i = 0;
+
+	for (i = 0; i < d->adapters; i++)
+	{
+		a = &d->adapter[i];
+		a->schedUs = getTimeUs() + (uint64_t)a->periodUs;
+		if (OK != evTimerStart(a->pollFd, a->periodUs))
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+/**
+ * Open the boards and start one I/O thread per adapter
+ */
+static int dmnBoardsOpen(DmnType *d, char *list, int periodUs)
+{
+	DmnAdapterType *a = NULL;
+	DmnBoardType *b = NULL;
+	char *tok = NULL;
+	char *save = NULL;
+	int bus = 0;
+	int stack = 0;
+	int i = 0;
+
+	for (tok = strtok_r(list, ",", &save); tok != NULL;
+		tok = strtok_r(NULL, ",", &save))
+	{
+		bus = I2C_BUS_DEFAULT;
+		if ( (OK != boardIdParse(tok, &bus, &stack))
+			|| (d->boards >= SCAN_BOARD_MAX))
+		{
+			printf("Invalid board id \"%s\" or too many boards!\n", tok);
+			return ARG_ERR;
+		}
+		b = &d->board[d->boards];
+		b->dmn = d;
+		b->idx = d->boards;
+		b->bus = bus;
+		b->stack = stack;
+		busLock(bus);
+		b->dev = doBoardOpen(bus, stack);
+		if ( (b->dev > 0) && (d->kaPercent > 0))
+		{
+			b->kaOn = OK == wdtKaInit(&b->ka, b->dev, d->kaPercent, periodUs);
+		}
+		busUnlock(bus);
+		if (b->dev <= 0)
+		{
+			return ERROR;
+		}
+		if ( (d->kaPercent > 0) && !b->kaOn)
+		{
+			printf("Fail to start the watchdog keep alive of board %d:%d!\n", bus,
+				stack);
+			return ERROR;
+		}
+		a = dmnAdapterGet(d, bus, periodUs);
+		if (NULL == a)
+		{
+			printf("Fail to start the I/O thread of bus %d!\n", bus);
+			return ERROR;
+		}
+		// sorted by stack level, the output order
+		for (i = a->boards; (i > 0) && (a->board[i - 1]->stack > stack); i--)
+		{
+			a->board[i] = a->board[i - 1];
+		}
+		a->board[i] = b;
+		a->boards++;
+		b->adapter = a;
+		b->io = &a->io;
+		b->poll.work = dmnPollWork;
+		b->poll.done = dmnPollDone;
+		b->poll.arg = b;
+		b->rdJob.work = dmnReadWork;
+		b->rdJob.done = dmnReadDone;
+		b->rdJob.arg = b;
+		b->rdTimer = evTimerAdd(&d->loop, 0, dmnReadTimerCb, b);
+		if (b->rdTimer < 0)
+		{
+			printf("Fail to start the coalescing timer!\n");
+			return ERROR;
+		}
+		d->boards++;
+	}
+	return OK;
+}
+
+static void dmnStop(DmnType *d)
+{
+	DmnAdapterType *a = NULL;
+	DmnClientType *c = NULL;
+	int i = 0;
+	int j = 0;
+
+	for (i = 0; i < d->adapters; i++)
+	{
+		a = &d->adapter[i];
+		evIoStop(&a->io);
+		// a stage not done: its rings are not drained any more
+		for (j = 0; j < a->staged; j++)
+		{
+			c = a->stage[j].client;
+			if (a->stage[j].isRing && c->ringStaged)
+			{
+				c->ringStaged = 0;
+				if (c->ringRelease)
+				{
+					ringDestroy(c->ring, c->ringName);
+					c->ring = NULL;
+					c->ringRelease = 0;
+				}
+			}
+		}
+	}
+	for (i = 0; i < EV_FD_MAX; i++)
+	{
+		if ( (d->loop.h[i].type == EV_TYPE_FD)
+			&& (d->loop.h[i].cb == dmnClientCb))
+		{
+			((DmnClientType*)d->loop.h[i].arg)->busy = 0;
+			dmnClientClose((DmnClientType*)d->loop.h[i].arg);
+		}
+	}
+	if (d->lfd >= 0)
+	{
+		evDel(&d->loop, d->lfd);
+		close(d->lfd);
+	}
+	evClose(&d->loop);
+}
+
+/**
+ * Params: <socket> <bus>:<stack>[,<bus>:<stack>...] <poll_ms> [<window_us>]
+ * 	[<wdt_percent>]
+ */
+int doDaemon(int argc, char *argv[])
+{
+	static const int signals[] = {SIGINT, SIGTERM};
+	DmnType *d = &gDmn;
+	int period = 0;
+	int window = 0;
+	int kaPercent = 0;
+	uid_t euid = 0;
+	int ret = OK;
+
+	if ( (argc < 5) || (argc > 7))
+	{
+		return ARG_CNT_ERR;
+	}
+	period = atoi(argv[4]);
+	window = argc >= 6 ? atoi(argv[5]) : 0;
+	if ( (period < 1) || (window < 0) || (window > DMN_WINDOW_MAX))
+	{
+		printf("Invalid poll period or coalescing window!\n");
+		return ARG_ERR;
+	}
+	if (argc == 7)
+	{
+		kaPercent = atoi(argv[6]);
+		if ( (kaPercent < 10) || (kaPercent > 90))
+		{
+			printf("Invalid watchdog reload percent, must be 10..90!\n");
+			return ARG_ERR;
+		}
+	}
+	memset(d, 0, sizeof(DmnType));
+	d->lfd = -1;
+	d->windowUs = window;
+	d->kaPercent = kaPercent;
+	// the I/O threads take the locks of their own adapters
+	busUnlock(I2C_BUS_DEFAULT);
+	if ( (OK != evInit(&d->loop))
+		|| (evSignalAdd(&d->loop, signals, 2, dmnSignalCb, d) < 0))
+	{
+		printf("Fail to create the event loop!\n");
+		busLock(I2C_BUS_DEFAULT);
+		return ERROR;
+	}
+	ret = dmnBoardsOpen(d, argv[3], period * 1000);
+	if (ret == OK)
+	{
+		d->lfd = dmnListen(argv[2]);
+		if ( (d->lfd < 0) || (OK != evAdd(&d->loop, d->lfd, EPOLLIN, dmnAcceptCb, d)))
+		{
+			printf("Fail to listen on \"%s\"!\n", argv[2]);
+			ret = ERROR;
+		}
+	}
+	if ( (ret == OK) && (OK != dmnAdaptersStart(d)))
+	{
+		printf("Fail to start the poll timers!\n");
+		ret = ERROR;
+	}
+	if (ret == OK)
+	{
+		printf("Serving %d boards on %d buses at \"%s\"\n", d->boards, d->adapters,
+			argv[2]);
+		fflush(stdout);
+		evRun(&d->loop);
+	}
+	dmnStop(d);
+	if (d->lfd >= 0)
+	{
+		euid = privDrop();
+		if (euid != (uid_t)-1)
+		{
+			dmnSockRemove(argv[2]);
+			privRestore(euid);
+		}
+	}
+	busLock(I2C_BUS_DEFAULT);
+	return ret;
+}
+
+/**
+ * Display the text metrics of a running service
+ * Params: <socket>
+ */
+int doMetrics(int argc, char *argv[])
+{
+	struct sockaddr_un sa;
+	char line[DMN_LINE_MAX];
+	FILE *f = NULL;
+	int lines = 0;
+	int fd = -1;
+	int ret = OK;
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	if (strlen(argv[2]) >= sizeof(sa.sun_path))
+	{
+		printf("Invalid socket path!\n");
+		return ARG_ERR;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strncpy(sa.sun_path, argv[2], sizeof(sa.sun_path) - 1);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if ( (fd < 0) || (0 != connect(fd, (struct sockaddr*)&sa, sizeof(sa))))
+	{
+		printf("Fail to connect to \"%s\"!\n", argv[2]);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return ERROR;
+	}
+	f = fdopen(fd, "r+");
+	if (NULL == f)
+	{
+		close(fd);
+		return ERROR;
+	}
+	fputs("metrics\nquit\n", f);
+	fflush(f);
+	if ( (NULL == fgets(line, sizeof(line), f))
+		|| (1 != sscanf(line, "ok %d", &lines)))
+	{
+		printf("Fail to read the metrics: %s", line);
+		ret = ERROR;
+	}
+	for (; (ret == OK) && (lines > 0) && (NULL != fgets(line, sizeof(line), f));
+		lines--)
+	{
+		fputs(line, stdout);
+	}
+	fclose(f);
+	return ret;
+}
@@ -0,0 +1,170 @@
+#ifndef DAEMON_H_
+#define DAEMON_H_
+
+#include <stdint.h>
+
+#include "plcpi.h"
+#include "scan.h"
+#include "evloop.h"
+#include "sub.h"
+#include "ring.h"
+#include "hist.h"
+
+#define DMN_CLIENT_MAX 512
+#define DMN_BACKLOG 64
+#define DMN_SOCK_MODE 0660 // socket file, owned by the user starting the service
+#define DMN_LINE_MAX 512 // request line, newline included
+#define DMN_OUT_MAX 8192 // answers not read yet
+#define DMN_DATA_MAX 64 // bytes per bus request
+#define DMN_ARG_MAX (DMN_DATA_MAX + 4)
+#define DMN_EV_LINE_MAX 64 // room kept in the output for one event line
+#define DMN_MERGE_SPAN 64 // registers covered by one coalesced read
+#define DMN_WINDOW_MAX 1000000 // coalescing window, us
+#define DMN_STAGE_MAX (2 * DMN_CLIENT_MAX) // a ring and a write per client
+
+struct Dmn;
+struct DmnClient;
+struct DmnAdapter;
+
+typedef struct
+{
+	struct Dmn *dmn;
+	int idx; // in the board table
+	int bus;
+	int stack;
+	int dev;
+	struct DmnAdapter *adapter;
+	EvIoType *io; // I/O thread of the adapter
+	EvJobType poll;
+	int pending; // poll job queued or running
+	u8 rd[SCAN_MEM_SIZE]; // written by the I/O thread
+	u8 mem[SCAN_MEM_SIZE]; // last poll, loop thread only
+	uint64_t stampUs;
+	u32 polls;
+	u32 errors;
+	u32 overruns; // poll periods skipped
+	// reads of the clients merged into one transfer
+	struct DmnClient *rdWait; // gathered during the window
+	int rdLo; // register range of the gathered reads
+	int rdHi;
+	struct DmnClient *rdFlight; // served by the transfer in progress
+	int flLo;
+	int flHi;
+	int rdTimer; // window timer
+	int rdArmed;
+	int rdBusy; // merged read on the bus or its waiters being answered
+	EvJobType rdJob;
+	u8 rdData[SCAN_MEM_SIZE]; // written by the I/O thread
+	u32 reads; // client reads served
+	u32 transfers; // bus transfers for them
+	// output command rings and socket writes, executed by the output stage of
+	// the adapter; the lists belong to the loop thread
+	struct DmnClient *rings;
+	struct DmnClient *wrWait; // writes waiting for the next stage
+	u32 ringCmds; // commands executed
+	u32 ringErrors;
+	u32 writes; // socket writes executed
+	// watchdog reloaded by the output stage when due
+	int kaOn;
+	WdtKaType ka; // I/O thread only
+	int kaRet; // last service, read once the stage is done
+	u32 kaReloads;
+	u32 kaErrors;
+} DmnBoardType;
+
+/*
+ * One ring drained or one socket write executed by an output stage, taken
+ * by the loop thread when the stage starts
+ */
+typedef struct
+{
+	DmnBoardType *board;
+	struct DmnClient *client;
+	int isRing; // the ring of the client, or its socket write
+	int ret; // I/O thread: ring commands executed, write status
+	u32 errors; // I/O thread: ring commands failed
+} DmnStageType;
+
+/*
+ * Boards of one I2C adapter, polled together: every period the output stage
+ * writes the commands queued for all the boards, then the boards are read
+ */
+typedef struct DmnAdapter
+{
+	struct Dmn *dmn;
+	int bus;
+	EvIoType io;
+	int pollFd; // poll timer
+	int periodUs;
+	DmnBoardType *board[SCAN_BOARD_MAX]; // by stack level, the output order
+	int boards;
+	EvJobType out;
+	int outPending;
+	DmnStageType stage[DMN_STAGE_MAX]; // output stage in progress, by stack level
+	int staged;
+	int outBoards; // I/O thread: boards updated by the stage
+	u32 outSkewUs; // I/O thread: first to last board updated
+	u32 stages; // output stages that wrote commands
+	u32 multi; // the ones that updated two boards or more
+	u32 skewUs; // last one, first to last board updated
+	HistType skew;
+	// timing of the cycles: output stage and polls of one period
+	CycleStatType cyc;
+	uint64_t schedUs; // next timer expiration
+	uint64_t cycSchedUs; // current cycle
+	uint64_t cycStartUs;
+	uint64_t cycBusUs; // added by the I/O thread
+	int cycJobs; // jobs of the current cycle not done
+} DmnAdapterType;
+
+typedef struct DmnClient
+{
+	struct Dmn *dmn;
+	struct DmnClient *subNext; // subscribers list
+	struct DmnClient *rdNext; // waiters of a merged read
+	struct DmnClient *ringNext; // rings of the board
+	struct DmnClient *wrNext; // writes waiting for the output stage
+	RingShmType *ring;
+	DmnBoardType *ringBoard;
+	char ringName[RING_NAME_MAX];
+	int ringStaged; // drained by the output stage in progress
+	int ringRelease; // destroyed once the stage is done
+	int subscribed;
+	SubType sub;
+	int fd; // -1 once closed
+	u32 events;
+	char in[DMN_LINE_MAX];
+	int inLen;
+	char out[DMN_OUT_MAX];
+	int outLen;
+	int overflow;
+	int quit;
+	int busy; // bus request on the I/O thread
+	EvJobType job;
+	DmnBoardType *board;
+	int isWrite;
+	int add;
+	int size;
+	u8 data[DMN_DATA_MAX];
+} DmnClientType;
+
+typedef struct Dmn
+{
+	EvLoopType loop;
+	int lfd; // listening socket
+	DmnBoardType board[SCAN_BOARD_MAX];
+	int boards;
+	DmnAdapterType adapter[SCAN_BUS_MAX];
+	int adapters;
+	int clients;
+	int windowUs; // reads gathered before the transfer starts
+	int kaPercent; // watchdog reload, 0 if not reloaded
+	DmnClientType *subs; // clients with filters
+	u32 ringSeq; // shared memory names
+	u32 requests;
+} DmnType;
+
+int doDaemon(int argc, char *argv[]);
+int doMetrics(int argc, char *argv[]);
+
+#endif //DAEMON_H_
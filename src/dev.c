@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "libplcpi.h"
+
+#define HW_VER_MOVE_PROFILE 3 // pwm frequency and movement profile
+
+/*
+ * Device contexts indexed by the I2C file descriptor, the accessors keep
+ * taking the descriptor and find the board state here. Different boards
+ * can be used from different threads, one board from one thread at a time.
+ */
+static DevCtxType *gDevTable[DEV_FD_MAX];
+static pthread_mutex_t gDevMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static u32 devFeaturesGet(u8 *ver)
+{
+	u32 features = 0;
+
+	if (ver[0] >= HW_VER_MOVE_PROFILE)
+	{
+		features |= DEV_FEAT_PWM_FREQ | DEV_FEAT_MOVE_PROFILE;
+	}
+	return features;
+}
+
+/**
+ * Open the I2C port of one card, read its version once and register the context
+ * Params:
+ * 	bus - I2C adapter number
+ * 	stack - board level id [0..7]
+ * Return the I2C file descriptor or a negative PlcpiErrType code
+ */
+int devOpen(int bus, int stack)
+{
+	DevCtxType *ctx = NULL;
+	int dev = 0;
+	u8 buff[4];
+
+	if ( (stack < 0) || (stack > 7) || (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	dev = i2cSetup(bus, stack + SLAVE_OWN_ADDRESS_BASE);
+	if (dev < 0)
+	{
+		return PLCPI_ERR_BUS;
+	}
+	if (dev >= DEV_FD_MAX)
+	{
+		close(dev);
+		return PLCPI_ERR_NO_MEM;
+	}
+	// a descriptor closed without devClose() may have been reused, its stale
+	// context must not answer the probe from its cache or skip it
+	pthread_mutex_lock(&gDevMutex);
+	free(gDevTable[dev]);
+	gDevTable[dev] = NULL;
+	pthread_mutex_unlock(&gDevMutex);
+	if (OK != i2cMem8ReadBus(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, buff, 4))
+	{
+		close(dev);
+		return PLCPI_ERR_NO_BOARD;
+	}
+	ctx = calloc(1, sizeof(DevCtxType));
+	if (NULL == ctx)
+	{
+		close(dev);
+		return PLCPI_ERR_NO_MEM;
+	}
+	ctx->fd = dev;
+	ctx->bus = bus;
+	ctx->addr = stack + SLAVE_OWN_ADDRESS_BASE;
+	ctx->stack = stack;
+	memcpy(ctx->ver, buff, 4);
+	ctx->features = devFeaturesGet(ctx->ver);
+
+	pthread_mutex_lock(&gDevMutex);
+	gDevTable[dev] = ctx;
+	pthread_mutex_unlock(&gDevMutex);
+	cachePut(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, buff, 4);
+	return dev;
+}
+
+void devClose(int dev)
+{
+	if ( (dev < 0) || (dev >= DEV_FD_MAX))
+	{
+		return;
+	}
+	pthread_mutex_lock(&gDevMutex);
+	free(gDevTable[dev]);
+	gDevTable[dev] = NULL;
+	pthread_mutex_unlock(&gDevMutex);
+	close(dev);
+}
+
+DevCtxType* devGet(int dev)
+{
+	if ( (dev < 0) || (dev >= DEV_FD_MAX))
+	{
+		return NULL;
+	}
+	return gDevTable[dev];
+}
+
+int devFeature(int dev, u32 feature)
+{
+	DevCtxType *ctx = devGet(dev);
+
+	if (NULL == ctx)
+	{
+		return 0;
+	}
+	return (ctx->features & feature) == feature;
+}
+
+/**
+ * Shadow copies of the output registers, updated on every successful
+ * read or write of the register
+ */
+void devShadowSet(int dev, u8 reg, u8 val)
+{
+	DevCtxType *ctx = devGet(dev);
+
+	if (NULL == ctx)
+	{
+		return;
+	}
+	switch (reg)
+	{
+	case DEV_SHADOW_RELAY:
+		ctx->relayShadow = val;
+		break;
+	case DEV_SHADOW_GPIO:
+		ctx->gpioShadow = val;
+		break;
+	default:
+		return;
+	}
+	ctx->shadowValid |= reg;
+}
+
+int devShadowGet(int dev, u8 reg, u8 *val)
+{
+	DevCtxType *ctx = devGet(dev);
+
+	if ( (NULL == ctx) || (NULL == val) || ! (ctx->shadowValid & reg))
+	{
+		return ERROR;
+	}
+	*val = reg == DEV_SHADOW_RELAY ? ctx->relayShadow : ctx->gpioShadow;
+	return OK;
+}
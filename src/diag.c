@@ -0,0 +1,411 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define DIAG_MAGIC 0x47414944 // "DIAG"
+#define DIAG_VERSION 2 // 2: the records carry the bus
+#define DIAG_DEFAULT_CAPACITY 10080 // one week of one minute samples
+#define DIAG_MAX_BOARDS 8 // logged by one process
+#define DIAG_STAT_BOARDS 32 // told apart by -diagstat
+
+typedef struct
+{
+	u32 magic;
+	u16 version;
+	u16 recSize;
+	u32 capacity; // records
+	u32 head; // next record to write
+	u32 count; // valid records
+} DiagHdrType;
+
+typedef struct
+{
+	u32 time; // unix time stamp
+	u8 bus;
+	u8 stack;
+	int8_t temperature; // Celsius degrees
+	u8 res;
+	u16 mV; // 3.3V rail
+} DiagRecType;
+
+typedef struct
+{
+	int bus;
+	int stack;
+	int count;
+	int tMin;
+	int tMax;
+	long tSum;
+	int vMin;
+	int vMax;
+	long vSum;
+	int alarms;
+} DiagStatType;
+
+#ifndef PLCPI_CLI
+int diagGet(int dev, int *temperature, int *mV)
+{
+	u8 buff[3];
+	u16 raw = 0;
+
+	if ( (NULL == temperature) || (NULL == mV))
+	{
+		return ERROR;
+	}
+	// temperature and voltage in one transfer
+	if (OK != i2cMem8Read(dev, I2C_MEM_DIAG_TEMPERATURE_ADD, buff, 3))
+	{
+		return ERROR;
+	}
+	*temperature = (int8_t)buff[0];
+	memcpy(&raw, &buff[1], 2);
+	*mV = raw;
+	return OK;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+/**
+ * Open or create a diagnostics ring file
+ * Params:
+ * 	name - file name
+ * 	capacity - records for a new file, an existing file keep its capacity
+ * 	hdr - file header
+ */
+static int diagFileOpen(const char *name, int capacity, DiagHdrType *hdr)
+{
+	int fd = -1;
+
+	fd = open(name, O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if ( (sizeof(DiagHdrType) == pread(fd, hdr, sizeof(DiagHdrType), 0))
+		&& (hdr->magic == DIAG_MAGIC) && (hdr->version == DIAG_VERSION)
+		&& (hdr->recSize == sizeof(DiagRecType)) && (hdr->capacity > 0))
+	{
+		return fd;
+	}
+	if (capacity <= 0)
+	{
+		close(fd);
+		return ERROR;
+	}
+	memset(hdr, 0, sizeof(DiagHdrType));
+	hdr->magic = DIAG_MAGIC;
+	hdr->version = DIAG_VERSION;
+	hdr->recSize = sizeof(DiagRecType);
+	hdr->capacity = (u32)capacity;
+	if ( (0 != ftruncate(fd, 0))
+		|| (sizeof(DiagHdrType) != pwrite(fd, hdr, sizeof(DiagHdrType), 0)))
+	{
+		close(fd);
+		return ERROR;
+	}
+	return fd;
+}
+
+static int diagFileAppend(int fd, DiagHdrType *hdr, DiagRecType *rec)
+{
+	off_t off = sizeof(DiagHdrType) + (off_t)hdr->head * sizeof(DiagRecType);
+
+	if (sizeof(DiagRecType) != pwrite(fd, rec, sizeof(DiagRecType), off))
+	{
+		return ERROR;
+	}
+	hdr->head = (hdr->head + 1) % hdr->capacity;
+	if (hdr->count < hdr->capacity)
+	{
+		hdr->count++;
+	}
+	if (sizeof(DiagHdrType) != pwrite(fd, hdr, sizeof(DiagHdrType), 0))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+/**
+ * Boards list, <stack> or <bus>:<stack> separated by commas
+ */
+static int diagBoardListGet(char *arg, int *bus, int *stack)
+{
+	int cnt = 0;
+	char *tok = NULL;
+	char *save = NULL;
+
+	for (tok = strtok_r(arg, ",", &save); tok != NULL;
+		tok = strtok_r(NULL, ",", &save))
+	{
+		if (cnt >= DIAG_MAX_BOARDS)
+		{
+			return ERROR;
+		}
+		bus[cnt] = I2C_BUS_DEFAULT;
+		if (OK != boardIdParse(tok, &bus[cnt], &stack[cnt]))
+		{
+			return ERROR;
+		}
+		cnt++;
+	}
+	return cnt;
+}
+
+int doDiagLog(int argc, char *argv[])
+{
+	int bus[DIAG_MAX_BOARDS];
+	int stack[DIAG_MAX_BOARDS];
+	int dev[DIAG_MAX_BOARDS];
+	int boards = 0;
+	int period = 0;
+	int capacity = DIAG_DEFAULT_CAPACITY;
+	int fd = -1;
+	int i = 0;
+	int ret = OK;
+	int temperature = 0;
+	int mV = 0;
+	uint64_t next = 0;
+	uint64_t now = 0;
+	DiagHdrType hdr;
+	DiagRecType rec;
+
+	if ( (argc != 5) && (argc != 6))
+	{
+		return ARG_CNT_ERR;
+	}
+	period = atoi(argv[3]);
+	if (period < 1)
+	{
+		printf("Invalid sample period!\n");
+		return ARG_ERR;
+	}
+	boards = diagBoardListGet(argv[4], bus, stack);
+	if (boards <= 0)
+	{
+		printf("Invalid boards list, max %d <stack> or <bus>:<stack>!\n",
+			DIAG_MAX_BOARDS);
+		return ARG_ERR;
+	}
+	if (argc == 6)
+	{
+		capacity = atoi(argv[5]);
+		if (capacity < 1)
+		{
+			printf("Invalid capacity!\n");
+			return ARG_ERR;
+		}
+	}
+	// every board is read under the lock of its own adapter
+	busUnlock(I2C_BUS_DEFAULT);
+	for (i = 0; i < boards; i++)
+	{
+		busLock(bus[i]);
+		dev[i] = doBoardOpen(bus[i], stack[i]);
+		busUnlock(bus[i]);
+		if (dev[i] <= 0)
+		{
+			busLock(I2C_BUS_DEFAULT);
+			return ERROR;
+		}
+	}
+	fd = diagFileOpen(argv[2], capacity, &hdr);
+	if (fd < 0)
+	{
+		printf("Fail to open \"%s\"!\n", argv[2]);
+		busLock(I2C_BUS_DEFAULT);
+		return ERROR;
+	}
+	memset(&rec, 0, sizeof(rec));
+	next = getTimeUs();
+	while (1)
+	{
+		for (i = 0; i < boards; i++)
+		{
+			busLock(bus[i]);
+			ret = diagGet(dev[i], &temperature, &mV);
+			busUnlock(bus[i]);
+			if (OK != ret)
+			{
+				continue;
+			}
+			rec.time = (u32)time(NULL);
+			rec.bus = (u8)bus[i];
+			rec.stack = (u8)stack[i];
+			rec.temperature = (int8_t)temperature;
+			rec.mV = (u16)mV;
+			if (OK != diagFileAppend(fd, &hdr, &rec))
+			{
+				printf("Fail to write \"%s\"!\n", argv[2]);
+				close(fd);
+				busLock(I2C_BUS_DEFAULT);
+				return ERROR;
+			}
+		}
+		next += (uint64_t)period * 1000000;
+		while ( (now = getTimeUs()) < next)
+		{
+			busyWaitUs(next - now > 1000000 ? 1000000 : (int) (next - now));
+		}
+	}
+	close(fd);
+	busLock(I2C_BUS_DEFAULT);
+	return OK;
+}
+
+/*
+ * Statistics slot of a board, NULL when the table is full
+ */
+static DiagStatType* diagStatGet(DiagStatType *st, int *boards, int bus,
+	int stack)
+{
+	int i = 0;
+
+	for (i = 0; i < *boards; i++)
+	{
+		if ( (st[i].bus == bus) && (st[i].stack == stack))
+		{
+			return &st[i];
+		}
+	}
+	if (*boards >= DIAG_STAT_BOARDS)
+	{
+		return NULL;
+	}
+	st[*boards].bus = bus;
+	st[*boards].stack = stack;
+	return &st[(*boards)++];
+}
+
+/**
+ * Statistics over the last window seconds, per board
+ * Params: <file> [window_s] [max_temperature] [min_mV] [max_mV]
+ */
+int doDiagStat(int argc, char *argv[])
+{
+	DiagHdrType hdr;
+	DiagRecType rec;
+	DiagStatType st[DIAG_STAT_BOARDS];
+	int boards = 0;
+	int fd = -1;
+	int window = 0;
+	int tMax = 1000;
+	int vMin = 0;
+	int vMax = 0xffff;
+	u32 i = 0;
+	u32 idx = 0;
+	u32 from = 0;
+	int alarm = 0;
+	DiagStatType *s = NULL;
+
+	if ( (argc < 3) || (argc > 7))
+	{
+		return ARG_CNT_ERR;
+	}
+	if (argc > 3)
+	{
+		window = atoi(argv[3]);
+	}
+	if (argc > 4)
+	{
+		tMax = atoi(argv[4]);
+	}
+	if (argc > 5)
+	{
+		vMin = atoi(argv[5]);
+	}
+	if (argc > 6)
+	{
+		vMax = atoi(argv[6]);
+	}
+	fd = open(argv[2], O_RDONLY);
+	if ( (fd < 0)
+		|| (sizeof(DiagHdrType) != pread(fd, &hdr, sizeof(DiagHdrType), 0))
+		|| (hdr.magic != DIAG_MAGIC) || (hdr.version != DIAG_VERSION)
+		|| (hdr.recSize != sizeof(DiagRecType))
+		|| (hdr.capacity == 0))
+	{
+		printf("Invalid diagnostics file \"%s\"!\n", argv[2]);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return ERROR;
+	}
+	if (window > 0)
+	{
+		from = (u32)time(NULL) - (u32)window;
+	}
+	memset(st, 0, sizeof(st));
+	// oldest record first
+	idx = (hdr.head + hdr.capacity - hdr.count) % hdr.capacity;
+	for (i = 0; i < hdr.count; i++)
+	{
+		if (sizeof(DiagRecType)
+			!= pread(fd, &rec, sizeof(DiagRecType),
+				sizeof(DiagHdrType) + (off_t) ( (idx + i) % hdr.capacity)
+					* sizeof(DiagRecType)))
+		{
+			break;
+		}
+		if (rec.time < from)
+		{
+			continue;
+		}
+		s = diagStatGet(st, &boards, rec.bus, rec.stack);
+		if (NULL == s)
+		{
+			continue;
+		}
+		alarm = (rec.temperature > tMax) || (rec.mV < vMin) || (rec.mV > vMax);
+		if (alarm)
+		{
+			s->alarms++;
+			printf("alarm: board %d:%d at %u, %d C, %u mV\n", (int)rec.bus,
+				(int)rec.stack, (unsigned int)rec.time, (int)rec.temperature,
+				(unsigned int)rec.mV);
+		}
+		if ( (s->count == 0) || (rec.temperature < s->tMin))
+		{
+			s->tMin = rec.temperature;
+		}
+		if ( (s->count == 0) || (rec.temperature > s->tMax))
+		{
+			s->tMax = rec.temperature;
+		}
+		if ( (s->count == 0) || (rec.mV < s->vMin))
+		{
+			s->vMin = rec.mV;
+		}
+		if ( (s->count == 0) || (rec.mV > s->vMax))
+		{
+			s->vMax = rec.mV;
+		}
+		s->tSum += rec.temperature;
+		s->vSum += rec.mV;
+		s->count++;
+	}
+	close(fd);
+	for (i = 0; i < (u32)boards; i++)
+	{
+		s = &st[i];
+		if (s->count == 0)
+		{
+			continue;
+		}
+		printf(
+			"board %d:%d: %d samples, temperature min %d max %d mean %0.1f C, 3.3V min %d max %d mean %0.0f mV, %d alarms\n",
+			s->bus, s->stack, s->count, s->tMin, s->tMax, (float)s->tSum / s->count, s->vMin,
+			s->vMax, (float)s->vSum / s->count, s->alarms);
+	}
+	return OK;
+}
+#endif // PLCPI_LIB
@@ -0,0 +1,453 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "evloop.h"
+
+/*
+ * Event loop for the resident services: one thread waits on epoll for the
+ * client sockets, the periodic timers (timerfd), the signals (signalfd) and
+ * the I/O threads completions (eventfd). The bus transfers never run in the
+ * loop thread, a slow or failing board delays only the jobs of its adapter.
+ */
+
+int evInit(EvLoopType *loop)
+{
+	if (NULL == loop)
+	{
+		return ERROR;
+	}
+	memset(loop, 0, sizeof(EvLoopType));
+	loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epfd < 0)
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+void evClose(EvLoopType *loop)
+{
+	int fd = 0;
+
+	if ( (NULL == loop) || (loop->epfd < 0))
+	{
+		return;
+	}
+	for (fd = 0; fd < EV_FD_MAX; fd++)
+	{
+		if ( (loop->h[fd].type == EV_TYPE_TIMER)
+			|| (loop->h[fd].type == EV_TYPE_SIGNAL))
+		{
+			evDel(loop, fd);
+			close(fd);
+		}
+	}
+	close(loop->epfd);
+	loop->epfd = -1;
+}
+
+static int evRegister(EvLoopType *loop, int fd, u32 events, u8 type,
+	EvCbType cb, void *arg)
+{
+	struct epoll_event ev;
+
+	if ( (NULL == loop) || (fd < 0) || (fd >= EV_FD_MAX) || (NULL == cb))
+	{
+		return ERROR;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	if (0 != epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev))
+	{
+		return ERROR;
+	}
+	loop->h[fd].type = type;
+	loop->h[fd].cb = cb;
+	loop->h[fd].arg = arg;
+	return OK;
+}
+
+/**
+ * Watch a file descriptor, the caller keeps its ownership
+ */
+int evAdd(EvLoopType *loop, int fd, u32 events, EvCbType cb, void *arg)
+{
+	return evRegister(loop, fd, events, EV_TYPE_FD, cb, arg);
+}
+
+int evMod(EvLoopType *loop, int fd, u32 events)
+{
+	struct epoll_event ev;
+
+	if ( (NULL == loop) || (fd < 0) || (fd >= EV_FD_MAX)
+		|| (loop->h[fd].type == EV_TYPE_NONE))
+	{
+		return ERROR;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+	return epoll_ctl(loop->epfd, EPOLL_CTL_MOD, fd, &ev) == 0 ? OK : ERROR;
+}
+
+/**
+ * Stop watching a file descriptor, the events already returned for it in
+ * the current iteration are dropped
+ */
+void evDel(EvLoopType *loop, int fd)
+{
+	if ( (NULL == loop) || (fd < 0) || (fd >= EV_FD_MAX)
+		|| (loop->h[fd].type == EV_TYPE_NONE))
+	{
+		return;
+	}
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+	memset(&loop->h[fd], 0, sizeof(EvHandlerType));
+}
+
+/**
+ * Periodic timer, the first expiration one period from now, a zero period
+ * creates a stopped timer for evTimerArm()
+ * Return the timer file descriptor, remove it with evDel() and close()
+ */
+int evTimerAdd(EvLoopType *loop, int periodUs, EvCbType cb, void *arg)
+{
+	struct itimerspec its;
+	int fd = -1;
+
+	if (periodUs < 0)
+	{
+		return ERROR;
+	}
+	fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	its.it_interval.tv_sec = periodUs / 1000000;
+	its.it_interval.tv_nsec = (long) (periodUs % 1000000) * 1000;
+	its.it_value = its.it_interval;
+	if ( (0 != timerfd_settime(fd, 0, &its, NULL))
+		|| (OK != evRegister(loop, fd, EPOLLIN, EV_TYPE_TIMER, cb, arg)))
+	{
+		close(fd);
+		return ERROR;
+	}
+	return fd;
+}
+
+/**
+ * Single expiration of a timer after delayUs, replaces its period
+ */
+int evTimerArm(int fd, int delayUs)
+{
+	struct itimerspec its;
+
+	if (delayUs <= 0)
+	{
+		return ERROR;
+	}
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = delayUs / 1000000;
+	its.it_value.tv_nsec = (long) (delayUs % 1000000) * 1000;
+	return timerfd_settime(fd, 0, &its, NULL) == 0 ? OK : ERROR;
+}
+
+/**
+ * Start a stopped timer periodic, the first expiration one period from now
+ */
+int evTimerStart(int fd, int periodUs)
+{
+	struct itimerspec its;
+
+	if (periodUs <= 0)
+	{
+		return ERROR;
+	}
+	its.it_interval.tv_sec = periodUs / 1000000;
+	its.it_interval.tv_nsec = (long) (periodUs % 1000000) * 1000;
+	its.it_value = its.it_interval;
+	return timerfd_settime(fd, 0, &its, NULL) == 0 ? OK : ERROR;
+}
+
+/**
+ * Receive signals in the loop, the signals are blocked for the calling thread
+ * and the threads it creates afterwards
+ */
+int evSignalAdd(EvLoopType *loop, const int *signals, int count, EvCbType cb,
+	void *arg)
+{
+	sigset_t set;
+	int fd = -1;
+	int i = 0;
+
+	if ( (NULL == signals) || (count < 1))
+	{
+		return ERROR;
+	}
+	sigemptyset(&set);
+	for (i = 0; i < count; i++)
+	{
+		sigaddset(&set, signals[i]);
+	}
+	if (0 != pthread_sigmask(SIG_BLOCK, &set, NULL))
+	{
+		return ERROR;
+	}
+	fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if (OK != evRegister(loop, fd, EPOLLIN, EV_TYPE_SIGNAL, cb, arg))
+	{
+		close(fd);
+		return ERROR;
+	}
+	return fd;
+}
+
+static void evDispatch(EvLoopType *loop, int fd, u32 events)
+{
+	EvHandlerType *h = &loop->h[fd];
+	struct signalfd_siginfo si;
+	uint64_t expirations = 0;
+
+	switch (h->type)
+	{
+	case EV_TYPE_FD:
+		h->cb(loop, fd, events, h->arg);
+		break;
+	case EV_TYPE_TIMER:
+		if (sizeof(expirations) == read(fd, &expirations, sizeof(expirations)))
+		{
+			h->cb(loop, fd, (u32)expirations, h->arg);
+		}
+		break;
+	case EV_TYPE_SIGNAL:
+		while (sizeof(si) == read(fd, &si, sizeof(si)))
+		{
+			h->cb(loop, fd, si.ssi_signo, h->arg);
+			if (h->type != EV_TYPE_SIGNAL)
+			{
+				break;
+			}
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+ * Dispatch the events until evStop()
+ */
+int evRun(EvLoopType *loop)
+{
+	struct epoll_event ev[EV_EVENTS_MAX];
+	int n = 0;
+	int i = 0;
+
+	if ( (NULL == loop) || (loop->epfd < 0))
+	{
+		return ERROR;
+	}
+	loop->run = 1;
+	while (loop->run)
+	{
+		n = epoll_wait(loop->epfd, ev, EV_EVENTS_MAX, -1);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return ERROR;
+		}
+		for (i = 0; (i < n) && loop->run; i++)
+		{
+			evDispatch(loop, ev[i].data.fd, ev[i].events);
+		}
+	}
+	return OK;
+}
+
+void evStop(EvLoopType *loop)
+{
+	if (NULL != loop)
+	{
+		loop->run = 0;
+	}
+}
+
+static void* evIoThread(void *arg)
+{
+	EvIoType *io = (EvIoType*)arg;
+	EvJobType *batch = NULL;
+	EvJobType *job = NULL;
+	EvJobType *last = NULL;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&io->lock);
+	while (io->run)
+	{
+		if (NULL == io->todo)
+		{
+			pthread_cond_wait(&io->cond, &io->lock);
+			continue;
+		}
+		batch = io->todo;
+		io->todo = NULL;
+		io->todoTail = NULL;
+		pthread_mutex_unlock(&io->lock);
+
+		busLock(io->bus);
+		for (job = batch; job != NULL; job = job->next)
+		{
+			job->work(job);
+			last = job;
+		}
+		busUnlock(io->bus);
+
+		pthread_mutex_lock(&io->lock);
+		if (NULL == io->doneTail)
+		{
+			io->done = batch;
+		}
+		else
+		{
+			io->doneTail->next = batch;
+		}
+		io->doneTail = last;
+		io->sessions++;
+		pthread_mutex_unlock(&io->lock);
+		if (write(io->efd, &one, sizeof(one)) < 0)
+		{
+			// the counter is saturated, the loop is already woken up
+		}
+		pthread_mutex_lock(&io->lock);
+	}
+	pthread_mutex_unlock(&io->lock);
+	return NULL;
+}
+
+static void evIoDone(EvLoopType *loop UNU, int fd, u32 events UNU, void *arg)
+{
+	EvIoType *io = (EvIoType*)arg;
+	EvJobType *job = NULL;
+	EvJobType *next = NULL;
+	uint64_t count = 0;
+
+	if (read(fd, &count, sizeof(count)) < 0)
+	{
+		return;
+	}
+	pthread_mutex_lock(&io->lock);
+	job = io->done;
+	io->done = NULL;
+	io->doneTail = NULL;
+	pthread_mutex_unlock(&io->lock);
+	// the completion may submit the job again
+	for (; job != NULL; job = next)
+	{
+		next = job->next;
+		job->next = NULL;
+		if (NULL != job->done)
+		{
+			job->done(job);
+		}
+	}
+}
+
+/**
+ * Start the I/O thread of an adapter, its completions are reported to the loop
+ */
+int evIoStart(EvLoopType *loop, EvIoType *io, int bus)
+{
+	if ( (NULL == loop) || (NULL == io))
+	{
+		return ERROR;
+	}
+	memset(io, 0, sizeof(EvIoType));
+	io->loop = loop;
+	io->bus = bus;
+	io->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (io->efd < 0)
+	{
+		return ERROR;
+	}
+	pthread_mutex_init(&io->lock, NULL);
+	pthread_cond_init(&io->cond, NULL);
+	io->run = 1;
+	if (OK != evAdd(loop, io->efd, EPOLLIN, evIoDone, io))
+	{
+		close(io->efd);
+		return ERROR;
+	}
+	if (0 != pthread_create(&io->thread, NULL, evIoThread, io))
+	{
+		evDel(loop, io->efd);
+		close(io->efd);
+		return ERROR;
+	}
+	io->started = 1;
+	return OK;
+}
+
+/**
+ * Queue a job, called from the loop thread
+ */
+void evIoSubmit(EvIoType *io, EvJobType *job)
+{
+	if ( (NULL == io) || (NULL == job) || (NULL == job->work))
+	{
+		return;
+	}
+	job->next = NULL;
+	pthread_mutex_lock(&io->lock);
+	if (NULL == io->todoTail)
+	{
+		io->todo = job;
+	}
+	else
+	{
+		io->todoTail->next = job;
+	}
+	io->todoTail = job;
+	io->jobs++;
+	pthread_cond_signal(&io->cond);
+	pthread_mutex_unlock(&io->lock);
+}
+
+/**
+ * Stop the I/O thread, the queued jobs are dropped
+ */
+void evIoStop(EvIoType *io)
+{
+	if ( (NULL == io) || !io->started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&io->lock);
+	io->run = 0;
+	pthread_cond_signal(&io->cond);
+	pthread_mutex_unlock(&io->lock);
+	pthread_join(io->thread, NULL);
+	evDel(io->loop, io->efd);
+	close(io->efd);
+	io->started = 0;
+}
@@ -0,0 +1,100 @@
+#ifndef EVLOOP_H_
+#define EVLOOP_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "plcpi.h"
+
+#define EV_FD_MAX 1024 // handlers table size, indexed by the file descriptor
+#define EV_EVENTS_MAX 64 // events handled per epoll_wait()
+
+struct EvLoop;
+
+/*
+ * Handler callback, run in the loop thread
+ * 	events - EPOLL* flags for a file descriptor, the expirations count for a
+ * 	timer, the signal number for a signal
+ */
+typedef void (*EvCbType)(struct EvLoop *loop, int fd, u32 events, void *arg);
+
+typedef enum
+{
+	EV_TYPE_NONE = 0,
+	EV_TYPE_FD,
+	EV_TYPE_TIMER, // timerfd, owned by the loop
+	EV_TYPE_SIGNAL, // signalfd, owned by the loop
+} EvTypeEnumType;
+
+typedef struct
+{
+	u8 type; // EvTypeEnumType
+	EvCbType cb;
+	void *arg;
+} EvHandlerType;
+
+typedef struct EvLoop
+{
+	int epfd;
+	volatile int run;
+	EvHandlerType h[EV_FD_MAX];
+} EvLoopType;
+
+struct EvJob;
+
+typedef void (*EvJobCbType)(struct EvJob *job);
+
+/*
+ * Bus work executed by an I/O thread with the bus locked, the completion
+ * callback runs later in the loop thread
+ */
+typedef struct EvJob
+{
+	struct EvJob *next;
+	EvJobCbType work; // I/O thread
+	EvJobCbType done; // loop thread
+	void *arg;
+	int ret; // set by work
+} EvJobType;
+
+/*
+ * One I/O thread per adapter, the jobs queued while the bus was busy are
+ * executed in one bus lock session and their completions reported through
+ * one eventfd wake up
+ */
+typedef struct
+{
+	EvLoopType *loop;
+	int bus;
+	int efd; // eventfd, completions ready
+	int started;
+	volatile int run;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	EvJobType *todo;
+	EvJobType *todoTail;
+	EvJobType *done;
+	EvJobType *doneTail;
+	u32 jobs;
+	u32 sessions; // bus lock sessions
+} EvIoType;
+
+int evInit(EvLoopType *loop);
+void evClose(EvLoopType *loop);
+int evAdd(EvLoopType *loop, int fd, u32 events, EvCbType cb, void *arg);
+int evMod(EvLoopType *loop, int fd, u32 events);
+void evDel(EvLoopType *loop, int fd);
+int evTimerAdd(EvLoopType *loop, int periodUs, EvCbType cb, void *arg);
+int evTimerArm(int fd, int delayUs);
+int evTimerStart(int fd, int periodUs);
+int evSignalAdd(EvLoopType *loop, const int *signals, int count, EvCbType cb,
+	void *arg);
+int evRun(EvLoopType *loop);
+void evStop(EvLoopType *loop);
+
+int evIoStart(EvLoopType *loop, EvIoType *io, int bus);
+void evIoSubmit(EvIoType *io, EvJobType *job);
+void evIoStop(EvIoType *io);
+
+#endif //EVLOOP_H_
@@ -7,17 +7,23 @@
 #include "comm.h"
 #include "plcpi.h"
 
+#ifndef PLCPI_CLI
+#define GPIO_MASK 0x0f
+
+/*
+ * The value and direction writes are verified like the relay writes, only
+ * the output pins of the value register can be verified
+ */
 int gpioChSet(int dev, u8 channel, OutStateEnumType state)
 {
-	int resp;
-	u8 buff[2];
+	u8 buff[4]; // value, set, clear, direction
+	u8 mask = 0;
 
 	if ( (channel < CHANNEL_NR_MIN) || (channel > GPIO_CH_NR_MAX))
 	{
-		printf("Invalid GPIO nr!\n");
 		return ERROR;
 	}
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_GPIO_VAL_ADD, buff, 1))
+	if (FAIL == i2cMem8Read(dev, I2C_MEM_GPIO_VAL_ADD, buff, 4))
 	{
 		return FAIL;
 	}
@@ -26,18 +32,23 @@ int gpioChSet(int dev, u8 channel, OutStateEnumType state)
 	{
 	case OFF:
 		buff[0] &= ~ (1 << (channel - 1));
-		resp = i2cMem8Write(dev, I2C_MEM_GPIO_VAL_ADD, buff, 1);
 		break;
 	case ON:
 		buff[0] |= 1 << (channel - 1);
-		resp = i2cMem8Write(dev, I2C_MEM_GPIO_VAL_ADD, buff, 1);
 		break;
 	default:
-		printf("Invalid GPIO state!\n");
 		return ERROR;
 		break;
 	}
-	return resp;
+	mask = ~buff[3] & GPIO_MASK;
+	if (OK
+		!= i2cMem8WriteVerify(dev, I2C_MEM_GPIO_VAL_ADD, buff, &mask, 1,
+			VERIFY_RETRIES, VERIFY_TIMEOUT_US))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_GPIO, buff[0]);
+	return OK;
 }
 
 int gpioChGet(int dev, u8 channel, OutStateEnumType *state)
@@ -51,7 +62,6 @@ int gpioChGet(int dev, u8 channel, OutStateEnumType *state)
 
 	if ( (channel < CHANNEL_NR_MIN) || (channel > GPIO_CH_NR_MAX))
 	{
-		printf("Invalid GPIO nr!\n");
 		return ERROR;
 	}
 
@@ -59,6 +69,7 @@ int gpioChGet(int dev, u8 channel, OutStateEnumType *state)
 	{
 		return ERROR;
 	}
+	devShadowSet(dev, DEV_SHADOW_GPIO, buff[0]);
 
 	if (buff[0] & (1 << (channel - 1)))
 	{
@@ -74,10 +85,25 @@ int gpioChGet(int dev, u8 channel, OutStateEnumType *state)
 int gpioSet(int dev, int val)
 {
 	u8 buff[2];
+	u8 mask = 0;
 
+	// the verify mask follows the direction on the board, another process
+	// may have changed it since it was cached
+	if (OK != i2cMem8ReadBus(dev, I2C_MEM_GPIO_DIR_ADD, &mask, 1))
+	{
+		return ERROR;
+	}
+	mask = ~mask & GPIO_MASK;
 	buff[0] = 0xff & val;
 
-	return i2cMem8Write(dev, I2C_MEM_GPIO_VAL_ADD, buff, 1);
+	if (OK
+		!= i2cMem8WriteVerify(dev, I2C_MEM_GPIO_VAL_ADD, buff, &mask, 1,
+			VERIFY_RETRIES, VERIFY_TIMEOUT_US))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_GPIO, buff[0]);
+	return OK;
 }
 
 int gpioGet(int dev, int *val)
@@ -93,18 +119,18 @@ int gpioGet(int dev, int *val)
 	{
 		return ERROR;
 	}
+	devShadowSet(dev, DEV_SHADOW_GPIO, buff[0]);
 	*val = buff[0];
 	return OK;
 }
 
 int gpioChDirSet(int dev, u8 channel, u8 state)
 {
-	int resp;
 	u8 buff[2];
+	u8 mask = GPIO_MASK;
 
 	if ( (channel < CHANNEL_NR_MIN) || (channel > GPIO_CH_NR_MAX))
 	{
-		printf("Invalid GPIO nr!\n");
 		return ERROR;
 	}
 
@@ -116,27 +142,27 @@ int gpioChDirSet(int dev, u8 channel, u8 state)
 	{
 	case 0: //output
 		buff[0] &= ~ (1 << (channel - 1));
-		resp = i2cMem8Write(dev, I2C_MEM_GPIO_DIR_ADD, buff, 1);
 		break;
 	case 1: //input
 		buff[0] |= 1 << (channel - 1);
-		resp = i2cMem8Write(dev, I2C_MEM_GPIO_DIR_ADD, buff, 1);
 		break;
 	default:
-		printf("Invalid GPIO state!\n");
 		return ERROR;
 		break;
 	}
-	return resp;
+	return i2cMem8WriteVerify(dev, I2C_MEM_GPIO_DIR_ADD, buff, &mask, 1,
+		VERIFY_RETRIES, VERIFY_TIMEOUT_US);
 }
 
 int gpioDirSet(int dev, int val)
 {
 	u8 buff[2];
+	u8 mask = GPIO_MASK;
 
 	buff[0] = 0xff & val;
 
-	return i2cMem8Write(dev, I2C_MEM_GPIO_DIR_ADD, buff, 1);
+	return i2cMem8WriteVerify(dev, I2C_MEM_GPIO_DIR_ADD, buff, &mask, 1,
+		VERIFY_RETRIES, VERIFY_TIMEOUT_US);
 }
 
 int gpioDirGet(int dev, int *val)
@@ -317,7 +343,9 @@ int gpioCountReset(int dev, u8 channel)
 	}
 	return OK;
 }
+#endif // PLCPI_CLI
 
+#ifndef PLCPI_LIB
 int doGpioRead(int argc, char *argv[])
 {
 	int pin = 0;
@@ -376,8 +404,6 @@ int doGpioWrite(int argc, char *argv[])
 	OutStateEnumType state = STATE_COUNT;
 	int val = 0;
 	int dev = 0;
-	OutStateEnumType stateR = STATE_COUNT;
-	int retry = 0;
 	int direction = 0x0f;
 
 	if ( (argc != 5) && (argc != 4))
@@ -426,29 +452,8 @@ int doGpioWrite(int argc, char *argv[])
 			printf("Fail to write gpio pin, is input\n");
 			return ERROR;
 		}
-		retry = RETRY_TIMES;
-
-		while ( (retry > 0) && (stateR != state))
-		{
-			if (OK != gpioChSet(dev, pin, state))
-			{
-				printf("Fail to write gpio\n");
-				return ERROR;
-			}
-			if (OK != gpioChGet(dev, pin, &stateR))
-			{
-				printf("Fail to read gpio\n");
-				return ERROR;
-			}
-			retry--;
-		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
-		{
-			printf("retry %d times\n", 3-retry);
-		}
-#endif
-		if (retry == 0)
+		// verified write, bounded by VERIFY_RETRIES and VERIFY_TIMEOUT_US
+		if (OK != gpioChSet(dev, pin, state))
 		{
 			printf("Fail to write gpio pin\n");
 			return ERROR;
@@ -858,3 +863,4 @@ int doInCmdSet(int argc, char *argv[])
 	return OK;
 }
 //********************************************************************************************
+#endif // PLCPI_LIB
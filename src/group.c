@@ -0,0 +1,326 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+/*
+ * Several write commands for one board in one invocation, separated by ",":
+ * 	plcpi <stack> relwr 0x0f , gpiowr 3 1 , odwr 2 40
+ * The values are staged in a register transaction and written with the fewest
+ * contiguous blocks, all the blocks in one I2C transaction. The channel
+ * commands are turned into whole register values from one read of the outputs.
+ */
+
+#define GRP_SEP ","
+#define GRP_OUT_SIZE (I2C_MEM_GPIO_DIR_ADD + 1) // relays to gpio direction
+
+typedef struct
+{
+	TxType tx;
+	u8 out[GRP_OUT_SIZE]; // outputs read before the first channel command
+	int outValid;
+} GrpImgType;
+
+typedef int (*GrpOpType)(int dev, GrpImgType *img, int argc, char *argv[]);
+
+typedef struct
+{
+	const char *name;
+	GrpOpType op;
+} GrpCmdType;
+
+static int grpStage(GrpImgType *img, int add, const u8 *buff, int size)
+{
+	if (txWrite(&img->tx, add, buff, size) < 0)
+	{
+		printf("Too many commands in the group!\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+/**
+ * Output register value, the staged one or the one read from the board
+ */
+static int grpOutGet(int dev, GrpImgType *img, int add, u8 *val)
+{
+	if (img->tx.wrMask[add])
+	{
+		*val = img->tx.wrVal[add];
+		return OK;
+	}
+	if (!img->outValid)
+	{
+		if (OK != i2cMem8Read(dev, I2C_MEM_RELAY_VAL_ADD, img->out, GRP_OUT_SIZE))
+		{
+			printf("Fail to read!\n");
+			return ERROR;
+		}
+		img->outValid = 1;
+	}
+	*val = img->out[add];
+	return OK;
+}
+
+static int grpStateGet(const char *arg, OutStateEnumType *state)
+{
+	if ( (strcasecmp(arg, "up") == 0) || (strcasecmp(arg, "on") == 0))
+	{
+		*state = ON;
+	}
+	else if ( (strcasecmp(arg, "down") == 0) || (strcasecmp(arg, "off") == 0))
+	{
+		*state = OFF;
+	}
+	else
+	{
+		if ( (atoi(arg) >= STATE_COUNT) || (atoi(arg) < 0))
+		{
+			return ERROR;
+		}
+		*state = (OutStateEnumType)atoi(arg);
+	}
+	return OK;
+}
+
+/**
+ * relwr <channel> <on/off> | relwr <value>
+ */
+static int grpRelay(int dev, GrpImgType *img, int argc, char *argv[])
+{
+	OutStateEnumType state = OFF;
+	long val = 0;
+	int ch = 0;
+	u8 reg = 0;
+
+	if (argc == 2)
+	{
+		val = strtol(argv[1], NULL, 0);
+		if ( (val < 0) || (val > 255))
+		{
+			printf("Invalid relay value\n");
+			return ARG_ERR;
+		}
+		reg = (u8)val;
+	}
+	else if (argc == 3)
+	{
+		ch = atoi(argv[1]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > RELAY_CH_NR_MAX))
+		{
+			printf("Relay number value out of range\n");
+			return ARG_ERR;
+		}
+		if (OK != grpStateGet(argv[2], &state))
+		{
+			printf("Invalid relay state!\n");
+			return ARG_ERR;
+		}
+		if (OK != grpOutGet(dev, img, I2C_MEM_RELAY_VAL_ADD, &reg))
+		{
+			return ERROR;
+		}
+		if (state == ON)
+		{
+			reg |= (u8) (1 << (ch - 1));
+		}
+		else
+		{
+			reg &= (u8)~ (1 << (ch - 1));
+		}
+	}
+	else
+	{
+		return ARG_CNT_ERR;
+	}
+	return grpStage(img, I2C_MEM_RELAY_VAL_ADD, &reg, 1);
+}
+
+/**
+ * gpiowr <channel> <0/1> | gpiowr <value>
+ */
+static int grpGpio(int dev, GrpImgType *img, int argc, char *argv[])
+{
+	OutStateEnumType state = OFF;
+	long val = 0;
+	int ch = 0;
+	u8 reg = 0;
+	u8 dir = 0;
+
+	if (argc == 2)
+	{
+		val = strtol(argv[1], NULL, 0);
+		if ( (val < 0) || (val > 0x0f))
+		{
+			printf("Invalid gpio value\n");
+			return ARG_ERR;
+		}
+		reg = (u8)val;
+	}
+	else if (argc == 3)
+	{
+		ch = atoi(argv[1]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > GPIO_CH_NR_MAX))
+		{
+			printf("Gpio pin number value out of range\n");
+			return ARG_ERR;
+		}
+		if (OK != grpStateGet(argv[2], &state))
+		{
+			printf("Invalid gpio state!\n");
+			return ARG_ERR;
+		}
+		if ( (OK != grpOutGet(dev, img, I2C_MEM_GPIO_DIR_ADD, &dir))
+			|| (OK != grpOutGet(dev, img, I2C_MEM_GPIO_VAL_ADD, &reg)))
+		{
+			return ERROR;
+		}
+		if ( (1 << (ch - 1)) & dir)
+		{
+			printf("Fail to write gpio pin, is input\n");
+			return ERROR;
+		}
+		if (state == ON)
+		{
+			reg |= (u8) (1 << (ch - 1));
+		}
+		else
+		{
+			reg &= (u8)~ (1 << (ch - 1));
+		}
+	}
+	else
+	{
+		return ARG_CNT_ERR;
+	}
+	return grpStage(img, I2C_MEM_GPIO_VAL_ADD, &reg, 1);
+}
+
+/**
+ * odwr <channel> <value>
+ */
+static int grpOd(int dev UNU, GrpImgType *img, int argc, char *argv[])
+{
+	int ch = 0;
+	float proc = 0;
+	u16 raw = 0;
+	u8 buff[2];
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	ch = atoi(argv[1]);
+	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+	{
+		printf("Open drain channel out of range!\n");
+		return ARG_ERR;
+	}
+	proc = atof(argv[2]);
+	if (proc < 0 || proc > 100)
+	{
+		printf("Invalid open drain pwm value, must be 0..100 \n");
+		return ARG_ERR;
+	}
+	raw = (u16)ceil(OD_PWM_VAL_MAX * proc / 100);
+	memcpy(buff, &raw, 2);
+	return grpStage(img, I2C_MEM_OD_PWM_VAL_RAW_ADD + 2 * (ch - 1), buff, 2);
+}
+
+static const GrpCmdType gGrpCmd[] = { {"relwr", grpRelay}, {"gpiowr", grpGpio},
+	{"odwr", grpOd}, {NULL, NULL}};
+
+int groupCheck(int argc, char *argv[])
+{
+	int i = 0;
+
+	for (i = 3; i < argc; i++)
+	{
+		if (strcmp(argv[i], GRP_SEP) == 0)
+		{
+			return 1;
+		}
+	}
+	return 0;
+}
+
+int doGroup(int argc, char *argv[])
+{
+	GrpImgType img;
+	int dev = 0;
+	int start = 2;
+	int end = 0;
+	int ret = OK;
+	int i = 0;
+	int relayWr = 0;
+	u8 relay = 0;
+	u8 relayVal = 0;
+
+	if (argc < 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	memset(&img, 0, sizeof(img));
+	txInit(&img.tx, dev);
+	while (start < argc)
+	{
+		for (end = start; (end < argc) && strcmp(argv[end], GRP_SEP); end++)
+			;
+		if (end == start)
+		{
+			printf("Empty command in the group!\n");
+			return ARG_ERR;
+		}
+		for (i = 0; gGrpCmd[i].name != NULL; i++)
+		{
+			if (strcasecmp(argv[start], gGrpCmd[i].name) == 0)
+			{
+				break;
+			}
+		}
+		if (gGrpCmd[i].name == NULL)
+		{
+			printf("\"%s\" can not be grouped, only relwr, gpiowr and odwr!\n",
+				argv[start]);
+			return ARG_ERR;
+		}
+		ret = gGrpCmd[i].op(dev, &img, end - start, &argv[start]);
+		if (ret == ARG_CNT_ERR)
+		{
+			printf("Invalid parameters number for \"%s\"!\n", argv[start]);
+		}
+		if (ret != OK)
+		{
+			return ret;
+		}
+		start = end + 1;
+	}
+
+	relayWr = img.tx.wrMask[I2C_MEM_RELAY_VAL_ADD];
+	relayVal = img.tx.wrVal[I2C_MEM_RELAY_VAL_ADD];
+	if (OK != txCommit(&img.tx, NULL))
+	{
+		printf("Fail to write!\n");
+		return ERROR;
+	}
+	if (relayWr)
+	{
+		if ( (OK != i2cReadByteAS(dev, I2C_MEM_RELAY_VAL_ADD, &relay))
+			|| (relay != relayVal))
+		{
+			printf("Fail to write relay!\n");
+			return ERROR;
+		}
+	}
+	return OK;
+}
@@ -0,0 +1,228 @@
+/*
+ * hist.c:
+ *	Fixed buckets (power of 2) histograms for latency measurements
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hist.h"
+
+#define HIST_BAR_MAX 40
+
+void histInit(HistType *h)
+{
+	memset(h, 0, sizeof(HistType));
+}
+
+int histBucket(uint32_t val)
+{
+	int b = 0;
+
+	if (val < 2)
+	{
+		return 0;
+	}
+	b = 31 - __builtin_clz(val);
+	return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+void histAdd(HistType *h, uint32_t val)
+{
+	h->bucket[histBucket(val)]++;
+	if ( (h->count == 0) || (val < h->min))
+	{
+		h->min = val;
+	}
+	if (val > h->max)
+	{
+		h->max = val;
+	}
+	h->sum += val;
+	h->count++;
+}
+
+/**
+ * Upper limit of the bucket holding the percentile, capped to the max value
+ */
+uint32_t histPercentile(HistType *h, int percent)
+{
+	uint64_t target = 0;
+	uint64_t acc = 0;
+	uint32_t upper = 0;
+	int i = 0;
+
+	if (h->count == 0)
+	{
+		return 0;
+	}
+	target = ((uint64_t)h->count * percent + 99) / 100;
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		acc += h->bucket[i];
+		if (acc >= target)
+		{
+			upper = i == 0 ? 1 : (uint32_t) ( ((uint64_t)2 << i) - 1);
+			return upper < h->max ? upper : h->max;
+		}
+	}
+	return h->max;
+}
+
+void histPrint(FILE *f, HistType *h, const char *title, const char *unit)
+{
+	uint32_t peak = 0;
+	int i = 0;
+	int bar = 0;
+
+	fprintf(f, "%s (%s): count %u", title, unit, h->count);
+	if (h->count == 0)
+	{
+		fprintf(f, "\n");
+		return;
+	}
+	fprintf(f, " min %u mean %0.1f p50 %u p99 %u max %u\n", h->min,
+		(double)h->sum / h->count, histPercentile(h, 50), histPercentile(h, 99),
+		h->max);
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (h->bucket[i] > peak)
+		{
+			peak = h->bucket[i];
+		}
+	}
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (h->bucket[i] == 0)
+		{
+			continue;
+		}
+		bar = (int) ((uint64_t)h->bucket[i] * HIST_BAR_MAX / peak);
+		fprintf(f, "  [%10u .. %10u] %8u %.*s\n", i == 0 ? 0 : 1u << i,
+			i == 0 ? 1 : (uint32_t) ( ((uint64_t)2 << i) - 1), h->bucket[i],
+			bar > 0 ? bar : 1, "########################################");
+	}
+}
+
+/**
+ * Text exposition of a histogram, cumulative counts of the non empty buckets,
+ * the "# TYPE" line is written by the caller
+ * Params:
+ * 	labels - "name=\"value\",..." or ""
+ * Return the characters written, -1 if buf is too small
+ */
+int histExport(char *buf, int size, HistType *h, const char *name,
+	const char *labels)
+{
+	const char *sep = *labels ? "," : "";
+	uint64_t acc = 0;
+	int len = 0;
+	int n = 0;
+	int i = 0;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+	{
+		if (h->bucket[i] == 0)
+		{
+			continue;
+		}
+		acc += h->bucket[i];
+		n = snprintf(&buf[len], (size_t) (size - len),
+			"%s_bucket{%s%sle=\"%u\"} %llu\n", name, labels, sep,
+			i == 0 ? 1 : (uint32_t) ( ((uint64_t)2 << i) - 1),
+			(unsigned long long)acc);
+		if ( (n < 0) || (n >= size - len))
+		{
+			return -1;
+		}
+		len += n;
+	}
+	n = snprintf(&buf[len], (size_t) (size - len),
+		"%s_bucket{%s%sle=\"+Inf\"} %u\n%s_sum{%s} %llu\n%s_count{%s} %u\n",
+		name, labels, sep, h->count, name, labels, (unsigned long long)h->sum,
+		name, labels, h->count);
+	if ( (n < 0) || (n >= size - len))
+	{
+		return -1;
+	}
+	return len + n;
+}
+
+void cycleStatInit(CycleStatType *c)
+{
+	memset(c, 0, sizeof(CycleStatType));
+}
+
+/**
+ * Add one cycle, all times from getTimeUs()
+ * Params:
+ * 	schedUs - scheduled start, 0 for a continuous cycle without jitter
+ */
+void cycleStatAdd(CycleStatType *c, uint64_t schedUs, uint64_t startUs,
+	uint64_t busUs, uint64_t endUs)
+{
+	uint64_t exec = endUs - startUs;
+
+	if (schedUs > 0)
+	{
+		histAdd(&c->jitter, startUs > schedUs ? (uint32_t) (startUs - schedUs) : 0);
+	}
+	histAdd(&c->exec, (uint32_t)exec);
+	histAdd(&c->bus, (uint32_t)busUs);
+	histAdd(&c->compute, exec > busUs ? (uint32_t) (exec - busUs) : 0);
+}
+
+void cycleStatPrint(FILE *f, CycleStatType *c)
+{
+	histPrint(f, &c->jitter, "  start jitter", "us");
+	histPrint(f, &c->exec, "  execution", "us");
+	histPrint(f, &c->bus, "  bus", "us");
+	histPrint(f, &c->compute, "  compute", "us");
+	fprintf(f, "  overruns %u\n", c->overruns);
+}
+
+/**
+ * Text metrics of several cycles, see histExport()
+ * Params:
+ * 	labels - labels of every cycle
+ */
+int cycleStatExport(char *buf, int size, CycleStatType *c, const char **labels,
+	int count)
+{
+	static const char *names[] = {"plcpi_cycle_jitter_us", "plcpi_cycle_exec_us",
+		"plcpi_cycle_bus_us", "plcpi_cycle_compute_us"};
+	HistType *h = NULL;
+	int len = 0;
+	int n = 0;
+	int i = 0;
+	int j = 0;
+
+	for (i = 0; i < 5; i++)
+	{
+		n = snprintf(&buf[len], (size_t) (size - len), "# TYPE %s %s\n",
+			i < 4 ? names[i] : "plcpi_cycle_overruns_total",
+			i < 4 ? "histogram" : "counter");
+		for (j = 0; (n >= 0) && (n < size - len) && (j < count); j++)
+		{
+			len += n;
+			if (i < 4)
+			{
+				h = i == 0 ? &c[j].jitter : i == 1 ? &c[j].exec :
+					i == 2 ? &c[j].bus : &c[j].compute;
+				n = histExport(&buf[len], size - len, h, names[i], labels[j]);
+			}
+			else
+			{
+				n = snprintf(&buf[len], (size_t) (size - len),
+					"plcpi_cycle_overruns_total{%s} %u\n", labels[j],
+					c[j].overruns);
+			}
+		}
+		if ( (n < 0) || (n >= size - len))
+		{
+			return -1;
+		}
+		len += n;
+	}
+	return len;
+}
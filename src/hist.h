@@ -0,0 +1,43 @@
+#ifndef HIST_H_
+#define HIST_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define HIST_BUCKETS 32 // bucket 0 hold 0 and 1, bucket i hold [2^i, 2^(i+1))
+
+typedef struct
+{
+	uint32_t bucket[HIST_BUCKETS];
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t sum;
+} HistType;
+
+/*
+ * Timing of a periodic cycle, every one adds a sample to each histogram
+ */
+typedef struct
+{
+	HistType jitter; // start after the scheduled start, us
+	HistType exec; // start to end, us
+	HistType bus; // bus sessions, us
+	HistType compute; // exec minus bus: waits, merge and processing, us
+	uint32_t overruns; // periods skipped, the cycle was still running
+} CycleStatType;
+
+void histInit(HistType *h);
+int histBucket(uint32_t val);
+void histAdd(HistType *h, uint32_t val);
+uint32_t histPercentile(HistType *h, int percent);
+void histPrint(FILE *f, HistType *h, const char *title, const char *unit);
+int histExport(char *buf, int size, HistType *h, const char *name,
+	const char *labels);
+void cycleStatInit(CycleStatType *c);
+void cycleStatAdd(CycleStatType *c, uint64_t schedUs, uint64_t startUs,
+	uint64_t busUs, uint64_t endUs);
+void cycleStatPrint(FILE *f, CycleStatType *c);
+int cycleStatExport(char *buf, int size, CycleStatType *c, const char **labels,
+	int count);
+#endif //HIST_H_
@@ -0,0 +1,996 @@
+/*
+ * libplcpi.c:
+ *	Context handle API over the card accessors, see libplcpi.h
+ *	Copyright (c) 2016-2024 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "libplcpi.h"
+#include "trace.h"
+#include "ring.h"
+
+struct PlcpiCtx
+{
+	int dev; // I2C file descriptor, the board state is in its DevCtxType
+	int bus; // I2C adapter, selects the bus lock
+};
+
+struct PlcpiTx
+{
+	int bus;
+	TxType tx;
+};
+
+struct PlcpiRing
+{
+	RingShmType *shm;
+};
+
+static const char *gErrStr[] = {"success", "invalid argument",
+	"can not open the I2C bus", "board not detected", "I2C transfer failed",
+	"not available on this hardware version", "out of memory",
+	"board suspended after repeated transfer errors", "command ring full",
+	"timeout"};
+
+/*
+ * Take the bus for one accessor call, libStatus() maps its failure from what
+ * happened on the bus since
+ */
+static void libLock(int bus)
+{
+	busLock(bus);
+	devBusOutcomeClear();
+}
+
+static int libStatus(int ret)
+{
+	if (ret == OK)
+	{
+		return PLCPI_OK;
+	}
+	switch (devBusOutcomeGet())
+	{
+	case DEV_BUS_REFUSED: // by the board breaker, see recover.c
+		return PLCPI_ERR_SUSPENDED;
+	case DEV_BUS_UNUSED: // rejected before any transfer
+		return PLCPI_ERR_ARG;
+	default:
+		return PLCPI_ERR_IO;
+	}
+}
+
+static int libChCheck(PlcpiCtxType *ctx, int ch, int max)
+{
+	return (NULL != ctx) && (ch >= CHANNEL_NR_MIN) && (ch <= max);
+}
+
+const char* plcpiStrError(int err)
+{
+	if ( (err > 0) || (err < PLCPI_ERR_TIMEOUT))
+	{
+		return "unknown error";
+	}
+	return gErrStr[-err];
+}
+
+int plcpiOpen(int stack, PlcpiCtxType **ctx)
+{
+	return plcpiOpenBus(I2C_BUS_DEFAULT, stack, ctx);
+}
+
+int plcpiOpenBus(int bus, int stack, PlcpiCtxType **ctx)
+{
+	PlcpiCtxType *c = NULL;
+	int dev = 0;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	*ctx = NULL;
+	c = calloc(1, sizeof(PlcpiCtxType));
+	if (NULL == c)
+	{
+		return PLCPI_ERR_NO_MEM;
+	}
+	if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+	{
+		free(c);
+		return PLCPI_ERR_ARG;
+	}
+	busLock(bus);
+	dev = devOpen(bus, stack);
+	busUnlock(bus);
+	if (dev < 0)
+	{
+		free(c);
+		return dev;
+	}
+	c->dev = dev;
+	c->bus = bus;
+	*ctx = c;
+	return PLCPI_OK;
+}
+
+void plcpiClose(PlcpiCtxType *ctx)
+{
+	if (NULL == ctx)
+	{
+		return;
+	}
+	devClose(ctx->dev);
+	free(ctx);
+}
+
+int plcpiStackGet(PlcpiCtxType *ctx)
+{
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	return devGet(ctx->dev)->stack;
+}
+
+int plcpiVersionGet(PlcpiCtxType *ctx, int *hwMajor, int *hwMinor,
+	int *fwMajor, int *fwMinor)
+{
+	DevCtxType *dc = NULL;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	dc = devGet(ctx->dev);
+	if (hwMajor)
+	{
+		*hwMajor = dc->ver[0];
+	}
+	if (hwMinor)
+	{
+		*hwMinor = dc->ver[1];
+	}
+	if (fwMajor)
+	{
+		*fwMajor = dc->ver[2];
+	}
+	if (fwMinor)
+	{
+		*fwMinor = dc->ver[3];
+	}
+	return PLCPI_OK;
+}
+
+int plcpiStatGet(PlcpiCtxType *ctx, uint32_t *reads, uint32_t *writes,
+	uint32_t *errors)
+{
+	DevCtxType *dc = NULL;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	dc = devGet(ctx->dev);
+	if (reads)
+	{
+		*reads = dc->stat.reads;
+	}
+	if (writes)
+	{
+		*writes = dc->stat.writes;
+	}
+	if (errors)
+	{
+		*errors = dc->stat.errors;
+	}
+	return PLCPI_OK;
+}
+
+int plcpiRecoverSet(uint32_t flags, void (*busClear)(int bus))
+{
+	if (flags & ~ (uint32_t) (DEV_RECOVER_REOPEN | DEV_RECOVER_REBIND
+		| DEV_RECOVER_CLEAR))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	devRecoverSet(flags, busClear);
+	return PLCPI_OK;
+}
+
+int plcpiErrStatGet(PlcpiCtxType *ctx, uint32_t err[PLCPI_ERR_CLASS_NR],
+	uint32_t *skipped, uint32_t *trips, uint32_t *recoveries)
+{
+	DevCtxType *dc = NULL;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	dc = devGet(ctx->dev);
+	if (err)
+	{
+		memcpy(err, dc->stat.err, sizeof(dc->stat.err));
+	}
+	if (skipped)
+	{
+		*skipped = dc->stat.skipped;
+	}
+	if (trips)
+	{
+		*trips = dc->stat.trips;
+	}
+	if (recoveries)
+	{
+		*recoveries = dc->stat.recoveries;
+	}
+	return PLCPI_OK;
+}
+
+//----------------------------------- Relays -----------------------------------------------------------
+int plcpiRelayChSet(PlcpiCtxType *ctx, int ch, int on)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, RELAY_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = relayChSet(ctx->dev, (u8)ch, on ? ON : OFF);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiRelayChGet(PlcpiCtxType *ctx, int ch, int *on)
+{
+	OutStateEnumType state = OFF;
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, RELAY_CH_NR_MAX) || (NULL == on))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = relayChGet(ctx->dev, (u8)ch, &state);
+	busUnlock(ctx->bus);
+	*on = state == ON;
+	return libStatus(ret);
+}
+
+int plcpiRelaySet(PlcpiCtxType *ctx, uint8_t mask)
+{
+	int ret = 0;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = relaySet(ctx->dev, mask);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiRelayGet(PlcpiCtxType *ctx, uint8_t *mask)
+{
+	int val = 0;
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == mask))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = relayGet(ctx->dev, &val);
+	busUnlock(ctx->bus);
+	*mask = (uint8_t)val;
+	return libStatus(ret);
+}
+
+//----------------------------------- Opto inputs ------------------------------------------------------
+int plcpiOptoGet(PlcpiCtxType *ctx, uint8_t *mask)
+{
+	int val = 0;
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == mask))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoGet(ctx->dev, &val);
+	busUnlock(ctx->bus);
+	*mask = (uint8_t)val;
+	return libStatus(ret);
+}
+
+int plcpiOptoEdgeSet(PlcpiCtxType *ctx, int ch, int edges)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX) || (edges < 0) || (edges > 3))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoEdgeSet(ctx->dev, (u8)ch, (u8)edges);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOptoEdgeGet(PlcpiCtxType *ctx, int ch, int *edges)
+{
+	u8 val = 0;
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX) || (NULL == edges))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoEdgeGet(ctx->dev, (u8)ch, &val);
+	busUnlock(ctx->bus);
+	*edges = val;
+	return libStatus(ret);
+}
+
+int plcpiOptoCountGet(PlcpiCtxType *ctx, int ch, uint32_t *count)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX) || (NULL == count))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoCountGet(ctx->dev, (u8)ch, count);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOptoCountReset(PlcpiCtxType *ctx, int ch)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoCountReset(ctx->dev, (u8)ch);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOptoEncCountGet(PlcpiCtxType *ctx, int ch, int32_t *count)
+{
+	int val = 0;
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX / 2) || (NULL == count))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoEncGetCnt(ctx->dev, (u8)ch, &val);
+	busUnlock(ctx->bus);
+	*count = val;
+	return libStatus(ret);
+}
+
+int plcpiOptoEncCountReset(PlcpiCtxType *ctx, int ch)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OPTO_IN_CH_NR_MAX / 2))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = optoEncRstCnt(ctx->dev, (u8)ch);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- GPIO -------------------------------------------------------------
+int plcpiGpioChSet(PlcpiCtxType *ctx, int ch, int on)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, GPIO_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = gpioChSet(ctx->dev, (u8)ch, on ? ON : OFF);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiGpioChGet(PlcpiCtxType *ctx, int ch, int *on)
+{
+	OutStateEnumType state = OFF;
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, GPIO_CH_NR_MAX) || (NULL == on))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = gpioChGet(ctx->dev, (u8)ch, &state);
+	busUnlock(ctx->bus);
+	*on = state == ON;
+	return libStatus(ret);
+}
+
+int plcpiGpioChDirSet(PlcpiCtxType *ctx, int ch, int input)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, GPIO_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = gpioChDirSet(ctx->dev, (u8)ch, input ? 1 : 0);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- Analog -----------------------------------------------------------
+int plcpiAdcGet(PlcpiCtxType *ctx, int ch, float *volts)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, ADC_CH_NR_MAX) || (NULL == volts))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = adcGet(ctx->dev, ch, volts);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiDacSet(PlcpiCtxType *ctx, int ch, float volts)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, DAC_CH_NR_MAX) || (volts < 0)
+		|| (volts > DAC_VOLT_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = dacSet(ctx->dev, ch, volts);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiDacGet(PlcpiCtxType *ctx, int ch, float *volts)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, DAC_CH_NR_MAX) || (NULL == volts))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = dacGet(ctx->dev, ch, volts);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- Open drain outputs -----------------------------------------------
+int plcpiOdSet(PlcpiCtxType *ctx, int ch, float percent)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OD_CH_NR_MAX) || (percent < 0) || (percent > 100))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = odSet(ctx->dev, ch, percent);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOdGet(PlcpiCtxType *ctx, int ch, float *percent)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OD_CH_NR_MAX) || (NULL == percent))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = odGet(ctx->dev, ch, percent);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOdPulsesWrite(PlcpiCtxType *ctx, int ch, uint32_t pulses)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, 2 * OD_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = odWritePulses(ctx->dev, ch, pulses);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOdPulsesRead(PlcpiCtxType *ctx, int ch, uint32_t *pulses)
+{
+	unsigned int val = 0;
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OD_CH_NR_MAX) || (NULL == pulses))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = odReadPulses(ctx->dev, ch, &val);
+	busUnlock(ctx->bus);
+	*pulses = val;
+	return libStatus(ret);
+}
+
+int plcpiOdMoveSet(PlcpiCtxType *ctx, int ch, int acc, int dec, int minSpd,
+	int maxSpd)
+{
+	int ret = 0;
+
+	if (!libChCheck(ctx, ch, OD_CH_NR_MAX) || (acc < 0)
+		|| (acc > OD_MOVE_ACC_MAX) || (dec < 0) || (dec > OD_MOVE_ACC_MAX)
+		|| (maxSpd < OD_MOVE_SPEED_MIN) || (maxSpd > OD_MOVE_SPEED_MAX)
+		|| (minSpd < OD_MOVE_SPEED_MIN) || (minSpd > maxSpd))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	if (!devFeature(ctx->dev, DEV_FEAT_MOVE_PROFILE))
+	{
+		return PLCPI_ERR_HW_VER;
+	}
+	libLock(ctx->bus);
+	ret = odOutMoveSet(ctx->dev, ch, acc, dec, minSpd, maxSpd);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOdWait(PlcpiCtxType *ctx, uint8_t chMask, int timeoutMs)
+{
+	uint64_t start = 0;
+	int ret = 0;
+
+	if ( (NULL == ctx) || (0 == (chMask & ((1 << OD_CH_NO) - 1)))
+		|| (chMask >> OD_CH_NO) || (timeoutMs < 0))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	start = getTimeUs();
+	libLock(ctx->bus);
+	// odWaitPulses() gives the lock back while it sleeps
+	ret = odWaitPulses(ctx->dev, chMask, 0, timeoutMs, NULL);
+	busUnlock(ctx->bus);
+	ret = libStatus(ret);
+	if ( (ret == PLCPI_ERR_IO) && (timeoutMs > 0)
+		&& (getTimeUs() - start >= (uint64_t)timeoutMs * 1000))
+	{
+		return PLCPI_ERR_TIMEOUT;
+	}
+	return ret;
+}
+
+int plcpiPwmFreqSet(PlcpiCtxType *ctx, int hz)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (hz < 10) || (hz > 65500))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	if (!devFeature(ctx->dev, DEV_FEAT_PWM_FREQ))
+	{
+		return PLCPI_ERR_HW_VER;
+	}
+	libLock(ctx->bus);
+	ret = pwmFreqSet(ctx->dev, hz);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiPwmFreqGet(PlcpiCtxType *ctx, int *hz)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == hz))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	if (!devFeature(ctx->dev, DEV_FEAT_PWM_FREQ))
+	{
+		return PLCPI_ERR_HW_VER;
+	}
+	libLock(ctx->bus);
+	ret = pwmFreqGet(ctx->dev, hz);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiEncThresholdSet(PlcpiCtxType *ctx, int ch, uint32_t val)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (ch < 0) || (ch > OD_CH_NR_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = encSetThreshold(ctx->dev, ch, val);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- Watchdog ---------------------------------------------------------
+int plcpiWdtReload(PlcpiCtxType *ctx)
+{
+	int ret = 0;
+
+	if (NULL == ctx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = wdtReload(ctx->dev);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiWdtPeriodSet(PlcpiCtxType *ctx, int seconds)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (seconds < 0) || (seconds > WDT_PERIOD_MAX))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = wdtPeriodSet(ctx->dev, seconds);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiWdtPeriodGet(PlcpiCtxType *ctx, int *seconds)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == seconds))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = wdtPeriodGet(ctx->dev, seconds);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- Diagnostics and 1-Wire -------------------------------------------
+int plcpiDiagGet(PlcpiCtxType *ctx, int *temperature, int *mV)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == temperature) || (NULL == mV))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = diagGet(ctx->dev, temperature, mV);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOwbCountGet(PlcpiCtxType *ctx, int *count)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == count))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = owbCountGet(ctx->dev, count);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+int plcpiOwbTempGet(PlcpiCtxType *ctx, float *temp)
+{
+	int ret = 0;
+
+	if ( (NULL == ctx) || (NULL == temp))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	libLock(ctx->bus);
+	ret = owbTempGetAll(ctx->dev, temp);
+	busUnlock(ctx->bus);
+	return libStatus(ret);
+}
+
+//----------------------------------- Transactions -----------------------------------------------------
+int plcpiTxBegin(PlcpiCtxType *ctx, PlcpiTxType **tx)
+{
+	PlcpiTxType *t = NULL;
+
+	if ( (NULL == ctx) || (NULL == tx))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	t = malloc(sizeof(PlcpiTxType));
+	if (NULL == t)
+	{
+		*tx = NULL;
+		return PLCPI_ERR_NO_MEM;
+	}
+	t->bus = ctx->bus;
+	txInit(&t->tx, ctx->dev);
+	*tx = t;
+	return PLCPI_OK;
+}
+
+int plcpiTxWrite(PlcpiTxType *tx, int add, const uint8_t *buff, int size)
+{
+	int ret = 0;
+
+	if (NULL == tx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	ret = txWrite(&tx->tx, add, buff, size);
+	return ret < 0 ? PLCPI_ERR_ARG : ret;
+}
+
+int plcpiTxRead(PlcpiTxType *tx, int add, uint8_t *buff, int size)
+{
+	int ret = 0;
+
+	if (NULL == tx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	ret = txRead(&tx->tx, add, buff, size);
+	return ret < 0 ? PLCPI_ERR_ARG : ret;
+}
+
+int plcpiTxCommit(PlcpiTxType *tx, int *result)
+{
+	int count = 0;
+	int ret = 0;
+	int i = 0;
+
+	if (NULL == tx)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	count = tx->tx.count;
+	libLock(tx->bus);
+	ret = txCommit(&tx->tx, result);
+	busUnlock(tx->bus);
+	for (i = 0; result && (i < count); i++)
+	{
+		result[i] = libStatus(result[i]);
+	}
+	free(tx);
+	return libStatus(ret);
+}
+
+void plcpiTxAbort(PlcpiTxType *tx)
+{
+	free(tx);
+}
+
+//----------------------------------- Read consistency -------------------------------------------------
+int plcpiConsPolicySet(int add, int size, int type, int n, int m,
+	uint32_t limit)
+{
+	ConsPolicyType p;
+
+	if ( (type < 0) || (type >= CONS_NR) || (n < 0) || (n > 255) || (m < 0)
+		|| (m > 255))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	p.type = (u8)type;
+	p.n = (u8)n;
+	p.m = (u8)m;
+	p.limit = limit;
+	return consPolicySet(add, size, &p) == OK ? PLCPI_OK : PLCPI_ERR_ARG;
+}
+
+int plcpiConsStatGet(PlcpiCtxType *ctx, int type, uint32_t *calls,
+	uint32_t *reads, uint32_t *retries, uint32_t *failures)
+{
+	ConsStatType *st = NULL;
+
+	if ( (NULL == ctx) || (type < 0) || (type >= CONS_NR))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	st = &devGet(ctx->dev)->cons[type];
+	if (calls)
+	{
+		*calls = st->calls;
+	}
+	if (reads)
+	{
+		*reads = st->reads;
+	}
+	if (retries)
+	{
+		*retries = st->retries;
+	}
+	if (failures)
+	{
+		*failures = st->failures;
+	}
+	return PLCPI_OK;
+}
+
+//----------------------------------- Read cache -------------------------------------------------
+int plcpiCacheAgeSet(int cls, uint64_t maxAgeUs)
+{
+	return cacheAgeSet(cls, maxAgeUs) == OK ? PLCPI_OK : PLCPI_ERR_ARG;
+}
+
+int plcpiCacheClassSet(int add, int size, int cls)
+{
+	return cacheClassSet(add, size, cls) == OK ? PLCPI_OK : PLCPI_ERR_ARG;
+}
+
+int plcpiCacheStatGet(PlcpiCtxType *ctx, int cls, uint32_t *hits,
+	uint32_t *misses)
+{
+	CacheStatType *st = NULL;
+
+	if ( (NULL == ctx) || (cls < 0) || (cls >= CACHE_NR))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	st = &devGet(ctx->dev)->cache[cls];
+	if (hits)
+	{
+		*hits = st->hits;
+	}
+	if (misses)
+	{
+		*misses = st->misses;
+	}
+	return PLCPI_OK;
+}
+
+//----------------------------------- I2C tracer -------------------------------------------------
+void plcpiTraceStart(void)
+{
+	traceStart();
+}
+
+void plcpiTraceStop(void)
+{
+	traceStop();
+}
+
+int plcpiTraceDump(const char *path)
+{
+	if (NULL == path)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	return traceDump(path) == OK ? PLCPI_OK : PLCPI_ERR_IO;
+}
+
+int plcpiTraceRegGet(int add, uint32_t *count, uint32_t *errors,
+	uint64_t *totalUs, uint32_t *maxUs)
+{
+	TraceRegType r;
+
+	if (OK != traceRegGet(add, &r))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	if (count)
+	{
+		*count = r.count;
+	}
+	if (errors)
+	{
+		*errors = r.errors;
+	}
+	if (totalUs)
+	{
+		*totalUs = r.sumUs;
+	}
+	if (maxUs)
+	{
+		*maxUs = r.maxUs;
+	}
+	return PLCPI_OK;
+}
+
+//----------------------------------- Output command ring -------------------------------------------------
+int plcpiRingOpen(const char *name, PlcpiRingType **ring)
+{
+	PlcpiRingType *r = NULL;
+
+	if ( (NULL == name) || (NULL == ring))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	r = calloc(1, sizeof(PlcpiRingType));
+	if (NULL == r)
+	{
+		return PLCPI_ERR_NO_MEM;
+	}
+	r->shm = ringMap(name);
+	if (NULL == r->shm)
+	{
+		free(r);
+		return PLCPI_ERR_ARG;
+	}
+	*ring = r;
+	return PLCPI_OK;
+}
+
+int plcpiRingPut(PlcpiRingType *ring, int cmd, int ch, int32_t val,
+	uint32_t *seq)
+{
+	RingCmdType c;
+
+	if ( (NULL == ring) || (cmd < 0) || (cmd >= RING_CMD_NR) || (ch < 0)
+		|| (ch > 255))
+	{
+		return PLCPI_ERR_ARG;
+	}
+	c.type = (uint8_t)cmd;
+	c.ch = (uint8_t)ch;
+	c.res = 0;
+	c.val = val;
+	return ringPut(ring->shm, &c, seq) == OK ? PLCPI_OK : PLCPI_ERR_FULL;
+}
+
+int plcpiRingDoneGet(PlcpiRingType *ring, uint32_t *done, uint32_t *errors)
+{
+	if (NULL == ring)
+	{
+		return PLCPI_ERR_ARG;
+	}
+	if (done)
+	{
+		*done = __atomic_load_n(&ring->shm->done, __ATOMIC_ACQUIRE);
+	}
+	if (errors)
+	{
+		*errors = __atomic_load_n(&ring->shm->errors, __ATOMIC_RELAXED);
+	}
+	return PLCPI_OK;
+}
+
+void plcpiRingClose(PlcpiRingType *ring)
+{
+	if (NULL != ring)
+	{
+		ringUnmap(ring->shm);
+		free(ring);
+	}
+}
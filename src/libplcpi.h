@@ -0,0 +1,240 @@
+/*
+ * libplcpi.h:
+ *	C interface to the Raspberry Pi's plcpi card, the same transfers the
+ *	plcpi command uses without the process start cost.
+ *	Copyright (c) 2016-2024 Sequent Microsystem
+ *	<http://www.sequentmicrosystem.com>
+ ***********************************************************************
+ *	All the functions return PLCPI_OK or a negative PlcpiErrType code and
+ *	never print. Every call holds the I2C bus lock shared with the plcpi
+ *	command for the duration of its transfers. Channels are numbered from 1.
+ *	The relay and GPIO writes are read back in the same transfer and repeated
+ *	a bounded number of times, PLCPI_ERR_IO means the output did not follow.
+ ***********************************************************************
+ */
+#ifndef LIBPLCPI_H_
+#define LIBPLCPI_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LIBPLCPI_VERSION_MAJOR 1
+#define LIBPLCPI_VERSION_MINOR 8
+
+typedef enum
+{
+	PLCPI_OK = 0,
+	PLCPI_ERR_ARG = -1, // invalid context, argument or channel out of range
+	PLCPI_ERR_BUS = -2, // the I2C adapter can not be opened
+	PLCPI_ERR_NO_BOARD = -3, // no card answers at this stack level
+	PLCPI_ERR_IO = -4, // I2C transfer failed
+	PLCPI_ERR_HW_VER = -5, // not available on this hardware version
+	PLCPI_ERR_NO_MEM = -6,
+	PLCPI_ERR_SUSPENDED = -7, // the board failed repeatedly, transfers refused until its backoff ends
+	PLCPI_ERR_FULL = -8, // command ring full, the resident service is behind
+	PLCPI_ERR_TIMEOUT = -9, // the awaited condition was not reached in time
+} PlcpiErrType;
+
+typedef struct PlcpiCtx PlcpiCtxType;
+typedef struct PlcpiTx PlcpiTxType;
+
+const char* plcpiStrError(int err);
+
+/**
+ * Open one card
+ * Params:
+ * 	stack - board level id [0..7]
+ * 	ctx - the new context, release it with plcpiClose()
+ */
+int plcpiOpen(int stack, PlcpiCtxType **ctx);
+// same as plcpiOpen() for a card on the adapter /dev/i2c-<bus>
+int plcpiOpenBus(int bus, int stack, PlcpiCtxType **ctx);
+void plcpiClose(PlcpiCtxType *ctx);
+int plcpiStackGet(PlcpiCtxType *ctx);
+int plcpiVersionGet(PlcpiCtxType *ctx, int *hwMajor, int *hwMinor,
+	int *fwMajor, int *fwMinor);
+// I2C transfers done with this context and the failed ones
+int plcpiStatGet(PlcpiCtxType *ctx, uint32_t *reads, uint32_t *writes,
+	uint32_t *errors);
+
+int plcpiRelayChSet(PlcpiCtxType *ctx, int ch, int on);
+int plcpiRelayChGet(PlcpiCtxType *ctx, int ch, int *on);
+int plcpiRelaySet(PlcpiCtxType *ctx, uint8_t mask);
+int plcpiRelayGet(PlcpiCtxType *ctx, uint8_t *mask);
+
+int plcpiOptoGet(PlcpiCtxType *ctx, uint8_t *mask);
+// edges: 0 - disabled, 1 - rising, 2 - falling, 3 - both
+int plcpiOptoEdgeSet(PlcpiCtxType *ctx, int ch, int edges);
+int plcpiOptoEdgeGet(PlcpiCtxType *ctx, int ch, int *edges);
+int plcpiOptoCountGet(PlcpiCtxType *ctx, int ch, uint32_t *count);
+int plcpiOptoCountReset(PlcpiCtxType *ctx, int ch);
+int plcpiOptoEncCountGet(PlcpiCtxType *ctx, int ch, int32_t *count);
+int plcpiOptoEncCountReset(PlcpiCtxType *ctx, int ch);
+
+int plcpiGpioChSet(PlcpiCtxType *ctx, int ch, int on);
+int plcpiGpioChGet(PlcpiCtxType *ctx, int ch, int *on);
+int plcpiGpioChDirSet(PlcpiCtxType *ctx, int ch, int input);
+
+int plcpiAdcGet(PlcpiCtxType *ctx, int ch, float *volts);
+int plcpiDacSet(PlcpiCtxType *ctx, int ch, float volts);
+int plcpiDacGet(PlcpiCtxType *ctx, int ch, float *volts);
+
+int plcpiOdSet(PlcpiCtxType *ctx, int ch, float percent);
+int plcpiOdGet(PlcpiCtxType *ctx, int ch, float *percent);
+// ch [1..8], channels 5 to 8 are channels 1 to 4 in opposite direction
+int plcpiOdPulsesWrite(PlcpiCtxType *ctx, int ch, uint32_t pulses);
+int plcpiOdPulsesRead(PlcpiCtxType *ctx, int ch, uint32_t *pulses);
+int plcpiOdMoveSet(PlcpiCtxType *ctx, int ch, int acc, int dec, int minSpd,
+	int maxSpd);
+// wait for the pulses of the channels in chMask (bit 0 for channel 1) to be
+// performed, timeoutMs 0 for no limit; the bus lock is released while waiting
+int plcpiOdWait(PlcpiCtxType *ctx, uint8_t chMask, int timeoutMs);
+int plcpiPwmFreqSet(PlcpiCtxType *ctx, int hz);
+int plcpiPwmFreqGet(PlcpiCtxType *ctx, int *hz);
+// ch 0 disable the threshold, [1..4] reset the pulses of this open drain channel
+int plcpiEncThresholdSet(PlcpiCtxType *ctx, int ch, uint32_t val);
+
+int plcpiWdtReload(PlcpiCtxType *ctx);
+int plcpiWdtPeriodSet(PlcpiCtxType *ctx, int seconds);
+int plcpiWdtPeriodGet(PlcpiCtxType *ctx, int *seconds);
+
+int plcpiDiagGet(PlcpiCtxType *ctx, int *temperature, int *mV);
+int plcpiOwbCountGet(PlcpiCtxType *ctx, int *count);
+// temp - 8 temperatures in Celsius degrees, the first plcpiOwbCountGet() are valid
+int plcpiOwbTempGet(PlcpiCtxType *ctx, float *temp);
+
+/*
+ * Register transaction groups, addressed with the card memory map (I2C_MEM_ADD
+ * in plcpi.h). The queued accesses are merged in the largest contiguous blocks
+ * and executed on commit in as few I2C transactions as possible, the writes
+ * first, so the reads of a group see its writes. The writes are chained in one
+ * transaction, every read block takes one; the bus lock is held for the whole
+ * commit, other processes can not access the bus in between, but the card
+ * may update its inputs between two read blocks. Overlapping writes: the last
+ * queued value wins.
+ */
+int plcpiTxBegin(PlcpiCtxType *ctx, PlcpiTxType **tx);
+// queue size bytes from buff at the register address add, return the operation index
+int plcpiTxWrite(PlcpiTxType *tx, int add, const uint8_t *buff, int size);
+// queue a read into buff, filled on commit, return the operation index
+int plcpiTxRead(PlcpiTxType *tx, int add, uint8_t *buff, int size);
+// result - status of every queued operation, can be NULL; the group is released
+int plcpiTxCommit(PlcpiTxType *tx, int *result);
+void plcpiTxAbort(PlcpiTxType *tx);
+
+/*
+ * Read consistency policies, per register address and process wide, set them
+ * before the boards are used from several threads. The value policies apply
+ * to the values up to 4 bytes, PLCPI_CONS_BLOCK to the bulk reads.
+ */
+typedef enum
+{
+	PLCPI_CONS_SINGLE = 0, // one read
+	PLCPI_CONS_AGREE, // n equal values out of at most m reads
+	PLCPI_CONS_MONOTONIC, // counter step below limit counts/s since the last read, else agreement
+	PLCPI_CONS_BLOCK, // two equal consecutive reads, at most m reads, m >= 2
+} PlcpiConsType;
+
+int plcpiConsPolicySet(int add, int size, int type, int n, int m,
+	uint32_t limit);
+// reads done with a policy on this context, retries are the reads over the policy minimum
+int plcpiConsStatGet(PlcpiCtxType *ctx, int type, uint32_t *calls,
+	uint32_t *reads, uint32_t *retries, uint32_t *failures);
+
+/*
+ * Read cache, the registers are grouped in classes with a freshness budget,
+ * process wide. A read is answered from the last value read when all its
+ * registers are younger than the budget of their class. By default only the
+ * configuration and the version registers are cached, until written; a write
+ * also drops the cached inputs and diagnostics of the board.
+ */
+typedef enum
+{
+	PLCPI_CACHE_LIVE = 0, // commands, watchdog, calibration: never cached
+	PLCPI_CACHE_INPUT, // relays, opto, gpio, ADC, counters and encoders
+	PLCPI_CACHE_DIAG, // temperature and 3.3V supply
+	PLCPI_CACHE_CONFIG, // gpio direction, edges, encoders enable, PWM frequency
+	PLCPI_CACHE_REVISION, // hardware and firmware version
+	PLCPI_CACHE_NR
+} PlcpiCacheType;
+
+#define PLCPI_CACHE_FOREVER UINT64_MAX
+
+// maxAgeUs - 0 to always read the bus, PLCPI_CACHE_FOREVER to read once
+int plcpiCacheAgeSet(int cls, uint64_t maxAgeUs);
+int plcpiCacheClassSet(int add, int size, int cls);
+int plcpiCacheStatGet(PlcpiCtxType *ctx, int cls, uint32_t *hits,
+	uint32_t *misses);
+
+/*
+ * I2C transaction tracer, process wide. Every transaction is recorded in a
+ * ring of the last 4096 transactions and its latency added to the histogram
+ * of its first register. Setting PLCPI_TRACE=<file> in the environment starts
+ * the trace at the first board open and writes the file at exit, display it
+ * with "plcpi -trace <file>".
+ */
+void plcpiTraceStart(void); // clear and start, call it while the bus is idle
+void plcpiTraceStop(void);
+int plcpiTraceDump(const char *path);
+int plcpiTraceRegGet(int add, uint32_t *count, uint32_t *errors,
+	uint64_t *totalUs, uint32_t *maxUs);
+
+/*
+ * Transfer errors and recovery. The failed transfers are counted per board
+ * and errno class. After 5 consecutive failures a board is suspended for a
+ * backoff of 100 ms doubling up to 10 s, its calls return PLCPI_ERR_SUSPENDED
+ * without using the bus. At the end of the backoff the recovery actions run
+ * and the next transfer probes the board.
+ */
+typedef enum
+{
+	PLCPI_ERR_CLASS_NACK = 0, // board missing or not answering
+	PLCPI_ERR_CLASS_TIMEOUT,
+	PLCPI_ERR_CLASS_BUS, // arbitration lost or bus stuck
+	PLCPI_ERR_CLASS_FD, // adapter removed or descriptor invalid
+	PLCPI_ERR_CLASS_OTHER,
+	PLCPI_ERR_CLASS_NR
+} PlcpiErrClassType;
+
+#define PLCPI_RECOVER_REOPEN 0x01 // open the adapter again, the default
+#define PLCPI_RECOVER_REBIND 0x02 // rebind the adapter driver on bus errors, needs root
+#define PLCPI_RECOVER_CLEAR 0x04 // call busClear(bus) on bus errors
+
+int plcpiRecoverSet(uint32_t flags, void (*busClear)(int bus));
+int plcpiErrStatGet(PlcpiCtxType *ctx, uint32_t err[PLCPI_ERR_CLASS_NR],
+	uint32_t *skipped, uint32_t *trips, uint32_t *recoveries);
+
+/*
+ * Output command ring of the resident service: the "ring <bus>:<stack>"
+ * request on the service socket creates a shared memory ring for the board and
+ * answers its name. The commands are queued without any system call and
+ * executed in order by the service at the start of every poll of the board,
+ * the command of sequence seq is done when the done counter reaches seq.
+ */
+typedef struct PlcpiRing PlcpiRingType;
+
+typedef enum
+{
+	PLCPI_RING_RELAY = 0, // val: relays mask
+	PLCPI_RING_GPIO, // val: gpio mask
+	PLCPI_RING_OD, // ch [1..4], val: duty cycle in 0.01%
+	PLCPI_RING_DAC, // ch [1..4], val: mV
+	PLCPI_RING_PULSES, // ch [1..8], val: pulses
+} PlcpiRingCmdType;
+
+int plcpiRingOpen(const char *name, PlcpiRingType **ring);
+// seq - sequence number of the command, can be NULL
+int plcpiRingPut(PlcpiRingType *ring, int cmd, int ch, int32_t val,
+	uint32_t *seq);
+// done - commands executed, errors - the failed ones, both can be NULL
+int plcpiRingDoneGet(PlcpiRingType *ring, uint32_t *done, uint32_t *errors);
+void plcpiRingClose(PlcpiRingType *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif //LIBPLCPI_H_
@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "hist.h"
+
+/*
+ * Hardware in the loop test, the outputs must be wired back to the opto inputs:
+ * 	rel - relay n to opto input n, n = 1..8
+ * 	od - open drain output n to opto input n, n = 1..4
+ */
+
+#define LB_MODE_REL 0
+#define LB_MODE_OD 1
+
+#define LB_REL_ITERATIONS 20
+#define LB_OD_ITERATIONS 100
+#define LB_REL_TIMEOUT_US 100000 // no input change after this is a failure
+#define LB_OD_TIMEOUT_US 20000
+#define LB_REL_MAX_LATENCY_US 20000 // pass/fail limits
+#define LB_OD_MAX_LATENCY_US 5000
+#define LB_RATE_WINDOW_US 1000000 // toggle rate measurement window
+#define LB_OD_PULSES 1000 // edge counter accuracy test
+#define LB_OD_PULSES_TIMEOUT_MS 30000
+
+typedef struct
+{
+	HistType latency; // output write to input change, us
+	int timeouts;
+	float rate; // confirmed toggles per second
+	u32 counted; // edges counted by the board
+	u32 commanded; // edges generated
+} LbResultType;
+
+static int lbOutSet(int dev, int mode, int ch, int on)
+{
+	if (mode == LB_MODE_REL)
+	{
+		return relayChSet(dev, (u8)ch, on ? ON : OFF);
+	}
+	return odSet(dev, ch, on ? 100 : 0);
+}
+
+/**
+ * Poll the opto input until it follow the output, the latency is measured
+ * from the end of the output write
+ */
+static int lbInWait(int dev, int ch, int on, uint32_t timeoutUs,
+	uint32_t *latency)
+{
+	uint64_t t0 = getTimeUs();
+	uint64_t now = t0;
+	int val = 0;
+
+	while (now - t0 < timeoutUs)
+	{
+		if (OK != optoGet(dev, &val))
+		{
+			return ERROR;
+		}
+		now = getTimeUs();
+		if ( ( (val >> (ch - 1)) & 1) == (on ? 1 : 0))
+		{
+			*latency = (uint32_t) (now - t0);
+			return OK;
+		}
+	}
+	return ERROR;
+}
+
+static int lbToggle(int dev, int mode, int ch, int on, uint32_t timeoutUs,
+	uint32_t *latency)
+{
+	if (OK != lbOutSet(dev, mode, ch, on))
+	{
+		return ERROR;
+	}
+	return lbInWait(dev, ch, on, timeoutUs, latency);
+}
+
+static void lbChannelTest(int dev, int mode, int ch, int iterations,
+	LbResultType *res)
+{
+	uint32_t timeoutUs = mode == LB_MODE_REL ? LB_REL_TIMEOUT_US :
+		LB_OD_TIMEOUT_US;
+	uint32_t latency = 0;
+	uint64_t start = 0;
+	int edges = 0;
+	int i = 0;
+	u8 edgeCfg = 0;
+
+	memset(res, 0, sizeof(LbResultType));
+	histInit(&res->latency);
+	lbOutSet(dev, mode, ch, 0);
+	busyWait(mode == LB_MODE_REL ? 50 : 5);
+
+	// output to input latency distribution
+	for (i = 0; i < iterations; i++)
+	{
+		if (OK == lbToggle(dev, mode, ch, 1, timeoutUs, &latency))
+		{
+			histAdd(&res->latency, latency);
+		}
+		else
+		{
+			res->timeouts++;
+		}
+		if (OK == lbToggle(dev, mode, ch, 0, timeoutUs, &latency))
+		{
+			histAdd(&res->latency, latency);
+		}
+		else
+		{
+			res->timeouts++;
+		}
+	}
+
+	// achievable toggle rate, every edge confirmed on the input
+	start = getTimeUs();
+	while (getTimeUs() - start < LB_RATE_WINDOW_US)
+	{
+		if (OK != lbToggle(dev, mode, ch, (edges + 1) & 1, timeoutUs, &latency))
+		{
+			res->timeouts++;
+			break;
+		}
+		edges++;
+	}
+	res->rate = (float)edges * 1000000 / (float) (getTimeUs() - start);
+	lbOutSet(dev, mode, ch, 0);
+	busyWait(mode == LB_MODE_REL ? 50 : 5);
+
+	// edge counter accuracy against commanded pulses
+	if (OK != optoEdgeGet(dev, (u8)ch, &edgeCfg))
+	{
+		edgeCfg = 0;
+	}
+	if ( (OK != optoEdgeSet(dev, (u8)ch, 1)) || (OK != optoCountReset(dev, (u8)ch)))
+	{
+		return;
+	}
+	if (mode == LB_MODE_REL)
+	{
+		for (i = 0; i < iterations; i++)
+		{
+			if ( (OK != lbToggle(dev, mode, ch, 1, timeoutUs, &latency))
+				|| (OK != lbToggle(dev, mode, ch, 0, timeoutUs, &latency)))
+			{
+				res->timeouts++;
+			}
+		}
+		res->commanded = (u32)iterations;
+	}
+	else
+	{
+		if ( (OK == odWritePulses(dev, ch, LB_OD_PULSES))
+			&& (OK
+				== odWaitPulses(dev, (u8) (1 << (ch - 1)), 0, LB_OD_PULSES_TIMEOUT_MS,
+					NULL)))
+		{
+			res->commanded = LB_OD_PULSES;
+		}
+		else
+		{
+			res->timeouts++;
+		}
+	}
+	busyWait(mode == LB_MODE_REL ? 50 : 5);
+	optoCountGet(dev, (u8)ch, &res->counted);
+	optoEdgeSet(dev, (u8)ch, edgeCfg);
+	lbOutSet(dev, mode, ch, 0);
+}
+
+int doLoopbackTest(int argc, char *argv[])
+{
+	int dev = 0;
+	int mode = LB_MODE_REL;
+	int channels = RELAY_CH_NR_MAX;
+	int iterations = 0;
+	int ch = 0;
+	int pass = 0;
+	int allPass = 1;
+	uint32_t maxLatency = 0;
+	char title[64];
+	FILE *out = stdout;
+	LbResultType res;
+
+	if ( (argc < 4) || (argc > 6))
+	{
+		return ARG_CNT_ERR;
+	}
+	if (strcasecmp(argv[3], "rel") == 0)
+	{
+		mode = LB_MODE_REL;
+		channels = RELAY_CH_NR_MAX;
+		iterations = LB_REL_ITERATIONS;
+		maxLatency = LB_REL_MAX_LATENCY_US;
+	}
+	else if (strcasecmp(argv[3], "od") == 0)
+	{
+		mode = LB_MODE_OD;
+		channels = OD_CH_NR_MAX;
+		iterations = LB_OD_ITERATIONS;
+		maxLatency = LB_OD_MAX_LATENCY_US;
+	}
+	else
+	{
+		printf("Invalid loopback type, must be rel or od!\n");
+		return ARG_ERR;
+	}
+	if (argc > 4)
+	{
+		iterations = atoi(argv[4]);
+		if (iterations < 1)
+		{
+			printf("Invalid iterations number!\n");
+			return ARG_ERR;
+		}
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (argc > 5)
+	{
+		out = fopen(argv[5], "w");
+		if (NULL == out)
+		{
+			printf("Fail to open result file\n");
+			return ERROR;
+		}
+	}
+	for (ch = 1; ch <= channels; ch++)
+	{
+		lbChannelTest(dev, mode, ch, iterations, &res);
+		pass = (res.timeouts == 0) && (res.latency.max <= maxLatency)
+			&& (res.counted == res.commanded);
+		allPass &= pass;
+		fprintf(out,
+			"%s %d -> opto %d ........ %s (timeouts %d, toggle rate %0.1f/s, edges counted %u of %u)\n",
+			mode == LB_MODE_REL ? "Relay" : "Open drain", ch, ch,
+			pass ? "PASS" : "FAIL!", res.timeouts, res.rate, res.counted,
+			res.commanded);
+		snprintf(title, sizeof(title), "  latency ch %d", ch);
+		histPrint(out, &res.latency, title, "us");
+	}
+	fprintf(out, "Loopback Test ......................... %s\n",
+		allPass ? "PASS" : "FAIL!");
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return allPass ? OK : ERROR;
+}
@@ -0,0 +1,444 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define MQ_POLL_US 200 // remaining pulses poll period
+#define MQ_DEFAULT_TIMEOUT_MS 60000
+
+#define ODW_TIGHT_US 5000 // poll tight when the predicted completion is closer than this
+#define ODW_TIGHT_POLL_US 500
+#define ODW_SLEEP_PERCENT 90 // sleep this part of the predicted time, then predict again
+
+#ifndef PLCPI_CLI
+void mqInit(MqType *mq, int dev, int ch, unsigned int watermark)
+{
+	if (NULL == mq)
+	{
+		return;
+	}
+	memset(mq, 0, sizeof(MqType));
+	mq->dev = dev;
+	mq->ch = ch;
+	mq->watermark = watermark;
+}
+
+/**
+ * Add one move to the queue
+ * Params:
+ * 	mq - motion queue
+ * 	pulses - pulses count, negative values move the axis in opposite direction
+ */
+int mqPush(MqType *mq, int pulses)
+{
+	MqSegType *seg = NULL;
+
+	if ( (NULL == mq) || (mq->count >= MQ_SIZE) || (pulses == 0))
+	{
+		return ERROR;
+	}
+	seg = &mq->seg[(mq->head + mq->count) % MQ_SIZE];
+	if (pulses > 0)
+	{
+		seg->ch = mq->ch;
+		seg->pulses = (unsigned int)pulses;
+	}
+	else
+	{
+		seg->ch = mq->ch + OD_CH_NO;
+		seg->pulses = (unsigned int) (-pulses);
+	}
+	mq->count++;
+	return OK;
+}
+
+int mqDepth(MqType *mq)
+{
+	if (NULL == mq)
+	{
+		return 0;
+	}
+	return mq->count;
+}
+
+static MqSegType* mqPop(MqType *mq)
+{
+	MqSegType *seg = NULL;
+
+	if (mq->count == 0)
+	{
+		return NULL;
+	}
+	seg = &mq->seg[mq->head];
+	mq->head = (mq->head + 1) % MQ_SIZE;
+	mq->count--;
+	return seg;
+}
+
+/**
+ * Wait for the remaining pulses of the axis to drop to the level
+ * Params:
+ * 	mq - motion queue
+ * 	level - remaining pulses level
+ * 	deadline - time limit in us
+ * 	zeroTs - filled with the first time the axis was seen stopped, 0 if never
+ */
+static int mqWaitLevel(MqType *mq, unsigned int level, uint64_t deadline,
+	uint64_t *zeroTs)
+{
+	unsigned int remaining = 0;
+
+	*zeroTs = 0;
+	while (1)
+	{
+		if (OK != odReadPulses(mq->dev, mq->ch, &remaining))
+		{
+			return ERROR;
+		}
+		mq->polls++;
+		if (remaining == 0)
+		{
+			*zeroTs = getTimeUs();
+		}
+		if (remaining <= level)
+		{
+			return OK;
+		}
+		if (getTimeUs() > deadline)
+		{
+			return ERROR;
+		}
+		busyWaitUs(MQ_POLL_US);
+	}
+}
+
+/**
+ * Execute all the queued moves, the next segment is kept staged in the board
+ * and started with the single byte execute command as soon as the remaining
+ * pulses reach the queue watermark.
+ */
+int mqRun(MqType *mq, int timeoutMs)
+{
+	MqSegType *seg = NULL;
+	uint64_t deadline = 0;
+	uint64_t zeroTs = 0;
+	uint64_t gap = 0;
+
+	if (NULL == mq)
+	{
+		return ERROR;
+	}
+	if (timeoutMs <= 0)
+	{
+		timeoutMs = MQ_DEFAULT_TIMEOUT_MS;
+	}
+	deadline = getTimeUs() + (uint64_t)timeoutMs * 1000;
+
+	seg = mqPop(mq);
+	if (NULL == seg)
+	{
+		return OK;
+	}
+	if (OK != odWritePulses(mq->dev, seg->ch, seg->pulses))
+	{
+		return ERROR;
+	}
+	mq->segments++;
+
+	while (NULL != (seg = mqPop(mq)))
+	{
+		if (OK != odSaveOdPulses(mq->dev, seg->ch, seg->pulses))
+		{
+			return ERROR;
+		}
+		if (OK != mqWaitLevel(mq, mq->watermark, deadline, &zeroTs))
+		{
+			return ERROR;
+		}
+		if (OK != odExecPulses(mq->dev, seg->ch))
+		{
+			return ERROR;
+		}
+		if (zeroTs != 0)
+		{
+			gap = getTimeUs() - zeroTs;
+			mq->idleGaps++;
+			mq->idleUs += gap;
+			if (gap > mq->maxIdleUs)
+			{
+				mq->maxIdleUs = gap;
+			}
+		}
+		mq->segments++;
+	}
+	return mqWaitLevel(mq, 0, deadline, &zeroTs);
+}
+
+/**
+ * Pwm frequency of the slowest selected channel, 0 if unknown: the board has
+ * no frequency setting or a selected channel reports none
+ */
+static int odWaitFreqGet(int dev, u8 chMask)
+{
+	u8 buff[OD_CH_NO * 2];
+	u16 raw = 0;
+	int global = 0;
+	int freq = 0;
+	int ch = 0;
+
+	if (!devFeature(dev, DEV_FEAT_PWM_FREQ))
+	{
+		return 0;
+	}
+	if ( (OK != i2cMem8Read(dev, I2C_MEM_OD_PWM_FREQUENCY_CH1, buff,
+		sizeof(buff))) || (OK != pwmFreqGet(dev, &global)))
+	{
+		return 0;
+	}
+	for (ch = 0; ch < OD_CH_NO; ch++)
+	{
+		if (! (chMask & (1 << ch)))
+		{
+			continue;
+		}
+		memcpy(&raw, &buff[ch * 2], 2);
+		// a channel never set on its own runs at the board frequency
+		if (raw == 0)
+		{
+			raw = (u16)global;
+		}
+		if (raw == 0)
+		{
+			return 0;
+		}
+		if ( (freq == 0) || (raw < freq))
+		{
+			freq = raw;
+		}
+	}
+	return freq;
+}
+
+/**
+ * Wait for the remaining pulses of one or more open drain channels to drop to
+ * the level. The completion time is predicted from the pwm frequency of the
+ * slowest channel and the remaining count so the board is read only a few
+ * times during long moves and polled tight only at the end; without a known
+ * frequency the board is polled tight all along. The caller holds the bus
+ * lock, it is released while sleeping.
+ * Params:
+ * 	dev - I2C port
+ * 	chMask - bit 0 for channel 1 ... bit 3 for channel 4
+ * 	level - remaining pulses level, 0 to wait for completion
+ * 	timeoutMs - time limit, 0 for no limit
+ * 	polls - filled with the number of board reads, may be NULL
+ */
+int odWaitPulses(int dev, u8 chMask, unsigned int level, int timeoutMs,
+	int *polls)
+{
+	u8 buff[OD_CH_NO * COUNTER_SIZE];
+	u32 remaining = 0;
+	u32 maxRemaining = 0;
+	int freq = 0;
+	int ch = 0;
+	int reads = 0;
+	int step = 0;
+	uint64_t now = 0;
+	uint64_t deadline = 0;
+	uint64_t waitUs = 0;
+
+	chMask &= (1 << OD_CH_NO) - 1;
+	if (0 == chMask)
+	{
+		return ERROR;
+	}
+	freq = odWaitFreqGet(dev, chMask);
+	if (timeoutMs > 0)
+	{
+		deadline = getTimeUs() + (uint64_t)timeoutMs * 1000;
+	}
+	while (1)
+	{
+		// all the channels counters in one transfer
+		if (OK != i2cMem8Read(dev, I2C_MEM_OD_PULSE_CNT_SET, buff, sizeof(buff)))
+		{
+			return ERROR;
+		}
+		reads++;
+		maxRemaining = 0;
+		for (ch = 0; ch < OD_CH_NO; ch++)
+		{
+			if (chMask & (1 << ch))
+			{
+				memcpy(&remaining, &buff[ch * COUNTER_SIZE], COUNTER_SIZE);
+				if (remaining > maxRemaining)
+				{
+					maxRemaining = remaining;
+				}
+			}
+		}
+		if (maxRemaining <= level)
+		{
+			break;
+		}
+		now = getTimeUs();
+		if ( (deadline != 0) && (now >= deadline))
+		{
+			if (polls)
+			{
+				*polls = reads;
+			}
+			return ERROR;
+		}
+		waitUs = freq > 0 ?
+			(uint64_t) (maxRemaining - level) * 1000000 / (unsigned int)freq : 0;
+		if (waitUs > ODW_TIGHT_US)
+		{
+			waitUs = waitUs * ODW_SLEEP_PERCENT / 100;
+		}
+		else
+		{
+			waitUs = ODW_TIGHT_POLL_US;
+		}
+		if ( (deadline != 0) && (now + waitUs > deadline))
+		{
+			waitUs = deadline - now;
+		}
+		// do not keep the other plcpi processes out of the bus while sleeping
+		busUnlock(devGet(dev)->bus);
+		while (waitUs > 0)
+		{
+			step = waitUs > 1000000000 ? 1000000000 : (int)waitUs;
+			busyWaitUs(step);
+			waitUs -= step;
+		}
+		busLock(devGet(dev)->bus);
+	}
+	if (polls)
+	{
+		*polls = reads;
+	}
+	return OK;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+int doOdWait(int argc, char *argv[])
+{
+	int dev = 0;
+	int ch = 0;
+	int timeout = 0;
+	u8 mask = 0;
+	char *p = NULL;
+
+	if ( (argc != 4) && (argc != 5))
+	{
+		return ARG_CNT_ERR;
+	}
+	p = argv[3];
+	while (*p)
+	{
+		ch = (int)strtol(p, &p, 10);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range [1..4]!\n");
+			return ARG_ERR;
+		}
+		mask |= 1 << (ch - 1);
+		if (*p == ',')
+		{
+			p++;
+		}
+		else if (*p != 0)
+		{
+			printf("Invalid channel list \"%s\"!\n", argv[3]);
+			return ARG_ERR;
+		}
+	}
+	if (argc == 5)
+	{
+		timeout = atoi(argv[4]);
+		if (timeout <= 0)
+		{
+			printf("Invalid timeout!\n");
+			return ARG_ERR;
+		}
+	}
+
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != odWaitPulses(dev, mask, 0, timeout, NULL))
+	{
+		printf("timeout\n");
+		return ERROR;
+	}
+	printf("done\n");
+	return OK;
+}
+
+int doOdQueue(int argc, char *argv[])
+{
+	int dev = 0;
+	int ch = 0;
+	int watermark = 0;
+	int pulses = 0;
+	int i = 0;
+	MqType mq;
+
+	if (argc < 6)
+	{
+		return ARG_CNT_ERR;
+	}
+	ch = atoi(argv[3]);
+	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+	{
+		printf("Open drain channel out of range [1..4]!\n");
+		return ARG_ERR;
+	}
+	watermark = atoi(argv[4]);
+	if (watermark < 0)
+	{
+		printf("Invalid watermark!\n");
+		return ARG_ERR;
+	}
+	if (argc - 5 > MQ_SIZE)
+	{
+		printf("Too many moves, max %d!\n", MQ_SIZE);
+		return ARG_ERR;
+	}
+
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	mqInit(&mq, dev, ch, (unsigned int)watermark);
+	for (i = 5; i < argc; i++)
+	{
+		pulses = atoi(argv[i]);
+		if (OK != mqPush(&mq, pulses))
+		{
+			printf("Invalid pulses count \"%s\"!\n", argv[i]);
+			return ARG_ERR;
+		}
+	}
+	if (OK != mqRun(&mq, 0))
+	{
+		printf("Fail to execute moves, %u done, %d queued\n", mq.segments,
+			mqDepth(&mq));
+		return ERROR;
+	}
+	printf(
+		"segments %u, polls %u, idle gaps %u, idle %0.1f ms (max %0.1f ms)\n",
+		mq.segments, mq.polls, mq.idleGaps, (float)mq.idleUs / 1000,
+		(float)mq.maxIdleUs / 1000);
+	return OK;
+}
+#endif // PLCPI_LIB
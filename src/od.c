@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "comm.h"
+#include "plcpi.h"
+
+int odGet(int dev, int ch, float *val)
+{
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	if (OK
+		!= i2cReadWordAS(dev, I2C_MEM_OD_PWM_VAL_RAW_ADD + 2 * (ch - 1), &raw))
+	{
+		return ERROR;
+	}
+	*val = 100 * (float)raw / OD_PWM_VAL_MAX;
+	return OK;
+}
+
+int odSet(int dev, int ch, float val)
+{
+	u8 buff[2] = {0, 0};
+	u16 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	if (val < 0)
+	{
+		val = 0;
+	}
+	if (val > 100)
+	{
+		val = 100;
+	}
+	raw = (u16)ceil(OD_PWM_VAL_MAX * val / 100);
+	memcpy(buff, &raw, 2);
+	if (OK
+		!= i2cMem8Write(dev, I2C_MEM_OD_PWM_VAL_RAW_ADD + 2 * (ch - 1), buff, 2))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+//----------------------------------- OD pulses --------------------------------------------------------
+#define SINGLE_TRANSFER
+
+int odWritePulses(int dev, int ch, unsigned int val)
+{
+	u8 buff[5] = {0, 0, 0, 0, 0};
+	u32 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
+	{
+		return ERROR;
+	}
+	raw = (u32)val;
+	memcpy(buff, &raw, 4);
+
+#ifdef SINGLE_TRANSFER
+	buff[4] = ch;
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 5)) // write the value
+	{
+		return ERROR;
+	}
+
+#else
+
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 4)) // write the value
+	{
+		return ERROR;
+	}
+	buff[0] = ch;
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_CMD, buff, 1))// update command
+	{
+		return ERROR;
+	}
+#endif
+	return OK;
+}
+#define PULSE_SAVE_MASK 0x10
+#define PULSE_EXEC_MASK 0x20
+
+int odSaveOdPulses(int dev, int ch, unsigned int val)
+{
+	u8 buff[5] = {0, 0, 0, 0, 0};
+	u32 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
+	{
+		return ERROR;
+	}
+	raw = (u32)val;
+	memcpy(buff, &raw, 4);
+
+	buff[4] = ch | PULSE_SAVE_MASK;
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 5)) // write the value
+	{
+		return ERROR;
+	}
+
+	return OK;
+}
+
+int odExecPulses(int dev, int ch) //execute previous saved poulses
+{
+	u8 buff[5] = {0, 0, 0, 0, 0};
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
+	{
+		return ERROR;
+	}
+	buff[0] = (0x0f & (uint8_t)ch) | PULSE_EXEC_MASK;
+
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_CMD, buff, 1)) // write the value
+	{
+		return ERROR;
+	}
+
+	return OK;
+}
+
+int odResetPulses(int dev, int ch)
+{
+	return odWritePulses(dev, ch, 0);
+}
+
+int odReadPulses(int dev, int ch, unsigned int *val)
+{
+	u32 raw = 0;
+
+	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	if (OK != i2cReadDWord(dev, I2C_MEM_OD_PULSE_CNT_SET + 4 * (ch - 1), &raw))
+	{
+		return ERROR;
+	}
+	*val = raw;
+	return OK;
+}
+
+//*************************************************************************************
+
+int pwmFreqGet(int dev, int *val)
+{
+	u16 raw = 0;
+
+	if (OK != i2cReadWordAS(dev, I2C_MEM_OD_PWM_FREQUENCY, &raw))
+	{
+		return ERROR;
+	}
+	*val = raw;
+	return OK;
+}
+
+int pwmFreqSet(int dev, int val)
+{
+	u8 buff[2] = {0, 0};
+	u16 raw = 0;
+
+	if (val < 10)
+	{
+		val = 10;
+	}
+	if (val > 65500)
+	{
+		val = 65500;
+	}
+	raw = (u16)val;
+	memcpy(buff, &raw, 2);
+	if (OK != i2cMem8Write(dev, I2C_MEM_OD_PWM_FREQUENCY, buff, 2))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+int pwmChFreqSet(int dev, int ch, int val)
+{
+	u8 buff[2] = {0, 0};
+	u16 raw = 0;
+
+	if (val < 10)
+	{
+		val = 10;
+	}
+	if (val > 65500)
+	{
+		val = 65500;
+	}
+	raw = (u16)val;
+	memcpy(buff, &raw, 2);
+	if (OK
+		!= i2cMem8Write(dev, I2C_MEM_OD_PWM_FREQUENCY_CH1 + (ch - 1) * 2, buff,
+			2))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+int odOutMoveSet(int dev, int ch, int acc, int dec, int minSpd, int maxSpd)
+{
+	uint8_t buff[8];
+	uint16_t aux16 = 0;
+
+	if (ch < CHANNEL_NR_MIN || ch > OD_CH_NR_MAX)
+	{
+		return -1;
+	}
+	if (acc < 0 || acc > OD_MOVE_ACC_MAX)
+	{
+		return -1;
+	}
+	if (dec < 0 || dec > OD_MOVE_ACC_MAX)
+	{
+		return -1;
+	}
+	aux16 = (u16)acc;
+	memcpy(buff, &aux16, sizeof(uint16_t));
+	aux16 = (u16)dec;
+	memcpy(buff + 2, &aux16, sizeof(uint16_t));
+	aux16 = (u16)maxSpd;
+	memcpy(buff + 4, &aux16, sizeof(uint16_t));
+	aux16 = (u16)minSpd;
+	memcpy(buff + 6, &aux16, sizeof(uint16_t));
+	if (OK != i2cMem8Write(dev, I2C_MEM_ODP_ACC, buff, 8))
+	{
+		return -1;
+	}
+	buff[0] = (uint8_t)ch;
+	if (OK != i2cMem8Write(dev, I2C_MEM_ODP_CMD, buff, 1))
+	{
+		return -1;
+	}
+	return OK;
+}
+
+//***************************************************Encoder threshold**********************************************
+int encSetThreshold(int dev, int ch, unsigned int val)
+{
+	u8 buff[5] = {0, 0, 0, 0, 0};
+	u32 raw = 0;
+
+	if ( (ch < 0) || (ch > OD_CH_NR_MAX)) //
+	{
+		return ERROR;
+	}
+	raw = (u32)val;
+	memcpy(buff, &raw, 4);
+
+	buff[4] = (uint8_t)ch;
+	if (OK != i2cMem8Write(dev, I2C_MEM_ENCODER_LIMIT, buff, 5)) // write the value
+	{
+		return ERROR;
+	}
+	return OK;
+}
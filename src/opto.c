@@ -7,6 +7,7 @@
 #include "comm.h"
 #include "plcpi.h"
 
+#ifndef PLCPI_CLI
 int optoChGet(int dev, u8 channel, OutStateEnumType *state)
 {
 	u8 buff[2];
@@ -18,7 +19,6 @@ int optoChGet(int dev, u8 channel, OutStateEnumType *state)
 
 	if ( (channel < CHANNEL_NR_MIN) || (channel > OPTO_IN_CH_NR_MAX))
 	{
-		printf("Invalid opto channel nr!\n");
 		return ERROR;
 	}
 
@@ -68,7 +68,6 @@ int optoEdgeGet(int dev, u8 channel, u8 *val)
 
 	if ( (channel < CHANNEL_NR_MIN) || (channel > OPTO_IN_CH_NR_MAX))
 	{
-		printf("Invalid opto channel nr!\n");
 		return ERROR;
 	}
 	if (FAIL == i2cMem8Read(dev, I2C_MEM_OPTO_IT_RISING_ADD, buff, 2))
@@ -232,7 +231,9 @@ int optoEncRstCnt(int dev, u8 channel)
 	}
 	return OK;
 }
+#endif // PLCPI_CLI
 
+#ifndef PLCPI_LIB
 int doOptoRead(int argc, char *argv[])
 {
 	int pin = 0;
@@ -577,3 +578,4 @@ int doOptoEncoderCntReset(int argc, char *argv[])
 	}
 	return OK;
 }
+#endif // PLCPI_LIB
@@ -0,0 +1,429 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define OWB_SEARCH_KEY 0xaa
+#define OWB_SEARCH_WAIT_MS 100
+#define OWB_SEARCH_RETRY 20 // wait max 2 seconds for the search to finish
+#define OWB_SEARCH_SETTLE_MS 300 // the count did not change for this long: done
+#define OWB_CACHE_DIR "/var/cache/plcpi" // owned by the plcpi user, not writable by others
+#define OWB_CACHE_FILE OWB_CACHE_DIR "/owb-%d-%d.cache" // by bus and stack
+
+#ifndef PLCPI_CLI
+/**
+ * Start a 1-Wire bus search and wait for the sensors count to settle, an
+ * empty bus included. ERROR if it still changes after OWB_SEARCH_RETRY polls,
+ * a partial count is never returned
+ */
+int owbScan(int dev, int *count)
+{
+	u8 buff[2];
+	int retry = 0;
+	int last = -1;
+	int stableMs = 0;
+
+	buff[0] = OWB_SEARCH_KEY;
+	if (OK != i2cMem8Write(dev, I2C_MEM_1WB_START_SEARCH, buff, 1))
+	{
+		return ERROR;
+	}
+	for (retry = 0; retry < OWB_SEARCH_RETRY; retry++)
+	{
+		busyWait(OWB_SEARCH_WAIT_MS);
+		if (OK != i2cMem8Read(dev, I2C_MEM_1WB_DEV, buff, 1))
+		{
+			return ERROR;
+		}
+		if (buff[0] != last)
+		{
+			last = buff[0];
+			stableMs = 0;
+			continue;
+		}
+		stableMs += OWB_SEARCH_WAIT_MS;
+		if (stableMs >= OWB_SEARCH_SETTLE_MS)
+		{
+			break;
+		}
+	}
+	if (retry >= OWB_SEARCH_RETRY)
+	{
+		return ERROR;
+	}
+	*count = buff[0];
+	return OK;
+}
+
+int owbCountGet(int dev, int *count)
+{
+	u8 buff[2];
+
+	if (NULL == count)
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_1WB_DEV, buff, 1))
+	{
+		return ERROR;
+	}
+	*count = buff[0];
+	return OK;
+}
+
+/**
+ * Read the ROM code of one sensor
+ * Params:
+ * 	dev - I2C port
+ * 	idx - sensor index [1..OWB_SENS_CNT]
+ * 	rom - 64 bits ROM code
+ */
+int owbRomCodeGet(int dev, int idx, uint64_t *rom)
+{
+	u8 buff[8];
+
+	if ( (idx < CHANNEL_NR_MIN) || (idx > OWB_SENS_CNT) || (NULL == rom))
+	{
+		return ERROR;
+	}
+	buff[0] = (u8) (idx - 1);
+	if (OK != i2cMem8Write(dev, I2C_MEM_1WB_ROM_CODE_IDX, buff, 1))
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_1WB_ROM_CODE, buff, 8))
+	{
+		return ERROR;
+	}
+	memcpy(rom, buff, 8);
+	return OK;
+}
+
+/**
+ * Read all the sensors temperatures in one transfer
+ * Params:
+ * 	dev - I2C port
+ * 	temp - OWB_SENS_CNT temperatures in degrees Celsius
+ */
+int owbTempGetAll(int dev, float *temp)
+{
+	u8 buff[OWB_SENS_CNT * OWB_TEMP_SIZE_B];
+	s16 raw = 0;
+	int i = 0;
+
+	if (NULL == temp)
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_1WB_T1, buff, sizeof(buff)))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < OWB_SENS_CNT; i++)
+	{
+		memcpy(&raw, &buff[i * OWB_TEMP_SIZE_B], OWB_TEMP_SIZE_B);
+		temp[i] = (float)raw / 100;
+	}
+	return OK;
+}
+
+static void owbCacheName(char *name, int size, int bus, int stack)
+{
+	snprintf(name, (size_t)size, OWB_CACHE_FILE, bus, stack);
+}
+
+/*
+ * The cache is trusted only if nobody else can write it: the directory and
+ * the file belong to the effective user and are not group or world writable
+ */
+static int owbCacheTrusted(const struct stat *st)
+{
+	return (st->st_uid == geteuid()) && (0 == (st->st_mode & (S_IWGRP | S_IWOTH)));
+}
+
+static int owbCacheDir(void)
+{
+	struct stat st;
+
+	if ( (0 != mkdir(OWB_CACHE_DIR, 0755)) && (errno != EEXIST))
+	{
+		return ERROR;
+	}
+	if ( (0 != lstat(OWB_CACHE_DIR, &st)) || !S_ISDIR(st.st_mode)
+		|| !owbCacheTrusted(&st))
+	{
+		return ERROR;
+	}
+	return OK;
+}
+
+/**
+ * ROM codes cache, one text file per board so the bus is searched only on demand
+ */
+int owbCacheLoad(int bus, int stack, uint64_t *rom, int *count)
+{
+	char name[64];
+	struct stat st;
+	FILE *f = NULL;
+	int fd = -1;
+	int cnt = 0;
+	unsigned long long code = 0;
+
+	if (OK != owbCacheDir())
+	{
+		return ERROR;
+	}
+	owbCacheName(name, sizeof(name), bus, stack);
+	fd = open(name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if ( (0 != fstat(fd, &st)) || !S_ISREG(st.st_mode) || !owbCacheTrusted(&st)
+		|| (NULL == (f = fdopen(fd, "r"))))
+	{
+		close(fd);
+		return ERROR;
+	}
+	while ( (cnt < OWB_SENS_CNT) && (1 == fscanf(f, "%llx", &code)))
+	{
+		rom[cnt++] = (uint64_t)code;
+	}
+	fclose(f);
+	*count = cnt;
+	return OK;
+}
+
+/**
+ * Replace the cache of a board atomically, through a temporary file
+ */
+int owbCacheSave(int bus, int stack, uint64_t *rom, int count)
+{
+	char name[64];
+	char tmp[72];
+	FILE *f = NULL;
+	int fd = -1;
+	int ret = OK;
+	int i = 0;
+
+	if (OK != owbCacheDir())
+	{
+		return ERROR;
+	}
+	owbCacheName(name, sizeof(name), bus, stack);
+	snprintf(tmp, sizeof(tmp), "%s.XXXXXX", name);
+	fd = mkstemp(tmp);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if ( (0 != fchmod(fd, 0644)) || (NULL == (f = fdopen(fd, "w"))))
+	{
+		close(fd);
+		unlink(tmp);
+		return ERROR;
+	}
+	for (i = 0; i < count; i++)
+	{
+		fprintf(f, "0x%016llx\n", (unsigned long long)rom[i]);
+	}
+	if ( (0 != fclose(f)) || (0 != rename(tmp, name)))
+	{
+		unlink(tmp);
+		ret = ERROR;
+	}
+	return ret;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+/**
+ * Enumerate the ROM codes from the board and refresh the cache
+ */
+static int owbEnumerate(int dev, int stack, uint64_t *rom, int *count)
+{
+	int i = 0;
+
+	if (*count > OWB_SENS_CNT)
+	{
+		*count = OWB_SENS_CNT;
+	}
+	for (i = 0; i < *count; i++)
+	{
+		if (OK != owbRomCodeGet(dev, i + 1, &rom[i]))
+		{
+			return ERROR;
+		}
+	}
+	return owbCacheSave(boardBusGet(), stack, rom, *count);
+}
+
+int doOwbScan(int argc, char *argv[])
+{
+	int dev = 0;
+	int count = 0;
+	uint64_t rom[OWB_SENS_CNT];
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != owbScan(dev, &count))
+	{
+		printf("Fail to scan the 1-Wire bus!\n");
+		return ERROR;
+	}
+	if (OK != owbEnumerate(dev, atoi(argv[1]), rom, &count))
+	{
+		printf("Fail to read the ROM codes!\n");
+		return ERROR;
+	}
+	printf("%d sensor(s) found\n", count);
+	return OK;
+}
+
+int doOwbCountRead(int argc, char *argv[])
+{
+	int dev = 0;
+	int count = 0;
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != owbCountGet(dev, &count))
+	{
+		printf("Fail to read!\n");
+		return ERROR;
+	}
+	printf("%d\n", count);
+	return OK;
+}
+
+int doOwbIdRead(int argc, char *argv[])
+{
+	int dev = 0;
+	int stack = 0;
+	int idx = 0;
+	int count = 0;
+	int i = 0;
+	uint64_t rom[OWB_SENS_CNT];
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		return ARG_CNT_ERR;
+	}
+	stack = atoi(argv[1]);
+	if (argc == 4)
+	{
+		idx = atoi(argv[3]);
+		if ( (idx < CHANNEL_NR_MIN) || (idx > OWB_SENS_CNT))
+		{
+			printf("1-Wire sensor number out of range [1..%d]!\n", OWB_SENS_CNT);
+			return ARG_ERR;
+		}
+	}
+	if (OK != owbCacheLoad(boardBusGet(), stack, rom, &count))
+	{
+		dev = doBoardInit(stack);
+		if (dev <= 0)
+		{
+			return ERROR;
+		}
+		if ( (OK != owbCountGet(dev, &count))
+			|| (OK != owbEnumerate(dev, stack, rom, &count)))
+		{
+			printf("Fail to read!\n");
+			return ERROR;
+		}
+	}
+	if (idx > count)
+	{
+		printf("Invalid sensor number, only %d sensor(s) found\n", count);
+		return ERROR;
+	}
+	for (i = 0; i < count; i++)
+	{
+		if ( (idx == 0) || (idx == i + 1))
+		{
+			printf("0x%016llx\n", (unsigned long long)rom[i]);
+		}
+	}
+	return OK;
+}
+
+int doOwbTempRead(int argc, char *argv[])
+{
+	int dev = 0;
+	int stack = 0;
+	int idx = 0;
+	int count = 0;
+	int i = 0;
+	float temp[OWB_SENS_CNT];
+	uint64_t rom[OWB_SENS_CNT];
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		return ARG_CNT_ERR;
+	}
+	stack = atoi(argv[1]);
+	if (argc == 4)
+	{
+		idx = atoi(argv[3]);
+		if ( (idx < CHANNEL_NR_MIN) || (idx > OWB_SENS_CNT))
+		{
+			printf("1-Wire sensor number out of range [1..%d]!\n", OWB_SENS_CNT);
+			return ARG_ERR;
+		}
+	}
+	dev = doBoardInit(stack);
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != owbCacheLoad(boardBusGet(), stack, rom, &count))
+	{
+		if (OK != owbCountGet(dev, &count))
+		{
+			printf("Fail to read!\n");
+			return ERROR;
+		}
+	}
+	if (idx > count)
+	{
+		printf("Invalid sensor number, only %d sensor(s) found\n", count);
+		return ERROR;
+	}
+	if (OK != owbTempGetAll(dev, temp))
+	{
+		printf("Fail to read!\n");
+		return ERROR;
+	}
+	for (i = 0; i < count && i < OWB_SENS_CNT; i++)
+	{
+		if ( (idx == 0) || (idx == i + 1))
+		{
+			printf("%0.2f C\n", temp[i]);
+		}
+	}
+	return OK;
+}
+#endif // PLCPI_LIB
@@ -18,10 +18,15 @@
 #include "comm.h"
 #include "thread.h"
 #include "cli.h"
+#include "hist.h"
+#include "scan.h"
+#include "trace.h"
+#include "daemon.h"
+#include "libplcpi.h"
 
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
-#include <semaphore.h>
 
 #define VERSION_BASE	(int)1
 #define VERSION_MAJOR	(int)1
@@ -29,10 +34,9 @@
 
 #define UNUSED(X) (void)X      /* To avoid gcc/g++ warnings */
 
-#define THREAD_SAFE
 #define MOVE_PROFILE
 
-u8 gHwVer = 0;
+static int gBus = I2C_BUS_DEFAULT; // adapter of the board given on the command line
 
 char *warranty =
 	"	       Copyright (c) 2016-2024 Sequent Microsystems\n"
@@ -68,42 +72,87 @@ void usage(void)
 		}
 		i++;
 	}
-	printf("Where: <stack> = Board level id = 0..7\n");
+	printf("Where: <stack> = Board level id = 0..7, <bus>:<stack> for a board on /dev/i2c-<bus>\n");
+	printf("Several relwr, gpiowr and odwr commands for one board can be separated by \" , \" to be written in one bus transaction\n");
 	printf("Type plcpi -h <command> for more help\n");
 }
 
-int doBoardInit(int stack)
+/**
+ * Parse a board id "<stack>" or "<bus>:<stack>", the bus is left unchanged
+ * when not given
+ */
+int boardIdParse(const char *arg, int *bus, int *stack)
 {
-	int dev = 0;
-	int add = 0;
-	uint8_t buff[8];
+	char *end = NULL;
+	long val = 0;
 
-	if ( (stack < 0) || (stack > 7))
+	if ( (NULL == arg) || (NULL == bus) || (NULL == stack))
 	{
-		printf("Invalid stack level [0..7]!");
 		return ERROR;
 	}
-	add = stack + SLAVE_OWN_ADDRESS_BASE;
-	dev = i2cSetup(add);
-	if (dev == -1)
+	val = strtol(arg, &end, 10);
+	if (end == arg)
 	{
 		return ERROR;
 	}
-	if (ERROR == i2cMem8Read(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, buff, 1))
+	if (*end == ':')
 	{
+		if ( (val < 0) || (val >= I2C_BUS_MAX))
+		{
+			return ERROR;
+		}
+		*bus = (int)val;
+		arg = end + 1;
+		val = strtol(arg, &end, 10);
+		if (end == arg)
+		{
+			return ERROR;
+		}
+	}
+	if ( (*end != 0) || (val < 0) || (val > 7))
+	{
+		return ERROR;
+	}
+	*stack = (int)val;
+	return OK;
+}
+
+int doBoardOpen(int bus, int stack)
+{
+	int dev = 0;
+
+	dev = devOpen(bus, stack);
+	switch (dev)
+	{
+	case PLCPI_ERR_ARG:
+		printf("Invalid stack level [0..7]!");
+		return ERROR;
+	case PLCPI_ERR_BUS:
+		printf("Failed to open the bus %d.", bus);
+		return ERROR;
+	case PLCPI_ERR_NO_BOARD:
 		printf("IO-PLUS id %d not detected\n", stack);
 		return ERROR;
+	default:
+		break;
 	}
-	gHwVer = buff[0];
 	return dev;
 }
 
-u8 getHwVer(void)
+int doBoardInit(int stack)
+{
+	return doBoardOpen(gBus, stack);
+}
+
+/**
+ * Adapter of the board given on the command line
+ */
+int boardBusGet(void)
 {
-	return gHwVer;
+	return gBus;
 }
 
-int boardCheck(int stack)
+int boardCheck(int bus, int stack)
 {
 	int dev = 0;
 	int add = 0;
@@ -115,16 +164,17 @@ int boardCheck(int stack)
 		return ERROR;
 	}
 	add = stack + SLAVE_OWN_ADDRESS_BASE;
-	dev = i2cSetup(add);
+	dev = i2cSetup(bus, add);
 	if (dev == -1)
 	{
 		return ERROR;
 	}
 	if (ERROR == i2cMem8Read(dev, I2C_MEM_REVISION_MAJOR_ADD, buff, 1))
 	{
-
+		close(dev);
 		return ERROR;
 	}
+	close(dev);
 	return OK;
 }
 int doHelp(int argc, char *argv[]);
@@ -213,20 +263,28 @@ int doList(int argc, char *argv[]);
 const CliCmdType CMD_LIST =
 	{"-list", 1, &doList,
 		"\t-list:		List all plcpi boards connected,return the # of boards and stack level for every board\n",
-		"\tUsage:		plcpi -list\n", "", "\tExample:		plcpi -list display: 1,0 \n"};
+		"\tUsage:		plcpi -list\n", "\tUsage:		plcpi -list <bus>\n",
+		"\tExample:		plcpi -list display: 1,0 \n"};
 
 int doList(int argc, char *argv[])
 {
 	int ids[8];
 	int i;
 	int cnt = 0;
+	int bus = I2C_BUS_DEFAULT;
 
-	UNUSED(argc);
-	UNUSED(argv);
-
+	if (argc > 2)
+	{
+		bus = atoi(argv[2]);
+		if ( (bus < 0) || (bus >= I2C_BUS_MAX))
+		{
+			printf("Invalid bus number [0..%d]!\n", I2C_BUS_MAX - 1);
+			return ARG_ERR;
+		}
+	}
 	for (i = 0; i < 8; i++)
 	{
-		if (boardCheck(i) == OK)
+		if (boardCheck(bus, i) == OK)
 		{
 			ids[cnt] = i;
 			cnt++;
@@ -255,7 +313,7 @@ const CliCmdType CMD_BOARD = {"board", 2, &doBoard,
 int doBoard(int argc, char *argv[])
 {
 	int dev = -1;
-	u8 buff[4];
+	DevCtxType *ctx = NULL;
 	int resp = 0;
 	int temperature = 25;
 	float voltage = 3.3;
@@ -270,26 +328,19 @@ int doBoard(int argc, char *argv[])
 	{
 		return (FAIL);
 	}
-	resp = i2cMem8Read(dev, I2C_MEM_DIAG_TEMPERATURE_ADD, buff, 3);
-	if (FAIL == resp)
+	if (OK != diagGet(dev, &temperature, &resp))
 	{
 		printf("Fail to read board info!\n");
 		return (FAIL);
 	}
-	temperature = buff[0];
-	memcpy(&resp, &buff[1], 2);
 	voltage = (float)resp / 1000; //read in milivolts
 
-	resp = i2cMem8Read(dev, I2C_MEM_REVISION_HW_MAJOR_ADD, buff, 4);
-	if (FAIL == resp)
-	{
-		printf("Fail to read board info!\n");
-		return (FAIL);
-	}
+	// revision read once when the board was opened
+	ctx = devGet(dev);
 	printf(
 		"Hardware %02d.%02d, Firmware %02d.%02d, CPU temperature %d C, voltage %0.2f V\n",
-		(int)buff[0], (int)buff[1], (int)buff[2], (int)buff[3], temperature,
-		voltage);
+		(int)ctx->ver[0], (int)ctx->ver[1], (int)ctx->ver[2], (int)ctx->ver[3],
+		temperature, voltage);
 	return OK;
 }
 #ifdef HW_DEBUG
@@ -365,98 +416,6 @@ int doGetErrors(int argc, char *argv[])
 }
 #endif
 
-int relayChSet(int dev, u8 channel, OutStateEnumType state)
-{
-	int resp = 0;
-	u8 buff[2];
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
-	{
-		printf("Invalid relay nr!\n");
-		return ERROR;
-	}
-	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1))
-	{
-		return FAIL;
-	}
-
-	switch (state)
-	{
-	case OFF:
-		buff[0] &= ~ (1 << (channel - 1));
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1);
-		break;
-	case ON:
-		buff[0] |= 1 << (channel - 1);
-		resp = i2cMem8Write(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1);
-		break;
-	default:
-		printf("Invalid relay state!\n");
-		return ERROR;
-		break;
-	}
-	return resp;
-}
-
-int relayChGet(int dev, u8 channel, OutStateEnumType *state)
-{
-	u8 buff[2];
-
-	if (NULL == state)
-	{
-		return ERROR;
-	}
-
-	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
-	{
-		printf("Invalid relay nr!\n");
-		return ERROR;
-	}
-
-//	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1))
-//	{
-//		return ERROR;
-//	}
-	if (OK != i2cReadByteAS(dev, I2C_MEM_RELAY_VAL_ADD, buff))
-	{
-		return ERROR;
-	}
-	if (buff[0] & (1 << (channel - 1)))
-	{
-		*state = ON;
-	}
-	else
-	{
-		*state = OFF;
-	}
-	return OK;
-}
-
-int relaySet(int dev, int val)
-{
-	u8 buff[2];
-
-	buff[0] = 0xff & val;
-
-	return i2cMem8Write(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1);
-}
-
-int relayGet(int dev, int *val)
-{
-	u8 buff[2];
-
-	if (NULL == val)
-	{
-		return ERROR;
-	}
-	if (OK != i2cReadByteAS(dev, I2C_MEM_RELAY_VAL_ADD, buff))
-	{
-		return ERROR;
-	}
-	*val = buff[0];
-	return OK;
-}
-
 int doRelayWrite(int argc, char *argv[]);
 const CliCmdType CMD_RELAY_WRITE = {"relwr", 2, &doRelayWrite,
 	"\trelwr:		Set relays On/Off\n",
@@ -470,9 +429,6 @@ int doRelayWrite(int argc, char *argv[])
 	OutStateEnumType state = STATE_COUNT;
 	int val = 0;
 	int dev = 0;
-	OutStateEnumType stateR = STATE_COUNT;
-	int valR = 0;
-	int retry = 0;
 
 	if ( (argc != 5) && (argc != 4))
 	{
@@ -511,29 +467,8 @@ int doRelayWrite(int argc, char *argv[])
 			state = (OutStateEnumType)atoi(argv[4]);
 		}
 
-		retry = RETRY_TIMES;
-
-		while ( (retry > 0) && (stateR != state))
-		{
-			if (OK != relayChSet(dev, pin, state))
-			{
-				printf("Fail to write relay\n");
-				return (FAIL);
-			}
-			if (OK != relayChGet(dev, pin, &stateR))
-			{
-				printf("Fail to read relay\n");
-				return (FAIL);
-			}
-			retry--;
-		}
-#ifdef DEBUG_I
-		if(retry < RETRY_TIMES)
-		{
-			printf("retry %d times\n", 3-retry);
-		}
-#endif
-		if (retry == 0)
+		// verified write, bounded by VERIFY_RETRIES and VERIFY_TIMEOUT_US
+		if (OK != relayChSet(dev, pin, state))
 		{
 			printf("Fail to write relay\n");
 			return (FAIL);
@@ -548,23 +483,7 @@ int doRelayWrite(int argc, char *argv[])
 			return (FAIL);
 		}
 
-		retry = RETRY_TIMES;
-		valR = -1;
-		while ( (retry > 0) && (valR != val))
-		{
-
-			if (OK != relaySet(dev, val))
-			{
-				printf("Fail to write relay!\n");
-				return (FAIL);
-			}
-			if (OK != relayGet(dev, &valR))
-			{
-				printf("Fail to read relay!\n");
-				return (FAIL);
-			}
-		}
-		if (retry == 0)
+		if (OK != relaySet(dev, val))
 		{
 			printf("Fail to write relay!\n");
 			return (FAIL);
@@ -636,16 +555,176 @@ int doRelayRead(int argc, char *argv[])
 
 int doRelayTest(int argc, char *argv[]);
 const CliCmdType CMD_TEST = {"reltest", 2, &doRelayTest,
-	"\treltest:	Turn ON and OFF the relays until press a key\n",
-	"\tUsage:		plcpi <stack> reltest\n", "", "\tExample:		plcpi 0 reltest\n"};
+	"\treltest:	Turn ON and OFF the relays until press a key, or run a timed relay benchmark with a pattern at a fixed rate and report the write to readback latency in JSON format\n",
+	"\tUsage:		plcpi <stack> reltest\n",
+	"\tUsage:		plcpi <stack> reltest bench <walk/alt/all> <rate_hz> <cycles> [<result_file>]\n",
+	"\tExample:		plcpi 0 reltest bench walk 20 100 res.json; Walk one relay on Board #0, 20 steps per second, 100 cycles\n"};
+
+#define RELAY_BENCH_PATTERN_MAX 8
+
+typedef struct
+{
+	unsigned int steps; // pattern transitions
+	unsigned int pairs; // relay changes
+	unsigned int retries; // write and readback transactions over one per change
+	unsigned int failures; // readback never matched
+	unsigned int overruns; // step started after its deadline
+	uint64_t elapsedUs;
+	HistType latency;
+} RelayBenchType;
+
+/**
+ * Timed relay benchmark, every relay change is a relayChSet(), which writes
+ * and reads back in one transaction, repeated by the driver until the
+ * readback match or its retry budget expire. Steps start at absolute deadlines so the rate does not
+ * drift with the I/O time.
+ */
+static int relayBench(int dev, const u8 *pattern, int len, int rateHz,
+	int cycles, RelayBenchType *res)
+{
+	uint64_t period = 1000000 / rateHz;
+	uint64_t start = 0;
+	uint64_t deadline = 0;
+	uint64_t t0 = 0;
+	DevCtxType *ctx = devGet(dev);
+	u32 writes = 0;
+	int cur = 0;
+	int step = 0;
+	int ch = 0;
+	int ret = OK;
+	u8 mask = 0;
+
+	memset(res, 0, sizeof(RelayBenchType));
+	histInit(&res->latency);
+	if (OK != relaySet(dev, 0))
+	{
+		return ERROR;
+	}
+	start = getTimeUs();
+	deadline = start;
+	for (step = 0; step < len * cycles; step++)
+	{
+		if ( (step > 0) && (getTimeUs() > deadline))
+		{
+			res->overruns++;
+		}
+		sleepUntilUs(deadline);
+		deadline += period;
+		mask = pattern[step % len];
+		for (ch = 0; ch < RELAY_CH_NR_MAX; ch++)
+		{
+			if ( ( (cur ^ mask) & (1 << ch)) == 0)
+			{
+				continue;
+			}
+			writes = ctx ? ctx->stat.writes : 0;
+			t0 = getTimeUs();
+			ret = relayChSet(dev, (u8) (ch + 1), (mask & (1 << ch)) ? ON : OFF);
+			histAdd(&res->latency, (uint32_t) (getTimeUs() - t0));
+			res->pairs++;
+			if ( (NULL != ctx) && (ctx->stat.writes - writes > 1))
+			{
+				res->retries += ctx->stat.writes - writes - 1;
+			}
+			if (OK != ret)
+			{
+				res->failures++;
+			}
+		}
+		cur = mask;
+		res->steps++;
+	}
+	res->elapsedUs = getTimeUs() - start;
+	relaySet(dev, 0);
+	return OK;
+}
+
+static int doRelayBench(int dev, int argc, char *argv[])
+{
+	u8 pattern[RELAY_BENCH_PATTERN_MAX];
+	int len = 0;
+	int rate = 0;
+	int cycles = 0;
+	int i = 0;
+	FILE *out = stdout;
+	RelayBenchType res;
+
+	if ( (argc != 7) && (argc != 8))
+	{
+		return ARG_CNT_ERR;
+	}
+	if (strcasecmp(argv[4], "walk") == 0)
+	{
+		for (i = 0; i < RELAY_CH_NR_MAX; i++)
+		{
+			pattern[i] = (u8) (1 << i);
+		}
+		len = RELAY_CH_NR_MAX;
+	}
+	else if (strcasecmp(argv[4], "alt") == 0)
+	{
+		pattern[0] = 0x55;
+		pattern[1] = 0xaa;
+		len = 2;
+	}
+	else if (strcasecmp(argv[4], "all") == 0)
+	{
+		pattern[0] = 0xff;
+		pattern[1] = 0x00;
+		len = 2;
+	}
+	else
+	{
+		printf("Invalid pattern, must be walk, alt or all!\n");
+		return ARG_ERR;
+	}
+	rate = atoi(argv[5]);
+	cycles = atoi(argv[6]);
+	if ( (rate < 1) || (rate > 1000) || (cycles < 1))
+	{
+		printf("Invalid rate [1..1000] or cycles number!\n");
+		return ARG_ERR;
+	}
+	if (argc == 8)
+	{
+		out = fopen(argv[7], "w");
+		if (NULL == out)
+		{
+			printf("Fail to open result file\n");
+			return (FAIL);
+		}
+	}
+	if (OK != relayBench(dev, pattern, len, rate, cycles, &res))
+	{
+		printf("Fail to write relay!\n");
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+		return (FAIL);
+	}
+	fprintf(out,
+		"{\"pattern\": \"%s\", \"rate_hz\": %d, \"cycles\": %d, \"steps\": %u, \"pairs\": %u, "
+			"\"elapsed_s\": %0.3f, \"pairs_per_s\": %0.1f, \"retries\": %u, \"failures\": %u, \"overruns\": %u, "
+			"\"latency_us\": {\"min\": %u, \"mean\": %0.1f, \"p50\": %u, \"p90\": %u, \"p99\": %u, \"max\": %u}}\n",
+		argv[4], rate, cycles, res.steps, res.pairs,
+		(double)res.elapsedUs / 1000000,
+		res.elapsedUs ? (double)res.pairs * 1000000 / res.elapsedUs : 0.0,
+		res.retries, res.failures, res.overruns, res.latency.min,
+		res.latency.count ? (double)res.latency.sum / res.latency.count : 0.0,
+		histPercentile(&res.latency, 50), histPercentile(&res.latency, 90),
+		histPercentile(&res.latency, 99), res.latency.max);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return res.failures == 0 ? OK : FAIL;
+}
 
 int doRelayTest(int argc, char *argv[])
 {
 	int dev = 0;
 	int i = 0;
-	int retry = 0;
-	int relVal;
-	int valR;
 	int relayResult = 0;
 	FILE *file = NULL;
 	const u8 relayOrder[8] = {1, 2, 3, 4, 5, 6, 7, 8};
@@ -655,6 +734,10 @@ int doRelayTest(int argc, char *argv[])
 	{
 		return (FAIL);
 	}
+	if ( (argc > 3) && (strcasecmp(argv[3], "bench") == 0))
+	{
+		return doRelayBench(dev, argc, argv);
+	}
 	if (argc == 4)
 	{
 		file = fopen(argv[3], "w");
@@ -667,7 +750,6 @@ int doRelayTest(int argc, char *argv[])
 //relay test****************************
 	if (strcasecmp(argv[2], "reltest") == 0)
 	{
-		relVal = 0;
 		printf(
 			"Are all relays and LEDs turning on and off in sequence?\nPress y for Yes or any key for No....");
 		startThread();
@@ -680,24 +762,7 @@ int doRelayTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0;
-				relVal = (u8)1 << (relayOrder[i] - 1);
-
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) == 0))
-				{
-					if (OK != relayChSet(dev, relayOrder[i], ON))
-					{
-						retry = 0;
-						break;
-					}
-
-					if (OK != relayGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				if (OK != relayChSet(dev, relayOrder[i], ON))
 				{
 					printf("Fail to write relay\n");
 					if (file)
@@ -714,21 +779,7 @@ int doRelayTest(int argc, char *argv[])
 				{
 					break;
 				}
-				valR = 0xff;
-				relVal = (u8)1 << (relayOrder[i] - 1);
-				retry = RETRY_TIMES;
-				while ( (retry > 0) && ( (valR & relVal) != 0))
-				{
-					if (OK != relayChSet(dev, relayOrder[i], OFF))
-					{
-						retry = 0;
-					}
-					if (OK != relayGet(dev, &valR))
-					{
-						retry = 0;
-					}
-				}
-				if (retry == 0)
+				if (OK != relayChSet(dev, relayOrder[i], OFF))
 				{
 					printf("Fail to write relay!\n");
 					if (file)
@@ -843,54 +894,6 @@ const CliCmdType CMD_OPTO_ENC_CNT_RESET =
 		"\tUsage:		plcpi <stack> optcntencrst <channel>\n", "",
 		"\tExample:		plcpi 0 optcntencrst 2; Reset contor of encoder #2 on Board #0\n"};
 
-int odGet(int dev, int ch, float *val)
-{
-	u16 raw = 0;
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	if (OK
-		!= i2cReadWordAS(dev, I2C_MEM_OD_PWM_VAL_RAW_ADD + 2 * (ch - 1), &raw))
-	{
-		printf("Fail to read!\n");
-		return ERROR;
-	}
-	*val = 100 * (float)raw / OD_PWM_VAL_MAX;
-	return OK;
-}
-
-int odSet(int dev, int ch, float val)
-{
-	u8 buff[2] = {0, 0};
-	u16 raw = 0;
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	if (val < 0)
-	{
-		val = 0;
-	}
-	if (val > 100)
-	{
-		val = 100;
-	}
-	raw = (u16)ceil(OD_PWM_VAL_MAX * val / 100);
-	memcpy(buff, &raw, 2);
-	if (OK
-		!= i2cMem8Write(dev, I2C_MEM_OD_PWM_VAL_RAW_ADD + 2 * (ch - 1), buff, 2))
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-	return OK;
-}
-
 int doOdRead(int argc, char *argv[]);
 const CliCmdType CMD_OD_READ =
 	{"odrd", 2, &doOdRead,
@@ -985,114 +988,6 @@ int doOdWrite(int argc, char *argv[])
 }
 
 //----------------------------------- OD pulses --------------------------------------------------------
-#define SINGLE_TRANSFER
-
-int odWritePulses(int dev, int ch, unsigned int val)
-{
-	u8 buff[5] = {0, 0, 0, 0, 0};
-	u32 raw = 0;
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	raw = (u32)val;
-	memcpy(buff, &raw, 4);
-
-#ifdef SINGLE_TRANSFER
-	buff[4] = ch;
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 5)) // write the value
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-
-#else
-
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 4)) // write the value
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-	buff[0] = ch;
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_CMD, buff, 1))// update command
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-#endif
-	return OK;
-}
-#define PULSE_SAVE_MASK 0x10
-#define PULSE_EXEC_MASK 0x20
-
-int odSaveOdPulses(int dev, int ch, unsigned int val)
-{
-	u8 buff[5] = {0, 0, 0, 0, 0};
-	u32 raw = 0;
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	raw = (u32)val;
-	memcpy(buff, &raw, 4);
-
-	buff[4] = ch | PULSE_SAVE_MASK;
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_VALUE, buff, 5)) // write the value
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-
-	return OK;
-}
-
-int odExecPulses(int dev, int ch) //execute previous saved poulses
-{
-	u8 buff[5] = {0, 0, 0, 0, 0};
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX)) // channel from 5 to 8 are channel 1 to 4 in oposite direction
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	buff[0] = (0x0f & (uint8_t)ch) | PULSE_EXEC_MASK;
-
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_P_SET_CMD, buff, 1)) // write the value
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-
-	return OK;
-}
-
-int odResetPulses(int dev, int ch)
-{
-	return odWritePulses(dev, ch, 0);
-}
-
-int odReadPulses(int dev, int ch, unsigned int *val)
-{
-	u32 raw = 0;
-
-	if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
-	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
-	}
-	if (OK != i2cReadDWord(dev, I2C_MEM_OD_PULSE_CNT_SET + 4 * (ch - 1), &raw))
-	{
-		printf("Fail to read!\n");
-		return ERROR;
-	}
-	*val = raw;
-	return OK;
-}
-
 int doOdCntRead(int argc, char *argv[]);
 const CliCmdType CMD_OD_CNT_READ =
 	{"odcrd", 2, &doOdCntRead,
@@ -1114,8 +1009,14 @@ int doOdCntRead(int argc, char *argv[])
 	if (argc == 4)
 	{
 		ch = atoi(argv[3]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		if (OK != odReadPulses(dev, ch, &val))
 		{
+			printf("Fail to read!\n");
 			return (FAIL);
 		}
 		printf("%d\n", val);
@@ -1150,10 +1051,16 @@ int doOdCntWrite(int argc, char *argv[])
 	if (argc == 5)
 	{
 		ch = atoi(argv[3]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		inVal = atol(argv[4]);
 		value = (unsigned int)inVal;
 		if (OK != odWritePulses(dev, ch, value))
 		{
+			printf("Fail to write!\n");
 			return (FAIL);
 		}
 		printf("done\n");
@@ -1189,10 +1096,16 @@ int doOdCntSave(int argc, char *argv[])
 	if (argc == 5)
 	{
 		ch = atoi(argv[3]);
+		if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		inVal = atol(argv[4]);
 		value = (unsigned int)inVal;
 		if (OK != odSaveOdPulses(dev, ch, value))
 		{
+			printf("Fail to write!\n");
 			return (FAIL);
 		}
 		printf("done\n");
@@ -1226,9 +1139,14 @@ int doOdCntExec(int argc, char *argv[])
 	if (argc == 4)
 	{
 		ch = atoi(argv[3]);
-
+		if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		if (OK != odExecPulses(dev, ch))
 		{
+			printf("Fail to write!\n");
 			return (FAIL);
 		}
 		printf("done\n");
@@ -1263,9 +1181,14 @@ int doOdCntReset(int argc, char *argv[])
 	if (argc == 4)
 	{
 		ch = atoi(argv[3]);
-
+		if ( (ch < CHANNEL_NR_MIN) || (ch > 2 * OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		if (OK != odResetPulses(dev, ch))
 		{
+			printf("Fail to write!\n");
 			return (FAIL);
 		}
 		printf("done\n");
@@ -1279,68 +1202,6 @@ int doOdCntReset(int argc, char *argv[])
 }
 
 //*************************************************************************************
-
-int pwmFreqGet(int dev, int *val)
-{
-	u16 raw = 0;
-
-	if (OK != i2cReadWordAS(dev, I2C_MEM_OD_PWM_FREQUENCY, &raw))
-	{
-		printf("Fail to read!\n");
-		return ERROR;
-	}
-	*val = raw;
-	return OK;
-}
-
-int pwmFreqSet(int dev, int val)
-{
-	u8 buff[2] = {0, 0};
-	u16 raw = 0;
-
-	if (val < 10)
-	{
-		val = 10;
-	}
-	if (val > 65500)
-	{
-		val = 65500;
-	}
-	raw = (u16)val;
-	memcpy(buff, &raw, 2);
-	if (OK != i2cMem8Write(dev, I2C_MEM_OD_PWM_FREQUENCY, buff, 2))
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-	return OK;
-}
-
-int pwmChFreqSet(int dev, int ch, int val)
-{
-	u8 buff[2] = {0, 0};
-	u16 raw = 0;
-
-	if (val < 10)
-	{
-		val = 10;
-	}
-	if (val > 65500)
-	{
-		val = 65500;
-	}
-	raw = (u16)val;
-	memcpy(buff, &raw, 2);
-	if (OK
-		!= i2cMem8Write(dev, I2C_MEM_OD_PWM_FREQUENCY_CH1 + (ch - 1) * 2, buff,
-			2))
-	{
-		printf("Fail to write!\n");
-		return ERROR;
-	}
-	return OK;
-}
-
 int doPwmFreqRead(int argc, char *argv[]);
 const CliCmdType CMD_PWM_FREQ_READ =
 	{"pwmfrd", 2, &doPwmFreqRead,
@@ -1358,7 +1219,7 @@ int doPwmFreqRead(int argc, char *argv[])
 	{
 		return (FAIL);
 	}
-	if (gHwVer < 3)
+	if (!devFeature(dev, DEV_FEAT_PWM_FREQ))
 	{
 		printf(
 			"This feature is available on hardware versions greater or equal to 3.0!\n");
@@ -1402,7 +1263,7 @@ int doPwmFreqWrite(int argc, char *argv[])
 	{
 		return (FAIL);
 	}
-	if (gHwVer < 3)
+	if (!devFeature(dev, DEV_FEAT_PWM_FREQ))
 	{
 		printf(
 			"This feature is available on hardware versions greater or equal to 3.0!\n");
@@ -1453,62 +1314,6 @@ int doPwmFreqWrite(int argc, char *argv[])
 	}
 	return OK;
 }
-#define MAX_ACC 60000
-#define MAX_SPEED 60000
-#define MIN_SPEED 10
-
-int odOutMoveSet(int dev, int ch, int acc, int dec, int minSpd, int maxSpd)
-{
-	uint8_t buff[8];
-	uint16_t aux16 = 0;
-
-	if (ch <= 0 || ch > 4)
-	{
-		printf("invalid Channel number [1..4]\n");
-		return -1;
-	}
-	if (acc < 0 || acc > MAX_ACC)
-	{
-		printf("Invalid acceleration value\n");
-		return -1;
-	}
-	if (dec < 0 || dec > MAX_ACC)
-	{
-		printf("Invalid deceleration value\n");
-		return -1;
-	}
-	if (maxSpd < MIN_SPEED || maxSpd > MAX_SPEED)
-	{
-		printf("Invalid speed [10..60000]\n");
-	}
-
-	if (minSpd < MIN_SPEED || minSpd > maxSpd)
-	{
-		printf("Invalid speed [10..60000]\n");
-	}
-
-	aux16 = (u16)acc;
-	memcpy(buff, &aux16, sizeof(uint16_t));
-	aux16 = (u16)dec;
-	memcpy(buff + 2, &aux16, sizeof(uint16_t));
-	aux16 = (u16)maxSpd;
-	memcpy(buff + 4, &aux16, sizeof(uint16_t));
-	aux16 = (u16)minSpd;
-	memcpy(buff + 6, &aux16, sizeof(uint16_t));
-	if (OK != i2cMem8Write(dev, I2C_MEM_ODP_ACC, buff, 8))
-	{
-		printf("Fail to write\n");
-		return -1;
-	}
-	buff[0] = (uint8_t)ch;
-	if (OK != i2cMem8Write(dev, I2C_MEM_ODP_CMD, buff, 1))
-	{
-		printf("Fail to write\n");
-		return -1;
-	}
-	return OK;
-}
-
 int doMoveParWrite(int argc, char *argv[]);
 const CliCmdType CMD_MV_P_WRITE =
 	{"mvpwr", 2, &doMoveParWrite,
@@ -1531,7 +1336,7 @@ int doMoveParWrite(int argc, char *argv[])
 	{
 		return (FAIL);
 	}
-	if (gHwVer < 3)
+	if (!devFeature(dev, DEV_FEAT_MOVE_PROFILE))
 	{
 		printf(
 			"This feature is available on hardware versions greater or equal to 3.0!\n");
@@ -1548,37 +1353,38 @@ int doMoveParWrite(int argc, char *argv[])
 	dec = atoi(argv[5]);
 	minSpd = atoi(argv[6]);
 	maxSpd = atoi(argv[7]);
-
-	return odOutMoveSet(dev, channel, acc, dec, minSpd, maxSpd);
-}
-
-//***************************************************Encoder threshold**********************************************
-int encSetThreshold(int dev, int ch, unsigned int val)
-{
-	u8 buff[5] = {0, 0, 0, 0, 0};
-	u32 raw = 0;
-
-	if ( (ch < 0) || (ch > OD_CH_NR_MAX)) //
+	if ( (channel < CHANNEL_NR_MIN) || (channel > OD_CH_NR_MAX))
 	{
-		printf("Open drain channel out of range!\n");
-		return ERROR;
+		printf("invalid Channel number [1..4]\n");
+		return (FAIL);
 	}
-	raw = (u32)val;
-	memcpy(buff, &raw, 4);
-
-	buff[4] = (uint8_t)ch;
-	if (OK != i2cMem8Write(dev, I2C_MEM_ENCODER_LIMIT, buff, 5)) // write the value
+	if (acc < 0 || acc > OD_MOVE_ACC_MAX)
 	{
-		printf("Fail to write!\n");
-		return ERROR;
+		printf("Invalid acceleration value\n");
+		return (FAIL);
+	}
+	if (dec < 0 || dec > OD_MOVE_ACC_MAX)
+	{
+		printf("Invalid deceleration value\n");
+		return (FAIL);
+	}
+	if (maxSpd < OD_MOVE_SPEED_MIN || maxSpd > OD_MOVE_SPEED_MAX)
+	{
+		printf("Invalid speed [10..60000]\n");
+	}
+	if (minSpd < OD_MOVE_SPEED_MIN || minSpd > maxSpd)
+	{
+		printf("Invalid speed [10..60000]\n");
 	}
-	if(0 == ch)
+	if (OK != odOutMoveSet(dev, channel, acc, dec, minSpd, maxSpd))
 	{
-		printf("Disable threshold reset function\n");
+		printf("Fail to write\n");
+		return (FAIL);
 	}
 	return OK;
 }
 
+//***************************************************Encoder threshold**********************************************
 int doEncThWr(int argc, char *argv[]);
 const CliCmdType CMD_ENC_TH_WRITE =
 	{"encthwr", 2, &doEncThWr,
@@ -1602,12 +1408,22 @@ int doEncThWr(int argc, char *argv[])
 	if (argc == 5)
 	{
 		ch = atoi(argv[3]);
+		if ( (ch < 0) || (ch > OD_CH_NR_MAX))
+		{
+			printf("Open drain channel out of range!\n");
+			return (FAIL);
+		}
 		inVal = atol(argv[4]);
 		value = (unsigned int)inVal;
 		if (OK != encSetThreshold(dev, ch, value))
 		{
+			printf("Fail to write!\n");
 			return (FAIL);
 		}
+		if (0 == ch)
+		{
+			printf("Disable threshold reset function\n");
+		}
 		printf("done\n");
 	}
 	else
@@ -1618,8 +1434,177 @@ int doEncThWr(int argc, char *argv[])
 	return OK;
 }
 
-
-
+const CliCmdType CMD_POS_MOVE =
+	{"posmv", 2, &doPosMove,
+		"\tposmv:		Move the open drain pulse axis to an encoder position, the encoder threshold is used as hard stop and corrective moves are made until the error is inside the tolerance\n",
+		"\tUsage:		plcpi <stack> posmv <od_ch> <enc_ch> <target> <tolerance> [timeout_ms]\n", "",
+		"\tExample:		plcpi 0 posmv 1 1 5000 2; Move the axis driven by open drain channel #1 to position 5000 +/-2 of encoder #1 on Board #0\n"};
+
+const CliCmdType CMD_OD_QUEUE =
+	{"odq", 2, &doOdQueue,
+		"\todq:		Execute a sequence of open drain pulse moves, the next move is staged on the board and started when the remaining pulses drop to the watermark\n",
+		"\tUsage:		plcpi <stack> odq <channel> <watermark> <pulses> [<pulses> ...]\n", "",
+		"\tExample:		plcpi 0 odq 1 0 1000 -500 2000; Perform 1000 pulses forward, 500 backward and 2000 forward on open drain channel #1 on Board #0\n"};
+const CliCmdType CMD_OD_WAIT =
+	{"odwait", 2, &doOdWait,
+		"\todwait:	Wait for the open drain pulses to be performed on one or more channels\n",
+		"\tUsage:		plcpi <stack> odwait <channel>[,<channel>...] [timeout_ms]\n", "",
+		"\tExample:		plcpi 0 odwait 1,2 5000; Wait max 5 seconds for open drain channels #1 and #2 on Board #0 to finish the pulses\n"};
+const CliCmdType CMD_OWB_SCAN =
+	{"owbscan", 2, &doOwbScan,
+		"\towbscan:	Search for 1-Wire sensors and refresh the cached ROM codes\n",
+		"\tUsage:		plcpi <stack> owbscan\n", "",
+		"\tExample:		plcpi 0 owbscan; Search the 1-Wire bus on Board #0\n"};
+
+const CliCmdType CMD_OWB_CNT_READ =
+	{"owbcnt", 2, &doOwbCountRead,
+		"\towbcnt:		Read the number of 1-Wire sensors detected by the last search\n",
+		"\tUsage:		plcpi <stack> owbcnt\n", "",
+		"\tExample:		plcpi 0 owbcnt; Display the number of 1-Wire sensors on Board #0\n"};
+
+const CliCmdType CMD_OWB_ID_READ =
+	{"owbidrd", 2, &doOwbIdRead,
+		"\towbidrd:	Display the ROM code of one or all 1-Wire sensors, the codes are cached until the next owbscan\n",
+		"\tUsage:		plcpi <stack> owbidrd [<sensor>]\n", "",
+		"\tExample:		plcpi 0 owbidrd 1; Display the ROM code of the 1-Wire sensor #1 on Board #0\n"};
+
+const CliCmdType CMD_OWB_TEMP_READ =
+	{"owbtrd", 2, &doOwbTempRead,
+		"\towbtrd:		Read the temperature of one or all 1-Wire sensors in Celsius degrees\n",
+		"\tUsage:		plcpi <stack> owbtrd [<sensor>]\n", "",
+		"\tExample:		plcpi 0 owbtrd 1; Read the temperature of the 1-Wire sensor #1 on Board #0\n"};
+
+const CliCmdType CMD_WDT_RELOAD =
+	{"wdtr", 2, &doWdtReload,
+		"\twdtr:		Reload the watchdog timer and enable the watchdog if is disabled\n",
+		"\tUsage:		plcpi <stack> wdtr\n", "",
+		"\tExample:		plcpi 0 wdtr; Reload the watchdog timer on Board #0 with the period \n"};
+
+const CliCmdType CMD_WDT_SET_PERIOD =
+	{"wdtpwr", 2, &doWdtPeriodWrite,
+		"\twdtpwr:		Set the watchdog period in seconds, reload command must be issued in this interval before watchdog resets the raspberry pi\n",
+		"\tUsage:		plcpi <stack> wdtpwr <val> \n", "",
+		"\tExample:		plcpi 0 wdtpwr 10; Set the watchdog timer period on Board #0 at 10 seconds \n"};
+
+const CliCmdType CMD_WDT_GET_PERIOD =
+	{"wdtprd", 2, &doWdtPeriodRead,
+		"\twdtprd:		Get the watchdog period in seconds, reload command must be issued in this interval before watchdog resets the raspberry pi\n",
+		"\tUsage:		plcpi <stack> wdtprd \n", "",
+		"\tExample:		plcpi 0 wdtprd; Get the watchdog timer period on Board #0\n"};
+
+const CliCmdType CMD_WDT_SET_INIT_PERIOD =
+	{"wdtipwr", 2, &doWdtInitPeriodWrite,
+		"\twdtipwr:	Set the watchdog initial period in seconds, this period is loaded after power cycle, giving Raspberry time to boot\n",
+		"\tUsage:		plcpi <stack> wdtipwr <val> \n", "",
+		"\tExample:		plcpi 0 wdtipwr 10; Set the watchdog timer initial period on Board #0 at 10 seconds \n"};
+
+const CliCmdType CMD_WDT_GET_INIT_PERIOD =
+	{"wdtiprd", 2, &doWdtInitPeriodRead,
+		"\twdtiprd:	Get the watchdog initial period in seconds, this period is loaded after power cycle, giving Raspberry time to boot\n",
+		"\tUsage:		plcpi <stack> wdtiprd \n", "",
+		"\tExample:		plcpi 0 wdtiprd; Get the watchdog timer initial period on Board #0\n"};
+
+const CliCmdType CMD_WDT_SET_OFF_PERIOD =
+	{"wdtopwr", 2, &doWdtOffPeriodWrite,
+		"\twdtopwr:	Set the watchdog off period in seconds (max 48 days), this is the time that watchdog mantain Raspberry turned off \n",
+		"\tUsage:		plcpi <stack> wdtopwr <val> \n", "",
+		"\tExample:		plcpi 0 wdtopwr 10; Set the watchdog off interval on Board #0 at 10 seconds \n"};
+
+const CliCmdType CMD_WDT_GET_OFF_PERIOD =
+	{"wdtoprd", 2, &doWdtOffPeriodRead,
+		"\twdtoprd:	Get the watchdog off period in seconds (max 48 days), this is the time that watchdog mantain Raspberry turned off \n",
+		"\tUsage:		plcpi <stack> wdtoprd \n", "",
+		"\tExample:		plcpi 0 wdtoprd; Get the watchdog off period on Board #0\n"};
+
+const CliCmdType CMD_WDT_GET_RESET_COUNT =
+	{"wdtrcrd", 2, &doWdtResetCountRead,
+		"\twdtrcrd:	Get the watchdog numbers of performed repowers\n",
+		"\tUsage:		plcpi <stack> wdtrcrd \n", "",
+		"\tExample:		plcpi 0 wdtrcrd; Get the watchdog reset count on Board #0\n"};
+
+const CliCmdType CMD_WDT_CLR_RESET_COUNT =
+	{"wdtrcclr", 2, &doWdtResetCountClear,
+		"\twdtrcclr:	Clear the reset count\n",
+		"\tUsage:		plcpi <stack> wdtrcclr\n", "",
+		"\tExample:		plcpi 0 wdtrcclr -> Clear the watchdog resets count on Board #0\n"};
+
+const CliCmdType CMD_WDT_KEEP_ALIVE =
+	{"wdtka", 2, &doWdtKeepAlive,
+		"\twdtka:		Stay resident and reload the watchdog at a jittered percent of its period, optionally write the reset count and reloads in text metrics format to a status file\n",
+		"\tUsage:		plcpi <stack> wdtka [<percent>] [<status_file>]\n", "",
+		"\tExample:		plcpi 0 wdtka 50 /var/lib/node_exporter/plcpi_wdt.prom; Reload the watchdog on Board #0 every half period\n"};
+
+const CliCmdType CMD_ADC_CAL =
+	{"adccal", 2, &doAdcCal,
+		"\tadccal:		Calibrate one ADC channel, the calibration must be done in 2 points at min 5V apart\n",
+		"\tUsage:		plcpi <stack> adccal <channel> <value(V)>\n", "",
+		"\tExample:		plcpi 0 adccal 1 0.5; Calibrate the ADC channel #1 on Board #0 at 0.5V\n"};
+
+const CliCmdType CMD_ADC_CAL_RST =
+	{"adccalrst", 2, &doAdcCalRst,
+		"\tadccalrst:	Reset the calibration for one ADC channel\n",
+		"\tUsage:		plcpi <stack> adccalrst <channel>\n", "",
+		"\tExample:		plcpi 0 adccalrst 5; Reset the calibration on ADC channel #5 on Board #0 to factory defaults\n"};
+
+const CliCmdType CMD_DAC_CAL =
+	{"daccal", 2, &doDacCal,
+		"\tdaccal:		Calibrate one DAC channel with the value measured on the output, the calibration must be done in 2 points at min 5V apart\n",
+		"\tUsage:		plcpi <stack> daccal <channel> <value(V)>\n", "",
+		"\tExample:		plcpi 0 daccal 1 0.5; Calibrate the DAC channel #1 on Board #0 at 0.5V\n"};
+
+const CliCmdType CMD_DAC_CAL_RST =
+	{"daccalrst", 2, &doDacCalRst,
+		"\tdaccalrst:	Reset the calibration for one DAC channel\n",
+		"\tUsage:		plcpi <stack> daccalrst <channel>\n", "",
+		"\tExample:		plcpi 0 daccalrst 2; Reset the calibration on DAC channel #2 on Board #0 to factory defaults\n"};
+
+const CliCmdType CMD_CAL_BATCH =
+	{"-calbatch", 1, &doCalBatch,
+		"\t-calbatch:	Execute a calibration plan file, one step per line: <stack> or <bus>:<stack>, <adc1..8|dac1..4> <point <mV>|reset|set <mV>>, ADC points are verified with averaged readings\n",
+		"\tUsage:		plcpi -calbatch <plan_file>\n", "",
+		"\tExample:		plcpi -calbatch rack.cal; Execute the calibration steps from rack.cal\n"};
+
+const CliCmdType CMD_DIAG_LOG =
+	{"-diaglog", 1, &doDiagLog,
+		"\t-diaglog:	Stay resident and record the boards CPU temperature and 3.3V rail voltage into a binary ring file\n",
+		"\tUsage:		plcpi -diaglog <file> <period_s> <bus>:<stack>[,<bus>:<stack>...] [<capacity>]\n", "",
+		"\tExample:		plcpi -diaglog /var/log/plcpi.diag 60 0,1,3:0; Record boards #0 and #1 and board #0 of /dev/i2c-3 diagnostics every minute, keep the last 10080 records\n"};
+
+const CliCmdType CMD_DIAG_STAT =
+	{"-diagstat", 1, &doDiagStat,
+		"\t-diagstat:	Display min/max/mean of the recorded diagnostics per board over a time window and the samples outside the alarm thresholds\n",
+		"\tUsage:		plcpi -diagstat <file> [<window_s> [<max_C> [<min_mV> [<max_mV>]]]]\n", "",
+		"\tExample:		plcpi -diagstat /var/log/plcpi.diag 86400 70 3200 3400; Last day statistics, alarm above 70C or outside 3.2..3.4V\n"};
+
+const CliCmdType CMD_LOOPBACK_TEST =
+	{"lbtest", 2, &doLoopbackTest,
+		"\tlbtest:		Hardware in the loop test, relays or open drain outputs wired back to the opto inputs (output n to input n), measure output to input latency, toggle rate and edge counter accuracy\n",
+		"\tUsage:		plcpi <stack> lbtest <rel/od> [<iterations>] [<report_file>]\n", "",
+		"\tExample:		plcpi 0 lbtest od 100; Test the open drain outputs looped back to opto inputs 1..4 on Board #0\n"};
+
+const CliCmdType CMD_SCAN =
+	{"-scan", 1, &doScan,
+		"\t-scan:		Scan the inputs of several boards, one thread per I2C adapter, and display the scan rate per bus, the cycle start jitter, execution, bus and compute time histograms, the overruns and the last image of every board\n",
+		"\tUsage:		plcpi -scan <bus>:<stack>[,<bus>:<stack>...] <period_ms> <seconds> [<wdt_percent>]\n", "",
+		"\tExample:		plcpi -scan 1:0,1:1,3:0 0 10; Scan continuously for 10 seconds boards #0 and #1 on /dev/i2c-1 and board #0 on /dev/i2c-3; with a wdt_percent the watchdog of every board is reloaded by the scan at this part of its period\n"};
+
+const CliCmdType CMD_TRACE =
+	{"-trace", 1, &doTrace,
+		"\t-trace:		Display an I2C trace file: bus time, errors and latency percentiles per register and the last transactions, record a trace with PLCPI_TRACE=<file> in the environment\n",
+		"\tUsage:		plcpi -trace <file> [<records>]\n", "",
+		"\tExample:		PLCPI_TRACE=/tmp/i2c.trc plcpi 0 relwr 1 on; plcpi -trace /tmp/i2c.trc 10; Trace a relay write and display the last 10 transactions\n"};
+
+const CliCmdType CMD_DAEMON =
+	{"-daemon", 1, &doDaemon,
+		"\t-daemon:	Stay resident, poll the boards periodically and serve read, write and image requests on a unix socket, one I/O thread per I2C adapter\n",
+		"\tUsage:		plcpi -daemon <socket> <bus>:<stack>[,<bus>:<stack>...] <poll_ms> [<window_us>] [<wdt_percent>]\n", "",
+		"\tExample:		plcpi -daemon /run/plcpi.sock 1:0,1:1 10 2000 50; Poll boards #0 and #1 every 10 ms, \"image 1:0 0 4\" on the socket returns the last relays and inputs; the reads of several clients received within 2 ms share one bus transfer; the watchdogs are reloaded by the polls every half period\n"};
+
+const CliCmdType CMD_METRICS =
+	{"-metrics", 1, &doMetrics,
+		"\t-metrics:	Display the cycle timing of a running resident service as text metrics: start jitter, execution, bus and compute time histograms and overruns per I2C adapter\n",
+		"\tUsage:		plcpi -metrics <socket>\n", "",
+		"\tExample:		plcpi -metrics /run/plcpi.sock > /var/lib/node_exporter/plcpi.prom; Export the timing of the service started with \"plcpi -daemon /run/plcpi.sock ...\"\n"};
 
 const CliCmdType *gCmdArray[] = {&CMD_VERSION, &CMD_HELP, &CMD_WAR, &CMD_LIST,
 	&CMD_BOARD,
@@ -1634,6 +1619,35 @@ const CliCmdType *gCmdArray[] = {&CMD_VERSION, &CMD_HELP, &CMD_WAR, &CMD_LIST,
 	&CMD_OD_CNT_WRITE, &CMD_OD_CNT_SAVE, &CMD_OD_CNT_EXEC, &CMD_OD_CNT_RST, &CMD_PWM_FREQ_READ, &CMD_PWM_FREQ_WRITE,
 	&CMD_OPTO_OD_CMD_SET,
 	&CMD_ENC_TH_WRITE,
+	&CMD_POS_MOVE,
+	&CMD_OD_QUEUE,
+	&CMD_OD_WAIT,
+	&CMD_OWB_SCAN,
+	&CMD_OWB_CNT_READ,
+	&CMD_OWB_ID_READ,
+	&CMD_OWB_TEMP_READ,
+	&CMD_WDT_RELOAD,
+	&CMD_WDT_SET_PERIOD,
+	&CMD_WDT_GET_PERIOD,
+	&CMD_WDT_SET_INIT_PERIOD,
+	&CMD_WDT_GET_INIT_PERIOD,
+	&CMD_WDT_SET_OFF_PERIOD,
+	&CMD_WDT_GET_OFF_PERIOD,
+	&CMD_WDT_GET_RESET_COUNT,
+	&CMD_WDT_CLR_RESET_COUNT,
+	&CMD_WDT_KEEP_ALIVE,
+	&CMD_ADC_CAL,
+	&CMD_ADC_CAL_RST,
+	&CMD_DAC_CAL,
+	&CMD_DAC_CAL_RST,
+	&CMD_CAL_BATCH,
+	&CMD_DIAG_LOG,
+	&CMD_DIAG_STAT,
+	&CMD_LOOPBACK_TEST,
+	&CMD_SCAN,
+	&CMD_TRACE,
+	&CMD_DAEMON,
+	&CMD_METRICS,
 
 	&CMD_MV_P_WRITE,
 
@@ -1643,17 +1657,32 @@ int main(int argc, char *argv[])
 {
 	int i = 0;
 	int ret = OK;
+	int stack = 0;
+	char *sep = NULL;
 
 	if (argc == 1)
 	{
 		usage();
 		return -1;
 	}
-#ifdef THREAD_SAFE
-	sem_t *semaphore = sem_open("/SMI2C_SEM", O_CREAT);
-	int semVal = 2;
-	sem_wait(semaphore);
-#endif
+	// "<bus>:<stack>" board id, the commands see only the stack level
+	sep = strchr(argv[1], ':');
+	if (NULL != sep)
+	{
+		if (OK != boardIdParse(argv[1], &gBus, &stack))
+		{
+			printf("Invalid board id, must be <stack> or <bus>:<stack>!\n");
+			return -1;
+		}
+		argv[1] = sep + 1;
+	}
+	busLock(gBus);
+	if (groupCheck(argc, argv))
+	{
+		ret = doGroup(argc, argv);
+		busUnlock(gBus);
+		return ret;
+	}
 	while (NULL != gCmdArray[i])
 	{
 		if ( (gCmdArray[i]->name != NULL) && (gCmdArray[i]->namePos < argc))
@@ -1670,13 +1699,7 @@ int main(int argc, char *argv[])
 						printf("%s", gCmdArray[i]->usage2);
 					}
 				}
-#ifdef THREAD_SAFE
-				sem_getvalue(semaphore, &semVal);
-				if (semVal < 1)
-				{
-					sem_post(semaphore);
-				}
-#endif
+				busUnlock(gBus);
 				return ret;
 			}
 		}
@@ -1684,12 +1707,6 @@ int main(int argc, char *argv[])
 	}
 	printf("Invalid command option\n");
 	usage();
-#ifdef THREAD_SAFE
-	sem_getvalue(semaphore, &semVal);
-	if (semVal < 1)
-	{
-		sem_post(semaphore);
-	}
-#endif
+	busUnlock(gBus);
 	return -1;
 }
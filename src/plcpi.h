@@ -14,10 +14,13 @@
 #define COUNTER_SIZE 4
 
 #define RETRY_TIMES	10
+#define VERIFY_RETRIES 3 // verified output writes, repeated at most this many times
+#define VERIFY_TIMEOUT_US 20000 // and not after this
 #define CALIBRATION_KEY 0xaa
 #define RESET_CALIBRATION_KEY	0x55 
 #define WDT_RESET_SIGNATURE 	0xCA
 #define WDT_MAX_OFF_INTERVAL_S 4147200 //48 days
+#define WDT_PERIOD_MAX 65000
 
 #define OWB_TEMP_SIZE_B 2
 #define OWB_SENS_CNT 8
@@ -140,6 +143,10 @@ typedef enum
 #define ADC_CH_NR_MAX		8
 
 #define OD_PWM_VAL_MAX	10000
+#define OD_MOVE_ACC_MAX 60000
+#define OD_MOVE_SPEED_MIN 10
+#define OD_MOVE_SPEED_MAX 60000
+#define DAC_VOLT_MAX 10
 
 #define ERROR	-1
 #define OK		0
@@ -162,15 +169,208 @@ typedef enum
 	STATE_COUNT
 } OutStateEnumType;
 
+//*********************************** Device context *****************************************
+#define I2C_BUS_DEFAULT 1 // /dev/i2c-1
+#define I2C_BUS_MAX 32 // adapters /dev/i2c-0 to /dev/i2c-31
+#define DEV_FD_MAX 1024 // contexts registry size, indexed by the I2C file descriptor
+
+#define DEV_FEAT_PWM_FREQ 0x01 // pwm frequency setting, hardware >= 3
+#define DEV_FEAT_MOVE_PROFILE 0x02 // open drain movement profile, hardware >= 3
+
+#define DEV_SHADOW_RELAY 0x01
+#define DEV_SHADOW_GPIO 0x02
+
+// transfer errors by errno, see recover.c
+typedef enum
+{
+	DEV_ERR_NACK = 0, // no acknowledge, the board is missing or busy
+	DEV_ERR_TIMEOUT,
+	DEV_ERR_BUS, // arbitration lost or bus stuck
+	DEV_ERR_FD, // the adapter descriptor is no longer valid
+	DEV_ERR_OTHER,
+	DEV_ERR_NR
+} DevErrEnumType;
+
+typedef struct
+{
+	u32 reads;
+	u32 writes;
+	u32 errors;
+	uint64_t bytes;
+	u32 err[DEV_ERR_NR];
+	u32 skipped; // transfers refused while the breaker is open
+	u32 trips; // breaker openings
+	u32 recoveries; // breaker closed again after a recovery
+} DevStatType;
+
+#define DEV_BRK_FAILS 5 // consecutive failed transfers that open the breaker
+#define DEV_BRK_BACKOFF_MIN_MS 100
+#define DEV_BRK_BACKOFF_MAX_MS 10000
+
+#define DEV_RECOVER_REOPEN 0x01 // open the adapter again
+#define DEV_RECOVER_REBIND 0x02 // unbind and bind the adapter driver, needs root
+#define DEV_RECOVER_CLEAR 0x04 // call the bus clear handler
+
+typedef enum
+{
+	DEV_BRK_CLOSED = 0, // transfers allowed
+	DEV_BRK_OPEN, // transfers refused until the backoff ends
+	DEV_BRK_HALF_OPEN, // one probe transfer after a recovery
+} DevBrkEnumType;
+
+typedef enum
+{
+	DEV_BUS_UNUSED = 0, // no transfer tried since devBusOutcomeClear()
+	DEV_BUS_USED, // transfers went to the bus
+	DEV_BUS_REFUSED, // a transfer was refused by an open breaker
+} DevBusOutcomeType;
+
+typedef struct
+{
+	u8 state; // DevBrkEnumType
+	u8 lastErr; // DevErrEnumType
+	u16 fails; // consecutive failed transfers
+	u32 backoffMs;
+	uint64_t retryUs; // end of the backoff
+} DevBrkType;
+
+typedef void (*DevBusClearType)(int bus);
+
+// read consistency policies, see cons.c
+#define CONS_READ_MAX 16
+
+typedef enum
+{
+	CONS_SINGLE = 0, // one read
+	CONS_AGREE, // n equal values out of at most m reads
+	CONS_MONOTONIC, // counter step checked against the last value, agreement if not sane
+	CONS_BLOCK, // two equal consecutive block reads, at most m reads
+	CONS_NR
+} ConsEnumType;
+
+typedef struct
+{
+	u8 type; // ConsEnumType
+	u8 n;
+	u8 m;
+	u32 limit; // CONS_MONOTONIC: counts per second
+} ConsPolicyType;
+
+typedef struct
+{
+	u32 calls;
+	u32 reads; // bus reads
+	u32 retries; // reads over the policy minimum
+	u32 failures;
+} ConsStatType;
+
+typedef struct
+{
+	u32 val;
+	uint64_t us;
+	u8 valid;
+} ConsLastType;
+
+// read cache classes, see cache.c
+#define CACHE_FOREVER UINT64_MAX // read once
+
+typedef enum
+{
+	CACHE_LIVE = 0, // never cached
+	CACHE_INPUT, // inputs, outputs state and counters
+	CACHE_DIAG, // temperature and supply
+	CACHE_CONFIG, // configuration written by the host
+	CACHE_REVISION, // hardware and firmware version
+	CACHE_NR
+} CacheEnumType;
+
+typedef struct
+{
+	u32 hits;
+	u32 misses; // bus reads of a class with a budget
+} CacheStatType;
+
+typedef struct
+{
+	int fd;
+	int bus; // I2C adapter number
+	int addr; // 7 bits slave address
+	int stack;
+	u8 ver[4]; // hardware major, minor, firmware major, minor
+	u32 features; // DEV_FEAT_* flags
+	u8 shadowValid; // DEV_SHADOW_* flags
+	u8 relayShadow; // last relay value written or read
+	u8 gpioShadow;
+	DevStatType stat;
+	DevBrkType brk;
+	ConsStatType cons[CONS_NR];
+	ConsLastType consLast[SLAVE_BUFF_SIZE + 1]; // CONS_MONOTONIC counters
+	CacheStatType cache[CACHE_NR];
+	u8 cacheVal[SLAVE_BUFF_SIZE + 1]; // register snapshot
+	uint64_t cacheUs[SLAVE_BUFF_SIZE + 1]; // read time, 0 if not valid
+} DevCtxType;
+
+int devOpen(int bus, int stack);
+void devClose(int dev);
+DevCtxType* devGet(int dev);
+int devFeature(int dev, u32 feature);
+void devShadowSet(int dev, u8 reg, u8 val);
+int devShadowGet(int dev, u8 reg, u8 *val);
+void devStatAdd(int dev, int isWrite, int bytes, int ret);
+int devBusAllow(int dev);
+void devBusOutcomeClear(void);
+int devBusOutcomeGet(void);
+void devRecoverSet(u32 flags, DevBusClearType clear);
+int devRecover(int dev);
+int consPolicySet(int add, int size, ConsPolicyType *policy);
+int consPolicyGet(int add, ConsPolicyType *policy);
+int consRead(int dev, int add, u8 *buff, int size, u32 ignore);
+int cacheAgeSet(int cls, uint64_t maxAgeUs);
+int cacheClassSet(int add, int size, int cls);
+int cacheGet(int dev, int add, u8 *buff, int size);
+void cachePut(int dev, int add, const u8 *buff, int size);
+void cacheDrop(int dev, int add, int size);
+void cacheClear(int dev);
+//********************************************************************************************
+
+int boardIdParse(const char *arg, int *bus, int *stack);
+int doBoardOpen(int bus, int stack);
 int doBoardInit(int stack);
-u8 getHwVer(void);
+int boardBusGet(void);
+int groupCheck(int argc, char *argv[]);
+int doGroup(int argc, char *argv[]);
+int relayChSet(int dev, u8 channel, OutStateEnumType state);
+int relayChGet(int dev, u8 channel, OutStateEnumType *state);
+int relaySet(int dev, int val);
+int relayGet(int dev, int *val);
 int adcGet(int dev, int ch, float *val);
+int adcGetAvg(int dev, int ch, int samples, float *val);
+int odGet(int dev, int ch, float *val);
 int odSet(int dev, int ch, float val);
+int dacGet(int dev, int ch, float *val);
 int dacSet(int dev, int ch, float val);
+int calibPointSet(int dev, int ch, int mV);
+int calibReset(int dev, int ch);
+int doAdcCal(int argc, char *argv[]);
+int doAdcCalRst(int argc, char *argv[]);
+int doDacCal(int argc, char *argv[]);
+int doDacCalRst(int argc, char *argv[]);
+int doCalBatch(int argc, char *argv[]);
 
 int gpioChSet(int dev, u8 channel, OutStateEnumType state);
 int gpioChGet(int dev, u8 channel, OutStateEnumType *state);
 int gpioChDirSet(int dev, u8 channel, u8 state);
+int gpioSet(int dev, int val);
+int gpioGet(int dev, int *val);
+int gpioDirSet(int dev, int val);
+int gpioDirGet(int dev, int *val);
+int gpioEdgeGet(int dev, u8 channel, u8 *val);
+int gpioEdgeSet(int dev, u8 channel, u8 val);
+int gpioCountGet(int dev, u8 channel, u32 *val);
+int gpioCountReset(int dev, u8 channel);
+int gpioEncGetCnt(int dev, int *val);
+int gpioEncRstCnt(int dev);
+int inCmdSet(int dev, u8 inCh, u8 outCh, u32 count, u8 enable);
 int doGpioRead(int argc, char *argv[]);
 int doGpioDirWrite(int argc, char *argv[]);
 int doGpioDirRead(int argc, char *argv[]);
@@ -186,6 +386,11 @@ int doInCmdSet(int argc, char *argv[]);
 //********************************************************************************************
 
 int optoChGet(int dev, u8 channel, OutStateEnumType *state);
+int optoGet(int dev, int *val);
+int optoEdgeGet(int dev, u8 channel, u8 *val);
+int optoEdgeSet(int dev, u8 channel, u8 val);
+int optoCountGet(int dev, u8 channel, u32 *val);
+int optoCountReset(int dev, u8 channel);
 int doOptoRead(int argc, char *argv[]);
 int doOptoEdgeWrite(int argc, char *argv[]);
 int doOptoEdgeRead(int argc, char *argv[]);
@@ -196,6 +401,152 @@ int doOptoEncoderRead(int argc, char *argv[]);
 int doOptoEncoderCntRead(int argc, char *argv[]);
 int doOptoEncoderCntReset(int argc, char *argv[]);
 
+int optoEncStateWrite(int dev, u8 channel, u8 val);
+int optoEncStateRead(int dev, u8 channel, u8 *val);
+int optoEncGetCnt(int dev, u8 channel, int *val);
+int optoEncRstCnt(int dev, u8 channel);
+
+int odWritePulses(int dev, int ch, unsigned int val);
+int odSaveOdPulses(int dev, int ch, unsigned int val);
+int odExecPulses(int dev, int ch);
+int odResetPulses(int dev, int ch);
+int odReadPulses(int dev, int ch, unsigned int *val);
+int pwmFreqGet(int dev, int *val);
+int pwmFreqSet(int dev, int val);
+int pwmChFreqSet(int dev, int ch, int val);
+int odOutMoveSet(int dev, int ch, int acc, int dec, int minSpd, int maxSpd);
+int encSetThreshold(int dev, int ch, unsigned int val);
+
+//*********************************** closed loop positioning ********************************
+typedef struct
+{
+	int position; // last encoder reading
+	int error; // target - position
+	int moves; // pulse moves issued, first approach included
+	unsigned int settleUs; // time from start until the position was inside the tolerance
+} PosResultType;
+
+int posMove(int dev, int odCh, int encCh, int target, int tolerance,
+	int timeoutMs, PosResultType *res);
+int doPosMove(int argc, char *argv[]);
+//********************************************************************************************
+
+//*********************************** OD pulses motion queue *********************************
+#define MQ_SIZE 64
+
+typedef struct
+{
+	int ch; // [1..8], channels 5 to 8 are channels 1 to 4 in opposite direction
+	unsigned int pulses;
+} MqSegType;
+
+typedef struct
+{
+	int dev;
+	int ch; // axis open drain channel [1..4]
+	unsigned int watermark; // fire the staged segment when the remaining pulses drop to this value
+	MqSegType seg[MQ_SIZE];
+	int head;
+	int count;
+	// metrics
+	unsigned int segments; // segments executed
+	unsigned int polls; // remaining pulses reads
+	unsigned int idleGaps; // segments fired after the axis was found stopped
+	uint64_t idleUs; // total time the axis was seen stopped with a segment staged
+	uint64_t maxIdleUs;
+} MqType;
+
+void mqInit(MqType *mq, int dev, int ch, unsigned int watermark);
+int mqPush(MqType *mq, int pulses);
+int mqDepth(MqType *mq);
+int mqRun(MqType *mq, int timeoutMs);
+int doOdQueue(int argc, char *argv[]);
+int odWaitPulses(int dev, u8 chMask, unsigned int level, int timeoutMs,
+	int *polls);
+int doOdWait(int argc, char *argv[]);
+//********************************************************************************************
+
+//*********************************** 1-Wire bus *********************************************
+int owbScan(int dev, int *count);
+int owbCountGet(int dev, int *count);
+int owbRomCodeGet(int dev, int idx, uint64_t *rom);
+int owbTempGetAll(int dev, float *temp);
+int owbCacheLoad(int bus, int stack, uint64_t *rom, int *count);
+int owbCacheSave(int bus, int stack, uint64_t *rom, int count);
+int doOwbScan(int argc, char *argv[]);
+int doOwbCountRead(int argc, char *argv[]);
+int doOwbIdRead(int argc, char *argv[]);
+int doOwbTempRead(int argc, char *argv[]);
+//********************************************************************************************
+
+//*********************************** Watchdog ***********************************************
+typedef struct
+{
+	int dev;
+	int percent; // reload after this part of the period
+	int periodS; // watchdog period read from the board
+	int slackUs; // longest delay of the caller between due time and service
+	uint64_t nextUs; // next reload time stamp
+	unsigned int reloads;
+	unsigned int seed;
+} WdtKaType;
+
+int wdtReload(int dev);
+int wdtPeriodSet(int dev, int period);
+int wdtPeriodGet(int dev, int *period);
+int wdtInitPeriodSet(int dev, int period);
+int wdtInitPeriodGet(int dev, int *period);
+int wdtOffIntervalSet(int dev, int interval);
+int wdtOffIntervalGet(int dev, int *interval);
+int wdtResetCountGet(int dev, int *count);
+int wdtResetCountClear(int dev);
+int wdtKaInit(WdtKaType *ka, int dev, int percent, int slackUs);
+int wdtKaService(WdtKaType *ka, uint64_t now);
+int doWdtReload(int argc, char *argv[]);
+int doWdtPeriodWrite(int argc, char *argv[]);
+int doWdtPeriodRead(int argc, char *argv[]);
+int doWdtInitPeriodWrite(int argc, char *argv[]);
+int doWdtInitPeriodRead(int argc, char *argv[]);
+int doWdtOffPeriodWrite(int argc, char *argv[]);
+int doWdtOffPeriodRead(int argc, char *argv[]);
+int doWdtResetCountRead(int argc, char *argv[]);
+int doWdtResetCountClear(int argc, char *argv[]);
+int doWdtKeepAlive(int argc, char *argv[]);
+//********************************************************************************************
+
+int diagGet(int dev, int *temperature, int *mV);
+int doDiagLog(int argc, char *argv[]);
+int doDiagStat(int argc, char *argv[]);
+
 int doLoopbackTest(int argc, char *argv[]);
 
+//*********************************** Register transactions **********************************
+#define TX_OP_MAX 64
+#define TX_MEM_SIZE (SLAVE_BUFF_SIZE + 1)
+
+typedef struct
+{
+	u8 isRead;
+	u8 add;
+	u16 size;
+	u8 *buff; // read destination
+} TxOpType;
+
+typedef struct
+{
+	int dev;
+	int count;
+	TxOpType op[TX_OP_MAX];
+	u8 wrVal[TX_MEM_SIZE]; // staged writes, the last queued value of a byte wins
+	u8 wrMask[TX_MEM_SIZE];
+	u8 rdMask[TX_MEM_SIZE];
+	int xfers; // I2C transactions used by the last commit
+} TxType;
+
+void txInit(TxType *tx, int dev);
+int txWrite(TxType *tx, int add, const u8 *buff, int size);
+int txRead(TxType *tx, int add, u8 *buff, int size);
+int txCommit(TxType *tx, int *result);
+//********************************************************************************************
+
 #endif //IOPLUS_H_
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define POS_POLL_US 500 // encoder monitor period
+#define POS_STABLE_POLLS 6 // encoder readings without change to consider the axis stopped
+#define POS_MAX_MOVES 10 // first approach plus corrections
+#define POS_DEFAULT_TIMEOUT_MS 10000
+
+#ifndef PLCPI_CLI
+/**
+ * Start one pulse move toward the target
+ * Params:
+ * 	dev - I2C port
+ * 	odCh - open drain channel [1..4] that moves the axis in the encoder positive direction
+ * 	err - position error in encoder counts, the sign select the direction
+ */
+static int posMoveStart(int dev, int odCh, int err)
+{
+	if (err > 0)
+	{
+		return odWritePulses(dev, odCh, (unsigned int)err);
+	}
+	// channels 5 to 8 are channels 1 to 4 in opposite direction
+	return odWritePulses(dev, odCh + OD_CH_NO, (unsigned int) (-err));
+}
+
+/**
+ * Move an open drain pulse axis to an absolute encoder position
+ * The encoder threshold is programmed to the target so the firmware stops the
+ * pulses by itself if the axis reach the target before the pulse count expire,
+ * the encoder is monitored in the mean time and corrective moves are issued
+ * until the error is inside the tolerance. The threshold register is unsigned,
+ * a negative target is reached with the monitor stop only.
+ * Params:
+ * 	dev - I2C port
+ * 	odCh - open drain channel [1..4]
+ * 	encCh - optocoupled encoder channel [1..4]
+ * 	target - position in encoder counts
+ * 	tolerance - accepted position error in encoder counts
+ * 	timeoutMs - give up after this time
+ * 	res - result, may be NULL
+ */
+int posMove(int dev, int odCh, int encCh, int target, int tolerance,
+	int timeoutMs, PosResultType *res)
+{
+	PosResultType r;
+	uint64_t start = 0;
+	uint64_t deadline = 0;
+	unsigned int remaining = 0;
+	int pos = 0;
+	int lastPos = 0;
+	int stable = 0;
+	int dir = 0;
+	int ret = ERROR;
+
+	if ( (odCh < CHANNEL_NR_MIN) || (odCh > OD_CH_NR_MAX)
+		|| (encCh < CHANNEL_NR_MIN) || (encCh > OPTO_IN_CH_NR_MAX / 2)
+		|| (tolerance < 0))
+	{
+		return ERROR;
+	}
+	if (timeoutMs <= 0)
+	{
+		timeoutMs = POS_DEFAULT_TIMEOUT_MS;
+	}
+	memset(&r, 0, sizeof(r));
+	start = getTimeUs();
+	deadline = start + (uint64_t)timeoutMs * 1000;
+
+	if (OK != optoEncGetCnt(dev, (u8)encCh, &pos))
+	{
+		return ERROR;
+	}
+	if ( (target >= 0) && (OK != encSetThreshold(dev, odCh, (unsigned int)target)))
+	{
+		return ERROR;
+	}
+
+	while (1)
+	{
+		r.position = pos;
+		r.error = target - pos;
+		if (abs(r.error) <= tolerance)
+		{
+			r.settleUs = (unsigned int) (getTimeUs() - start);
+			ret = OK;
+			break;
+		}
+		if (r.moves >= POS_MAX_MOVES)
+		{
+			break;
+		}
+		dir = r.error > 0 ? 1 : -1;
+		if (OK != posMoveStart(dev, odCh, r.error))
+		{
+			break;
+		}
+		r.moves++;
+
+		// monitor the encoder until the pulses are done and the axis stopped
+		remaining = 1;
+		stable = 0;
+		lastPos = pos;
+		while (stable < POS_STABLE_POLLS)
+		{
+			if (getTimeUs() > deadline)
+			{
+				odResetPulses(dev, odCh);
+				goto exit;
+			}
+			busyWaitUs(POS_POLL_US);
+			if (OK != optoEncGetCnt(dev, (u8)encCh, &pos))
+			{
+				odResetPulses(dev, odCh);
+				goto exit;
+			}
+			if (remaining != 0)
+			{
+				if (OK != odReadPulses(dev, odCh, &remaining))
+				{
+					goto exit;
+				}
+				// backup of the firmware threshold stop
+				if ( (remaining != 0) && (dir * (target - pos) <= 0))
+				{
+					odResetPulses(dev, odCh);
+					remaining = 0;
+				}
+			}
+			if ( (remaining == 0) && (pos == lastPos))
+			{
+				stable++;
+			}
+			else
+			{
+				stable = 0;
+			}
+			lastPos = pos;
+		}
+	}
+exit:
+	encSetThreshold(dev, 0, 0);
+	if (res)
+	{
+		*res = r;
+	}
+	return ret;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+int doPosMove(int argc, char *argv[])
+{
+	int dev = 0;
+	int odCh = 0;
+	int encCh = 0;
+	int target = 0;
+	int tolerance = 0;
+	int timeout = 0;
+	PosResultType res;
+
+	memset(&res, 0, sizeof(res));
+	if ( (argc != 7) && (argc != 8))
+	{
+		return ARG_CNT_ERR;
+	}
+	odCh = atoi(argv[3]);
+	if ( (odCh < CHANNEL_NR_MIN) || (odCh > OD_CH_NR_MAX))
+	{
+		printf("Open drain channel out of range [1..4]!\n");
+		return ARG_ERR;
+	}
+	encCh = atoi(argv[4]);
+	if ( (encCh < CHANNEL_NR_MIN) || (encCh > OPTO_IN_CH_NR_MAX / 2))
+	{
+		printf("Optocoupled encoder number value out of range [1..4]!\n");
+		return ARG_ERR;
+	}
+	target = atoi(argv[5]);
+	tolerance = atoi(argv[6]);
+	if (tolerance < 0)
+	{
+		printf("Invalid tolerance!\n");
+		return ARG_ERR;
+	}
+	if (argc == 8)
+	{
+		timeout = atoi(argv[7]);
+	}
+
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != posMove(dev, odCh, encCh, target, tolerance, timeout, &res))
+	{
+		printf("Fail to reach position, position %d error %d after %d moves\n",
+			res.position, res.error, res.moves);
+		return ERROR;
+	}
+	printf("position %d error %d moves %d settle %0.1f ms\n", res.position,
+		res.error, res.moves, (float)res.settleUs / 1000);
+	return OK;
+}
+#endif // PLCPI_LIB
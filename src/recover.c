@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+/*
+ * Transfer errors accounting and recovery. The failed transfers are counted
+ * per board by errno class. After DEV_BRK_FAILS consecutive failures the
+ * board breaker opens: its transfers fail at once, without using the bus,
+ * until the backoff ends. Then the recovery actions run and one probe
+ * transfer is allowed, a success close the breaker, a failure open it again
+ * with twice the backoff. A missing board costs the other boards of the bus
+ * one failed transfer per backoff instead of one per access.
+ */
+
+#define REBIND_INTERVAL_US 1000000 // the rebind reset every board of the adapter
+#define REBIND_OPEN_TRIES 50 // the device node comes back asynchronously
+#define REBIND_OPEN_WAIT_MS 10
+
+static u32 gRecoverFlags = DEV_RECOVER_REOPEN;
+static DevBusClearType gBusClear = NULL;
+static uint64_t gRebindUs[I2C_BUS_MAX];
+static pthread_mutex_t gRecoverMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread int gBusOutcome = DEV_BUS_UNUSED; // DevBusOutcomeType
+
+/**
+ * Select the recovery actions, DEV_RECOVER_* flags, process wide
+ * Params:
+ * 	clear - bus clear handler for DEV_RECOVER_CLEAR, clocks SCL until the
+ * 	slave holding SDA releases it, the pins access is board specific
+ */
+void devRecoverSet(u32 flags, DevBusClearType clear)
+{
+	pthread_mutex_lock(&gRecoverMutex);
+	gRecoverFlags = flags;
+	gBusClear = clear;
+	pthread_mutex_unlock(&gRecoverMutex);
+}
+
+static int devErrClass(int err)
+{
+	switch (err)
+	{
+	case ENXIO:
+	case EREMOTEIO:
+		return DEV_ERR_NACK;
+	case ETIMEDOUT:
+		return DEV_ERR_TIMEOUT;
+	case EAGAIN:
+	case EBUSY:
+	case EIO:
+		return DEV_ERR_BUS;
+	case EBADF:
+	case ENODEV:
+	case ENOENT:
+		return DEV_ERR_FD;
+	default:
+		return DEV_ERR_OTHER;
+	}
+}
+
+/**
+ * Account a transfer result in the board statistics and breaker, the errno
+ * of a failed transfer must still be set
+ */
+void devStatAdd(int dev, int isWrite, int bytes, int ret)
+{
+	DevCtxType *ctx = devGet(dev);
+	DevBrkType *brk = NULL;
+	int err = errno;
+
+	if (NULL == ctx)
+	{
+		return;
+	}
+	brk = &ctx->brk;
+	if (ret != OK)
+	{
+		brk->lastErr = (u8)devErrClass(err ? err : EIO);
+		ctx->stat.errors++;
+		ctx->stat.err[brk->lastErr]++;
+		if (brk->fails < 0xffff)
+		{
+			brk->fails++;
+		}
+		if ( (brk->state == DEV_BRK_HALF_OPEN) || (brk->fails >= DEV_BRK_FAILS))
+		{
+			if (brk->state == DEV_BRK_HALF_OPEN)
+			{
+				brk->backoffMs *= 2;
+			}
+			else
+			{
+				brk->backoffMs = DEV_BRK_BACKOFF_MIN_MS;
+			}
+			if (brk->backoffMs > DEV_BRK_BACKOFF_MAX_MS)
+			{
+				brk->backoffMs = DEV_BRK_BACKOFF_MAX_MS;
+			}
+			brk->state = DEV_BRK_OPEN;
+			brk->retryUs = getTimeUs() + (uint64_t)brk->backoffMs * 1000;
+			ctx->stat.trips++;
+		}
+		errno = err;
+		return;
+	}
+	if (brk->state == DEV_BRK_HALF_OPEN)
+	{
+		ctx->stat.recoveries++;
+	}
+	brk->state = DEV_BRK_CLOSED;
+	brk->fails = 0;
+	if (isWrite)
+	{
+		ctx->stat.writes++;
+	}
+	else
+	{
+		ctx->stat.reads++;
+	}
+	ctx->stat.bytes += (u32)bytes;
+}
+
+/**
+ * Forget the bus outcome of the calling thread, call it before an accessor to
+ * learn with devBusOutcomeGet() why it failed: refused by the breaker, failed
+ * on the bus, or rejected before any transfer
+ */
+void devBusOutcomeClear(void)
+{
+	gBusOutcome = DEV_BUS_UNUSED;
+}
+
+int devBusOutcomeGet(void)
+{
+	return gBusOutcome;
+}
+
+/**
+ * Check the board breaker before a transfer, run the recovery when the
+ * backoff ended
+ * Return OK if the transfer can go, ERROR with errno EHOSTDOWN if not
+ */
+int devBusAllow(int dev)
+{
+	DevCtxType *ctx = devGet(dev);
+
+	if ( (NULL == ctx) || (ctx->brk.state != DEV_BRK_OPEN))
+	{
+		if (gBusOutcome == DEV_BUS_UNUSED)
+		{
+			gBusOutcome = DEV_BUS_USED;
+		}
+		return OK;
+	}
+	if (getTimeUs() < ctx->brk.retryUs)
+	{
+		ctx->stat.skipped++;
+		gBusOutcome = DEV_BUS_REFUSED;
+		errno = EHOSTDOWN;
+		return ERROR;
+	}
+	if (gBusOutcome == DEV_BUS_UNUSED)
+	{
+		gBusOutcome = DEV_BUS_USED;
+	}
+	ctx->brk.state = DEV_BRK_HALF_OPEN;
+	devRecover(dev);
+	return OK;
+}
+
+static int devSysWrite(const char *dir, const char *file, const char *val)
+{
+	char path[PATH_MAX + 16];
+	int fd = -1;
+	int ret = OK;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, file);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	if (write(fd, val, strlen(val)) < 0)
+	{
+		ret = ERROR;
+	}
+	close(fd);
+	return ret;
+}
+
+/**
+ * Unbind and bind again the driver of the adapter controller, the adapter
+ * and its device node are created again
+ */
+static int devAdapterRebind(int bus)
+{
+	char path[PATH_MAX + 16];
+	char ctrl[PATH_MAX];
+	char drv[PATH_MAX];
+	char *name = NULL;
+
+	snprintf(path, sizeof(path), "/sys/bus/i2c/devices/i2c-%d", bus);
+	if (NULL == realpath(path, ctrl))
+	{
+		return ERROR;
+	}
+	// the controller device is the parent of the adapter
+	name = strrchr(ctrl, '/');
+	if (NULL == name)
+	{
+		return ERROR;
+	}
+	*name = 0;
+	name = strrchr(ctrl, '/');
+	if (NULL == name)
+	{
+		return ERROR;
+	}
+	name++;
+	snprintf(path, sizeof(path), "%s/driver", ctrl);
+	if ( (NULL == realpath(path, drv)) || (OK != devSysWrite(drv, "unbind", name)))
+	{
+		return ERROR;
+	}
+	return devSysWrite(drv, "bind", name);
+}
+
+/**
+ * Recovery actions of a failing board, called with the bus lock held
+ */
+int devRecover(int dev)
+{
+	DevCtxType *ctx = devGet(dev);
+	DevBusClearType clear = NULL;
+	uint64_t now = getTimeUs();
+	u32 flags = 0;
+	int rebind = 0;
+	int fd = -1;
+	int i = 0;
+
+	if (NULL == ctx)
+	{
+		return ERROR;
+	}
+	// the board may have been reset, its configuration is read again
+	cacheClear(dev);
+	pthread_mutex_lock(&gRecoverMutex);
+	flags = gRecoverFlags;
+	clear = gBusClear;
+	// a stuck bus is shared by all its boards, reset it at most once a while
+	if ( (flags & DEV_RECOVER_REBIND)
+		&& ( (ctx->brk.lastErr == DEV_ERR_BUS)
+			|| (ctx->brk.lastErr == DEV_ERR_TIMEOUT))
+		&& (now - gRebindUs[ctx->bus] >= REBIND_INTERVAL_US))
+	{
+		gRebindUs[ctx->bus] = now;
+		rebind = 1;
+	}
+	pthread_mutex_unlock(&gRecoverMutex);
+
+	if ( (flags & DEV_RECOVER_CLEAR) && (NULL != clear)
+		&& (ctx->brk.lastErr != DEV_ERR_NACK))
+	{
+		clear(ctx->bus);
+	}
+	if (rebind && (OK != devAdapterRebind(ctx->bus)))
+	{
+		rebind = 0;
+	}
+	if ( (flags & DEV_RECOVER_REOPEN) || rebind)
+	{
+		for (i = 0; i < (rebind ? REBIND_OPEN_TRIES : 1); i++)
+		{
+			fd = i2cSetup(ctx->bus, ctx->addr);
+			if (fd >= 0)
+			{
+				break;
+			}
+			busyWait(REBIND_OPEN_WAIT_MS);
+		}
+		if (fd < 0)
+		{
+			return ERROR;
+		}
+		// keep the descriptor number, it is the board handle
+		if (dup2(fd, dev) < 0)
+		{
+			close(fd);
+			return ERROR;
+		}
+		close(fd);
+	}
+	return OK;
+}
@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+
+/*
+ * The relay writes are verified, the value is read back in the same bus
+ * transaction and the write repeated within VERIFY_RETRIES / VERIFY_TIMEOUT_US
+ */
+int relayChSet(int dev, u8 channel, OutStateEnumType state)
+{
+	u8 buff[2];
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1))
+	{
+		return FAIL;
+	}
+
+	switch (state)
+	{
+	case OFF:
+		buff[0] &= ~ (1 << (channel - 1));
+		break;
+	case ON:
+		buff[0] |= 1 << (channel - 1);
+		break;
+	default:
+		return ERROR;
+		break;
+	}
+	if (OK
+		!= i2cMem8WriteVerify(dev, I2C_MEM_RELAY_VAL_ADD, buff, NULL, 1,
+			VERIFY_RETRIES, VERIFY_TIMEOUT_US))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_RELAY, buff[0]);
+	return OK;
+}
+
+int relayChGet(int dev, u8 channel, OutStateEnumType *state)
+{
+	u8 buff[2];
+
+	if (NULL == state)
+	{
+		return ERROR;
+	}
+
+	if ( (channel < CHANNEL_NR_MIN) || (channel > RELAY_CH_NR_MAX))
+	{
+		return ERROR;
+	}
+
+//	if (FAIL == i2cMem8Read(dev, I2C_MEM_RELAY_VAL_ADD, buff, 1))
+//	{
+//		return ERROR;
+//	}
+	if (OK != i2cReadByteAS(dev, I2C_MEM_RELAY_VAL_ADD, buff))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_RELAY, buff[0]);
+	if (buff[0] & (1 << (channel - 1)))
+	{
+		*state = ON;
+	}
+	else
+	{
+		*state = OFF;
+	}
+	return OK;
+}
+
+int relaySet(int dev, int val)
+{
+	u8 buff[2];
+
+	buff[0] = 0xff & val;
+
+	if (OK
+		!= i2cMem8WriteVerify(dev, I2C_MEM_RELAY_VAL_ADD, buff, NULL, 1,
+			VERIFY_RETRIES, VERIFY_TIMEOUT_US))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_RELAY, buff[0]);
+	return OK;
+}
+
+int relayGet(int dev, int *val)
+{
+	u8 buff[2];
+
+	if (NULL == val)
+	{
+		return ERROR;
+	}
+	if (OK != i2cReadByteAS(dev, I2C_MEM_RELAY_VAL_ADD, buff))
+	{
+		return ERROR;
+	}
+	devShadowSet(dev, DEV_SHADOW_RELAY, buff[0]);
+	*val = buff[0];
+	return OK;
+}
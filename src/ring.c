@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "ring.h"
+
+/*
+ * Output command rings shared between a control process and the resident
+ * service. The producer only stores the command and releases head, no system
+ * call; the consumer, the I/O thread of the board, executes all the commands
+ * queued at the start of a poll in one bus lock session and releases done
+ * after each one, done is the completion sequence seen by the producer.
+ */
+
+static void ringInit(RingShmType *r, int bus, int stack)
+{
+	memset(r, 0, sizeof(RingShmType));
+	r->slots = RING_SLOTS;
+	r->bus = (uint16_t)bus;
+	r->stack = (uint8_t)stack;
+	__atomic_store_n(&r->magic, RING_MAGIC, __ATOMIC_RELEASE);
+}
+
+/**
+ * Create the shared memory ring of a client, name is a POSIX shared memory
+ * object name. The object is given to the client user and group, uid -1 to
+ * keep the service ones; the change needs the service to run as root, else
+ * the client reaches the ring through the group
+ */
+RingShmType* ringCreate(const char *name, int bus, int stack, uid_t uid,
+	gid_t gid)
+{
+	RingShmType *r = NULL;
+	int fd = -1;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	// only root can give the object away, else the client uses the group;
+	// the mode is set again, shm_open() applies the umask
+	if ( ( (uid != (uid_t)-1) && (0 != fchown(fd, uid, gid)) && (0 == geteuid()))
+		|| (0 != fchmod(fd, 0660)))
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	if (0 != ftruncate(fd, sizeof(RingShmType)))
+	{
+		close(fd);
+		shm_unlink(name);
+		return NULL;
+	}
+	r = mmap(NULL, sizeof(RingShmType), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0);
+	close(fd);
+	if (MAP_FAILED == r)
+	{
+		shm_unlink(name);
+		return NULL;
+	}
+	ringInit(r, bus, stack);
+	return r;
+}
+
+void ringDestroy(RingShmType *r, const char *name)
+{
+	ringUnmap(r);
+	shm_unlink(name);
+}
+
+/**
+ * Map an existing ring, producer side
+ */
+RingShmType* ringMap(const char *name)
+{
+	RingShmType *r = NULL;
+	struct stat st;
+	int fd = -1;
+
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+	{
+		return NULL;
+	}
+	if ( (0 != fstat(fd, &st)) || (st.st_size < (off_t)sizeof(RingShmType)))
+	{
+		close(fd);
+		return NULL;
+	}
+	r = mmap(NULL, sizeof(RingShmType), PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+		0);
+	close(fd);
+	if (MAP_FAILED == r)
+	{
+		return NULL;
+	}
+	if ( (__atomic_load_n(&r->magic, __ATOMIC_ACQUIRE) != RING_MAGIC)
+		|| (r->slots != RING_SLOTS))
+	{
+		munmap(r, sizeof(RingShmType));
+		return NULL;
+	}
+	return r;
+}
+
+void ringUnmap(RingShmType *r)
+{
+	if (NULL != r)
+	{
+		munmap(r, sizeof(RingShmType));
+	}
+}
+
+/**
+ * Queue a command, producer side
+ * Params:
+ * 	seq - done reaches this value when the command is executed
+ * Return ERROR if the ring is full
+ */
+int ringPut(RingShmType *r, const RingCmdType *cmd, uint32_t *seq)
+{
+	uint32_t head = 0;
+	uint32_t done = 0;
+
+	if ( (NULL == r) || (NULL == cmd))
+	{
+		return ERROR;
+	}
+	head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+	done = __atomic_load_n(&r->done, __ATOMIC_ACQUIRE);
+	if (head - done >= RING_SLOTS)
+	{
+		return ERROR;
+	}
+	r->cmd[head & (RING_SLOTS - 1)] = *cmd;
+	__atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+	if (NULL != seq)
+	{
+		*seq = head + 1;
+	}
+	return OK;
+}
+
+static int ringExec(int dev, const RingCmdType *cmd)
+{
+	switch (cmd->type)
+	{
+	case RING_RELAY:
+		return relaySet(dev, cmd->val & 0xff);
+	case RING_GPIO:
+		return gpioSet(dev, cmd->val & ( (1 << GPIO_CH_NO) - 1));
+	case RING_OD:
+		if ( (cmd->val < 0) || (cmd->val > 10000))
+		{
+			return ERROR;
+		}
+		return odSet(dev, cmd->ch, (float)cmd->val / 100);
+	case RING_DAC:
+		if ( (cmd->ch < CHANNEL_NR_MIN) || (cmd->ch > DAC_CH_NR_MAX)
+			|| (cmd->val < 0) || (cmd->val > DAC_VOLT_MAX * VOLT_TO_MILIVOLT))
+		{
+			return ERROR;
+		}
+		return dacSet(dev, cmd->ch, (float)cmd->val / VOLT_TO_MILIVOLT);
+	case RING_PULSES:
+		return odWritePulses(dev, cmd->ch, (unsigned int)cmd->val);
+	default:
+		return ERROR;
+	}
+}
+
+/**
+ * Execute the queued commands in order, consumer side, called with the bus
+ * locked
+ * Params:
+ * 	failed - incremented for every command failed
+ * Return the number of commands executed
+ */
+int ringDrain(RingShmType *r, int dev, uint32_t *failed)
+{
+	RingCmdType cmd;
+	uint32_t head = 0;
+	uint32_t done = 0;
+	int n = 0;
+
+	if (NULL == r)
+	{
+		return 0;
+	}
+	done = __atomic_load_n(&r->done, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	// a producer writing past the free slots loses the overwritten commands
+	if (head - done > RING_SLOTS)
+	{
+		done = head - RING_SLOTS;
+	}
+	while (done != head)
+	{
+		cmd = r->cmd[done & (RING_SLOTS - 1)];
+		if (OK != ringExec(dev, &cmd))
+		{
+			__atomic_store_n(&r->errors, r->errors + 1, __ATOMIC_RELAXED);
+			if (NULL != failed)
+			{
+				(*failed)++;
+			}
+		}
+		done++;
+		__atomic_store_n(&r->done, done, __ATOMIC_RELEASE);
+		n++;
+	}
+	return n;
+}
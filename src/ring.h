@@ -0,0 +1,58 @@
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define RING_MAGIC 0x474e4952 // "RING"
+#define RING_SLOTS 256 // commands, power of 2
+#define RING_NAME_MAX 32
+#define RING_LINE 64 // cache line, the producer and consumer indexes apart
+
+typedef enum
+{
+	RING_RELAY = 0, // val: relays mask
+	RING_GPIO, // val: gpio mask
+	RING_OD, // ch, val: duty cycle in 0.01%
+	RING_DAC, // ch, val: mV
+	RING_PULSES, // ch [1..8], val: pulses
+	RING_CMD_NR
+} RingCmdEnumType;
+
+typedef struct
+{
+	uint8_t type; // RingCmdEnumType
+	uint8_t ch;
+	uint16_t res;
+	int32_t val;
+} RingCmdType;
+
+/*
+ * Single producer single consumer command ring in shared memory, the indexes
+ * are free running counters. The producer writes head, the consumer writes
+ * done after executing each command.
+ */
+typedef struct
+{
+	uint32_t magic;
+	uint32_t slots;
+	uint16_t bus;
+	uint8_t stack;
+	uint8_t res[RING_LINE - 11];
+	uint32_t head; // commands written
+	uint8_t headPad[RING_LINE - 4];
+	uint32_t done; // commands executed
+	uint32_t errors; // commands failed
+	uint8_t donePad[RING_LINE - 8];
+	RingCmdType cmd[RING_SLOTS];
+} RingShmType;
+
+RingShmType* ringCreate(const char *name, int bus, int stack, uid_t uid,
+	gid_t gid);
+void ringDestroy(RingShmType *r, const char *name);
+RingShmType* ringMap(const char *name);
+void ringUnmap(RingShmType *r);
+int ringPut(RingShmType *r, const RingCmdType *cmd, uint32_t *seq);
+int ringDrain(RingShmType *r, int dev, uint32_t *failed);
+
+#endif //RING_H_
@@ -0,0 +1,433 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "scan.h"
+
+#ifndef PLCPI_CLI
+typedef struct
+{
+	u8 add;
+	u8 size;
+} ScanAreaType;
+
+// inputs and outputs, opto edge counters, gpio edge counters and encoders
+static const ScanAreaType gScanArea[] = { {I2C_MEM_RELAY_VAL_ADD,
+	I2C_MEM_OPTO_IT_RISING_ADD - I2C_MEM_RELAY_VAL_ADD}, {
+	I2C_MEM_OPTO_EDGE_COUNT_ADD,
+	I2C_MEM_OPTO_EDGE_COUNT_END_ADD - I2C_MEM_OPTO_EDGE_COUNT_ADD}, {
+	I2C_MEM_GPIO_EDGE_COUNT_ADD,
+	I2C_MEM_GPIO_ENC_COUNT_END_ADD - I2C_MEM_GPIO_EDGE_COUNT_ADD}};
+
+#define SCAN_AREA_NR (int)(sizeof(gScanArea) / sizeof(ScanAreaType))
+
+int scanInit(ScanImageType *img, int periodUs)
+{
+	if ( (NULL == img) || (periodUs < 0))
+	{
+		return ERROR;
+	}
+	memset(img, 0, sizeof(ScanImageType));
+	pthread_mutex_init(&img->lock, NULL);
+	img->periodUs = periodUs;
+	return OK;
+}
+
+/**
+ * Add an opened board to the image, the boards on a new adapter get a new worker
+ * Return the board index in the image
+ */
+int scanBoardAdd(ScanImageType *img, int bus, int stack, int dev)
+{
+	ScanBoardType *b = NULL;
+	int i = 0;
+
+	if ( (NULL == img) || img->run || (img->boards >= SCAN_BOARD_MAX))
+	{
+		return ERROR;
+	}
+	for (i = 0; i < img->workers; i++)
+	{
+		if (img->worker[i].bus == bus)
+		{
+			break;
+		}
+	}
+	if (i == img->workers)
+	{
+		if (img->workers >= SCAN_BUS_MAX)
+		{
+			return ERROR;
+		}
+		img->worker[i].img = img;
+		img->worker[i].bus = bus;
+		img->workers++;
+	}
+	b = &img->board[img->boards];
+	b->bus = bus;
+	b->stack = stack;
+	b->dev = dev;
+	return img->boards++;
+}
+
+/**
+ * Reload the watchdog of a board from its worker, every percent of the
+ * watchdog period, the caller holds the bus lock
+ */
+int scanBoardKaInit(ScanImageType *img, int idx, int percent)
+{
+	if ( (NULL == img) || img->run || (idx < 0) || (idx >= img->boards))
+	{
+		return ERROR;
+	}
+	if (OK != wdtKaInit(&img->ka[idx], img->board[idx].dev, percent, img->periodUs))
+	{
+		return ERROR;
+	}
+	img->board[idx].kaOn = 1;
+	img->board[idx].kaReloads = img->ka[idx].reloads;
+	return OK;
+}
+
+/**
+ * Read the scan areas of one board in an image indexed by I2C_MEM_ADD, all or
+ * nothing, a CONS_BLOCK policy on an area start address select double read
+ * snapshots
+ */
+int scanAreasRead(int dev, u8 *mem)
+{
+	int i = 0;
+
+	for (i = 0; i < SCAN_AREA_NR; i++)
+	{
+		if (OK
+			!= consRead(dev, gScanArea[i].add, &mem[gScanArea[i].add],
+				gScanArea[i].size, 0))
+		{
+			return ERROR;
+		}
+	}
+	return OK;
+}
+
+static void scanBoardMerge(ScanBoardType *b, const u8 *mem, uint64_t now)
+{
+	int i = 0;
+
+	for (i = 0; i < SCAN_AREA_NR; i++)
+	{
+		memcpy(&b->mem[gScanArea[i].add], &mem[gScanArea[i].add],
+			gScanArea[i].size);
+	}
+	b->stampUs = now;
+	b->scans++;
+}
+
+static void* scanWorker(void *arg)
+{
+	ScanWorkerType *w = (ScanWorkerType*)arg;
+	ScanImageType *img = w->img;
+	u8 mem[SCAN_BOARD_MAX][SCAN_MEM_SIZE];
+	int ret[SCAN_BOARD_MAX];
+	int kaRet[SCAN_BOARD_MAX];
+	uint64_t next = 0;
+	uint64_t start = 0;
+	uint64_t t0 = 0;
+	uint64_t now = 0;
+	u32 skipped = 0;
+	int i = 0;
+
+	w->startUs = getTimeUs();
+	next = w->startUs;
+	while (img->run)
+	{
+		start = getTimeUs();
+		// the transfers of one cycle in one bus session, the merge outside it
+		busLock(w->bus);
+		t0 = getTimeUs();
+		for (i = 0; i < img->boards; i++)
+		{
+			if (img->board[i].bus == w->bus)
+			{
+				ret[i] = scanAreasRead(img->board[i].dev, mem[i]);
+				// the watchdog reload, when due, share the scan bus session
+				kaRet[i] = img->board[i].kaOn ?
+					wdtKaService(&img->ka[i], getTimeUs()) : 0;
+			}
+		}
+		now = getTimeUs();
+		busUnlock(w->bus);
+
+		pthread_mutex_lock(&img->lock);
+		for (i = 0; i < img->boards; i++)
+		{
+			if (img->board[i].bus != w->bus)
+			{
+				continue;
+			}
+			if (ret[i] == OK)
+			{
+				scanBoardMerge(&img->board[i], mem[i], now);
+			}
+			else
+			{
+				img->board[i].errors++;
+			}
+			if (kaRet[i] == ERROR)
+			{
+				img->board[i].kaErrors++;
+			}
+			img->board[i].kaReloads = img->ka[i].reloads;
+		}
+		w->busUs += now - t0;
+		w->cycles++;
+		cycleStatAdd(&w->cyc, img->periodUs > 0 ? next : 0, start, now - t0,
+			getTimeUs());
+		pthread_mutex_unlock(&img->lock);
+
+		if (img->periodUs > 0)
+		{
+			next += (uint64_t)img->periodUs;
+			now = getTimeUs();
+			if (now > next)
+			{
+				// skip the missed periods, do not burst
+				skipped = (u32) ( (now - next) / (uint64_t)img->periodUs + 1);
+				w->overruns += skipped;
+				w->cyc.overruns += skipped;
+				next += (uint64_t)skipped * (uint64_t)img->periodUs;
+			}
+			sleepUntilUs(next);
+		}
+	}
+	w->endUs = getTimeUs();
+	return NULL;
+}
+
+/**
+ * Start one worker thread per adapter
+ */
+int scanStart(ScanImageType *img)
+{
+	int i = 0;
+
+	if ( (NULL == img) || img->run || (img->boards == 0))
+	{
+		return ERROR;
+	}
+	img->run = 1;
+	for (i = 0; i < img->workers; i++)
+	{
+		if (0 != pthread_create(&img->worker[i].thread, NULL, scanWorker,
+				&img->worker[i]))
+		{
+			scanStop(img);
+			return ERROR;
+		}
+		img->worker[i].started = 1;
+	}
+	return OK;
+}
+
+void scanStop(ScanImageType *img)
+{
+	int i = 0;
+
+	if (NULL == img)
+	{
+		return;
+	}
+	img->run = 0;
+	for (i = 0; i < img->workers; i++)
+	{
+		if (img->worker[i].started)
+		{
+			pthread_join(img->worker[i].thread, NULL);
+			img->worker[i].started = 0;
+		}
+	}
+}
+
+/**
+ * Consistent copy of one board image while the workers run
+ */
+int scanBoardGet(ScanImageType *img, int idx, ScanBoardType *board)
+{
+	if ( (NULL == img) || (NULL == board) || (idx < 0) || (idx >= img->boards))
+	{
+		return ERROR;
+	}
+	pthread_mutex_lock(&img->lock);
+	memcpy(board, &img->board[idx], sizeof(ScanBoardType));
+	pthread_mutex_unlock(&img->lock);
+	return OK;
+}
+
+int scanWorkerGet(ScanImageType *img, int idx, ScanWorkerType *worker)
+{
+	if ( (NULL == img) || (NULL == worker) || (idx < 0)
+		|| (idx >= img->workers))
+	{
+		return ERROR;
+	}
+	pthread_mutex_lock(&img->lock);
+	memcpy(worker, &img->worker[idx], sizeof(ScanWorkerType));
+	pthread_mutex_unlock(&img->lock);
+	return OK;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+static ScanImageType gScanImg;
+
+/**
+ * Scan a list of boards from several adapters for a while and display the
+ * throughput of every worker and the last image of every board
+ * Params: <bus:stack>[,<bus:stack>...] <period_ms> <seconds> [<wdt_percent>]
+ */
+int doScan(int argc, char *argv[])
+{
+	ScanImageType *img = &gScanImg;
+	ScanBoardType b;
+	ScanWorkerType w;
+	DevCtxType *ctx = NULL;
+	char *tok = NULL;
+	char *save = NULL;
+	int period = 0;
+	int seconds = 0;
+	int kaPercent = 0;
+	int idx = 0;
+	int ret = OK;
+	int bus = 0;
+	int stack = 0;
+	int dev = 0;
+	int i = 0;
+	float elapsed = 0;
+	float total = 0;
+	uint64_t now = 0;
+
+	if ( (argc != 5) && (argc != 6))
+	{
+		return ARG_CNT_ERR;
+	}
+	period = atoi(argv[3]);
+	seconds = atoi(argv[4]);
+	if ( (period < 0) || (seconds < 1))
+	{
+		printf("Invalid scan period or duration!\n");
+		return ARG_ERR;
+	}
+	if (argc == 6)
+	{
+		kaPercent = atoi(argv[5]);
+		if ( (kaPercent < 10) || (kaPercent > 90))
+		{
+			printf("Invalid watchdog reload percent, must be 10..90!\n");
+			return ARG_ERR;
+		}
+	}
+	scanInit(img, period * 1000);
+	// the workers take the locks of their own adapters
+	busUnlock(I2C_BUS_DEFAULT);
+	for (tok = strtok_r(argv[2], ",", &save); tok != NULL;
+		tok = strtok_r(NULL, ",", &save))
+	{
+		bus = I2C_BUS_DEFAULT;
+		if (OK != boardIdParse(tok, &bus, &stack))
+		{
+			printf("Invalid board id \"%s\", must be <stack> or <bus>:<stack>!\n",
+				tok);
+			busLock(I2C_BUS_DEFAULT);
+			return ARG_ERR;
+		}
+		busLock(bus);
+		dev = doBoardOpen(bus, stack);
+		busUnlock(bus);
+		if (dev <= 0)
+		{
+			busLock(I2C_BUS_DEFAULT);
+			return ERROR;
+		}
+		idx = scanBoardAdd(img, bus, stack, dev);
+		if (idx < 0)
+		{
+			printf("Too many boards or buses, max %d boards on %d buses!\n",
+			SCAN_BOARD_MAX, SCAN_BUS_MAX);
+			busLock(I2C_BUS_DEFAULT);
+			return ARG_ERR;
+		}
+		if (kaPercent > 0)
+		{
+			busLock(bus);
+			ret = scanBoardKaInit(img, idx, kaPercent);
+			busUnlock(bus);
+			if (OK != ret)
+			{
+				printf("Fail to start the watchdog keep alive of board %d:%d!\n",
+					bus, stack);
+				busLock(I2C_BUS_DEFAULT);
+				return ERROR;
+			}
+		}
+	}
+	if (OK != scanStart(img))
+	{
+		printf("Fail to start the scan!\n");
+		busLock(I2C_BUS_DEFAULT);
+		return ERROR;
+	}
+	sleep((unsigned int)seconds);
+	scanStop(img);
+	now = getTimeUs();
+
+	for (i = 0; i < img->workers; i++)
+	{
+		scanWorkerGet(img, i, &w);
+		elapsed = (float) (w.endUs - w.startUs) / 1000000;
+		printf(
+			"bus %d: %u cycles, %0.1f cycles/s, %u overruns, bus busy %0.1f%%\n",
+			w.bus, (unsigned int)w.cycles, (float)w.cycles / elapsed,
+			(unsigned int)w.overruns,
+			(float)w.busUs * 100 / (float) (w.endUs - w.startUs));
+		cycleStatPrint(stdout, &w.cyc);
+	}
+	for (i = 0; i < img->boards; i++)
+	{
+		scanBoardGet(img, i, &b);
+		ctx = devGet(b.dev);
+		total += (float)b.scans;
+		printf(
+			"board %d:%d: %u scans, %u errors, relays 0x%02x, opto 0x%02x, gpio 0x%02x, image age %0.1f ms\n",
+			b.bus, b.stack, (unsigned int)b.scans, (unsigned int)b.errors,
+			b.mem[I2C_MEM_RELAY_VAL_ADD], b.mem[I2C_MEM_OPTO_IN_ADD],
+			b.mem[I2C_MEM_GPIO_VAL_ADD],
+			b.scans ? (float) (now - b.stampUs) / 1000 : 0);
+		if (b.kaOn)
+		{
+			printf("  watchdog: %u reloads, %u errors\n",
+				(unsigned int)b.kaReloads, (unsigned int)b.kaErrors);
+		}
+		if ( (NULL != ctx) && (ctx->stat.errors > 0))
+		{
+			printf(
+				"  transfer errors: %u nack, %u timeout, %u bus, %u fd, %u other; suspended %u times, %u transfers skipped, %u recoveries\n",
+				(unsigned int)ctx->stat.err[DEV_ERR_NACK],
+				(unsigned int)ctx->stat.err[DEV_ERR_TIMEOUT],
+				(unsigned int)ctx->stat.err[DEV_ERR_BUS],
+				(unsigned int)ctx->stat.err[DEV_ERR_FD],
+				(unsigned int)ctx->stat.err[DEV_ERR_OTHER],
+				(unsigned int)ctx->stat.trips, (unsigned int)ctx->stat.skipped,
+				(unsigned int)ctx->stat.recoveries);
+		}
+	}
+	printf("%0.1f board scans/s\n", total / (float)seconds);
+	busLock(I2C_BUS_DEFAULT);
+	return OK;
+}
+#endif // PLCPI_LIB
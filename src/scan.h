@@ -0,0 +1,70 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "plcpi.h"
+#include "hist.h"
+
+#define SCAN_BOARD_MAX 32
+#define SCAN_BUS_MAX 8 // adapters scanned in parallel, one worker thread each
+#define SCAN_MEM_SIZE (SLAVE_BUFF_SIZE + 1)
+
+typedef struct
+{
+	int bus;
+	int stack;
+	int dev;
+	u8 mem[SCAN_MEM_SIZE]; // register image indexed by I2C_MEM_ADD, scanned areas only
+	uint64_t stampUs; // end of the last successful scan
+	u32 scans;
+	u32 errors;
+	int kaOn; // watchdog reloaded by the worker, in the scan bus session
+	u32 kaReloads;
+	u32 kaErrors;
+} ScanBoardType;
+
+struct ScanImage;
+
+typedef struct
+{
+	struct ScanImage *img;
+	int bus;
+	int started;
+	pthread_t thread;
+	u32 cycles;
+	u32 overruns; // periods skipped, a cycle ended after their start
+	uint64_t busUs; // time spent holding the bus
+	uint64_t startUs;
+	uint64_t endUs;
+	CycleStatType cyc;
+} ScanWorkerType;
+
+/*
+ * Process image shared by the workers, every worker scan the boards of one
+ * adapter and merge its results under the image lock
+ */
+typedef struct ScanImage
+{
+	pthread_mutex_t lock;
+	ScanBoardType board[SCAN_BOARD_MAX];
+	int boards;
+	ScanWorkerType worker[SCAN_BUS_MAX];
+	int workers;
+	WdtKaType ka[SCAN_BOARD_MAX]; // keep alive of the boards, worker threads only
+	int periodUs; // 0 scan continuously
+	volatile int run;
+} ScanImageType;
+
+int scanInit(ScanImageType *img, int periodUs);
+int scanAreasRead(int dev, u8 *mem);
+int scanBoardAdd(ScanImageType *img, int bus, int stack, int dev);
+int scanBoardKaInit(ScanImageType *img, int idx, int percent);
+int scanStart(ScanImageType *img);
+void scanStop(ScanImageType *img);
+int scanBoardGet(ScanImageType *img, int idx, ScanBoardType *board);
+int scanWorkerGet(ScanImageType *img, int idx, ScanWorkerType *worker);
+int doScan(int argc, char *argv[]);
+
+#endif //SCAN_H_
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "sub.h"
+
+/*
+ * Change subscriptions evaluated against a board image indexed by
+ * I2C_MEM_ADD. Every filter remembers the last value sent, a new scan queues
+ * an event only for the channels in the mask of a bit signal or for a value
+ * signal moved by at least the deadband. The queue of every subscriber is
+ * bounded, a subscriber that does not read loses its old events or gets only
+ * the last value of every signal, the scan never waits for it.
+ */
+
+typedef struct
+{
+	const char *name;
+	u8 add; // channel 1 address
+	u8 size; // bytes per channel
+	u8 isSigned;
+	u8 channels; // 0 for a bit signal
+} SubSigDefType;
+
+static const SubSigDefType gSubSig[SUB_SIG_NR] = {
+	{"relay", I2C_MEM_RELAY_VAL_ADD, 1, 0, 0},
+	{"opto", I2C_MEM_OPTO_IN_ADD, 1, 0, 0},
+	{"gpio", I2C_MEM_GPIO_VAL_ADD, 1, 0, 0},
+	{"adc", I2C_MEM_ADC_VAL_MV_ADD, ADC_RAW_VAL_SIZE, 0, ADC_CH_NO},
+	{"optocnt", I2C_MEM_OPTO_EDGE_COUNT_ADD, COUNTER_SIZE, 0, OPTO_CH_NO},
+	{"gpiocnt", I2C_MEM_GPIO_EDGE_COUNT_ADD, COUNTER_SIZE, 0, GPIO_CH_NO},
+	{"optoenc", I2C_MEM_OPTO_ENC_COUNT_ADD, COUNTER_SIZE, 1, OPTO_CH_NO / 2},
+	{"gpioenc", I2C_MEM_GPIO_ENC_COUNT_ADD, COUNTER_SIZE, 1, GPIO_CH_NO / 2}};
+
+const char* subSigName(int sig)
+{
+	if ( (sig < 0) || (sig >= SUB_SIG_NR))
+	{
+		return "?";
+	}
+	return gSubSig[sig].name;
+}
+
+int subSigParse(const char *name)
+{
+	int i = 0;
+
+	for (i = 0; i < SUB_SIG_NR; i++)
+	{
+		if (strcasecmp(name, gSubSig[i].name) == 0)
+		{
+			return i;
+		}
+	}
+	return ERROR;
+}
+
+/**
+ * Channels of a value signal, 0 for a bit signal
+ */
+int subSigChannels(int sig)
+{
+	if ( (sig < 0) || (sig >= SUB_SIG_NR))
+	{
+		return 0;
+	}
+	return gSubSig[sig].channels;
+}
+
+void subInit(SubType *s)
+{
+	memset(s, 0, sizeof(SubType));
+}
+
+/**
+ * Add a filter
+ * Params:
+ * 	ch - channel of a value signal, ignored for a bit signal
+ * 	arg - channel mask of a bit signal, deadband of a value signal
+ * Return the filter index
+ */
+int subFilterAdd(SubType *s, int board, int sig, int ch, u32 arg)
+{
+	SubFilterType *f = NULL;
+
+	if ( (NULL == s) || (s->filters >= SUB_FILTER_MAX) || (board < 0)
+		|| (board > 255) || (sig < 0) || (sig >= SUB_SIG_NR))
+	{
+		return ERROR;
+	}
+	if ( (gSubSig[sig].channels > 0)
+		&& ( (ch < 1) || (ch > gSubSig[sig].channels)))
+	{
+		return ERROR;
+	}
+	f = &s->filter[s->filters];
+	memset(f, 0, sizeof(SubFilterType));
+	f->board = (u8)board;
+	f->sig = (u8)sig;
+	if (gSubSig[sig].channels > 0)
+	{
+		f->ch = (u8)ch;
+		f->deadband = arg;
+	}
+	else
+	{
+		f->mask = arg & 0xff;
+	}
+	return s->filters++;
+}
+
+static int32_t subDecode(const SubFilterType *f, const u8 *mem)
+{
+	const SubSigDefType *d = &gSubSig[f->sig];
+	int add = d->add + (f->ch > 0 ? (f->ch - 1) * d->size : 0);
+	uint16_t v16 = 0;
+	uint32_t v32 = 0;
+
+	switch (d->size)
+	{
+	case 1:
+		return (int32_t) (mem[add] & f->mask);
+	case 2:
+		memcpy(&v16, &mem[add], 2);
+		return d->isSigned ? (int32_t) (int16_t)v16 : (int32_t)v16;
+	default:
+		memcpy(&v32, &mem[add], 4);
+		return (int32_t)v32;
+	}
+}
+
+static void subPush(SubType *s, const SubEventType *ev)
+{
+	SubEventType *q = NULL;
+	int i = 0;
+
+	if (s->policy == SUB_COALESCE)
+	{
+		for (i = 0; i < s->count; i++)
+		{
+			q = &s->q[(s->head + i) % SUB_QUEUE_SIZE];
+			if ( (q->board == ev->board) && (q->sig == ev->sig)
+				&& (q->ch == ev->ch))
+			{
+				*q = *ev;
+				s->coalesced++;
+				return;
+			}
+		}
+	}
+	if (s->count == SUB_QUEUE_SIZE)
+	{
+		s->head = (s->head + 1) % SUB_QUEUE_SIZE;
+		s->count--;
+		s->dropped++;
+	}
+	s->q[(s->head + s->count) % SUB_QUEUE_SIZE] = *ev;
+	s->count++;
+	s->events++;
+}
+
+/**
+ * Evaluate the filters of one board against its new image
+ * Return the number of events queued
+ */
+int subEval(SubType *s, int board, const u8 *mem, uint64_t us)
+{
+	SubFilterType *f = NULL;
+	SubEventType ev;
+	int32_t val = 0;
+	int64_t diff = 0;
+	int n = 0;
+	int i = 0;
+
+	if ( (NULL == s) || (NULL == mem))
+	{
+		return 0;
+	}
+	for (i = 0; i < s->filters; i++)
+	{
+		f = &s->filter[i];
+		if (f->board != board)
+		{
+			continue;
+		}
+		val = subDecode(f, mem);
+		if (f->valid)
+		{
+			diff = (int64_t)val - (int64_t)f->last;
+			if (gSubSig[f->sig].channels == 0)
+			{
+				if (diff == 0)
+				{
+					continue;
+				}
+			}
+			else if ( (diff == 0)
+				|| ( (diff < 0 ? -diff : diff) < (int64_t)f->deadband))
+			{
+				continue;
+			}
+		}
+		// the first scan sends the initial value
+		f->last = val;
+		f->valid = 1;
+		ev.us = us;
+		ev.board = f->board;
+		ev.sig = f->sig;
+		ev.ch = f->ch;
+		ev.val = val;
+		subPush(s, &ev);
+		n++;
+	}
+	return n;
+}
+
+/**
+ * Oldest queued event, return ERROR if none
+ */
+int subPop(SubType *s, SubEventType *ev)
+{
+	if ( (NULL == s) || (NULL == ev) || (s->count == 0))
+	{
+		return ERROR;
+	}
+	*ev = s->q[s->head];
+	s->head = (s->head + 1) % SUB_QUEUE_SIZE;
+	s->count--;
+	return OK;
+}
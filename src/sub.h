@@ -0,0 +1,71 @@
+#ifndef SUB_H_
+#define SUB_H_
+
+#include <stdint.h>
+
+#include "plcpi.h"
+
+#define SUB_FILTER_MAX 16 // filters per subscriber
+#define SUB_QUEUE_SIZE 64 // events waiting per subscriber
+
+typedef enum
+{
+	SUB_SIG_RELAY = 0, // bit signals, filtered by a channel mask
+	SUB_SIG_OPTO,
+	SUB_SIG_GPIO,
+	SUB_SIG_ADC, // value signals, filtered by a deadband
+	SUB_SIG_OPTO_CNT,
+	SUB_SIG_GPIO_CNT,
+	SUB_SIG_OPTO_ENC,
+	SUB_SIG_GPIO_ENC,
+	SUB_SIG_NR
+} SubSigEnumType;
+
+typedef enum
+{
+	SUB_DROP_OLDEST = 0, // a full queue drop its oldest event
+	SUB_COALESCE, // a new value replace the queued one of the same signal
+} SubPolicyEnumType;
+
+typedef struct
+{
+	u8 board; // index in the owner board table
+	u8 sig; // SubSigEnumType
+	u8 ch; // channel of the value signals, 0 for the bit signals
+	u8 valid; // last holds the last value sent
+	u32 mask; // bit signals: channels watched
+	u32 deadband; // value signals: minimum change sent, 0 for every change
+	int32_t last;
+} SubFilterType;
+
+typedef struct
+{
+	uint64_t us; // image time stamp
+	u8 board;
+	u8 sig;
+	u8 ch;
+	int32_t val;
+} SubEventType;
+
+typedef struct
+{
+	SubFilterType filter[SUB_FILTER_MAX];
+	int filters;
+	u8 policy; // SubPolicyEnumType
+	SubEventType q[SUB_QUEUE_SIZE];
+	int head;
+	int count;
+	u32 events; // events queued
+	u32 dropped;
+	u32 coalesced;
+} SubType;
+
+const char* subSigName(int sig);
+int subSigParse(const char *name);
+int subSigChannels(int sig);
+void subInit(SubType *s);
+int subFilterAdd(SubType *s, int board, int sig, int ch, u32 arg);
+int subEval(SubType *s, int board, const u8 *mem, uint64_t us);
+int subPop(SubType *s, SubEventType *ev);
+
+#endif //SUB_H_
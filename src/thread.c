@@ -2,10 +2,13 @@
 #include <string.h>
 #include <termios.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 
 #include "thread.h"
 
 
+#ifndef PLCPI_LIB
 static pthread_mutex_t piMutexes [4];
 
 int piHiPri (const int pri);
@@ -90,7 +93,9 @@ int checkThreadResult(void)
 	pthread_mutex_unlock(&piMutexes[COUNT_KEY]);
 	return res;
 }
+#endif // PLCPI_LIB
 
+#ifndef PLCPI_CLI
 /*
  * busyWait:
  *	Wait for some number of milliseconds
@@ -106,3 +111,52 @@ void busyWait(int ms)
 
   nanosleep (&sleeper, &dummy) ;
 }
+
+/*
+ * busyWaitUs:
+ *	Wait for some number of microseconds
+ *********************************************************************************
+ */
+
+void busyWaitUs(int us)
+{
+  struct timespec sleeper, dummy ;
+
+  sleeper.tv_sec  = (time_t)(us / 1000000) ;
+  sleeper.tv_nsec = (long)(us % 1000000) * 1000 ;
+
+  nanosleep (&sleeper, &dummy) ;
+}
+
+/*
+ * getTimeUs:
+ *	Monotonic time stamp in microseconds
+ *********************************************************************************
+ */
+
+uint64_t getTimeUs(void)
+{
+  struct timespec ts ;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts) ;
+  return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)(ts.tv_nsec / 1000) ;
+}
+
+/*
+ * sleepUntilUs:
+ *	Sleep until an absolute getTimeUs() time stamp, periodic loops using
+ *	absolute deadlines do not accumulate the loop execution time
+ *********************************************************************************
+ */
+
+void sleepUntilUs(uint64_t ts)
+{
+  struct timespec deadline ;
+
+  deadline.tv_sec  = (time_t)(ts / 1000000) ;
+  deadline.tv_nsec = (long)(ts % 1000000) * 1000 ;
+
+  while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+    ;
+}
+#endif // PLCPI_CLI
@@ -8,8 +8,12 @@
 
 #define	PI_THREAD(X)	void *X (UNU void *dummy)
 
+#include <stdint.h>
 
 void busyWait(int ms);
+void busyWaitUs(int us);
+uint64_t getTimeUs(void);
+void sleepUntilUs(uint64_t ts);
 void startThread(void);
 int checkThreadResult(void);
 
@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+#include "trace.h"
+
+/*
+ * I2C transaction tracer, off by default. Every transaction of comm.c is
+ * recorded in a ring without locks: the writers reserve a slot with an atomic
+ * increment and publish it with a sequence number, the dump skip the slots
+ * being written. The latency of every transaction is also added to the
+ * histogram of its first register, the histograms are never overwritten.
+ *
+ * Trace file: TraceHdrType, the records oldest first, the TRACE_REG_NR
+ * register histograms
+ */
+
+#define TRACE_MAGIC 0x45435254 // "TRCE"
+#define TRACE_VERSION 1
+
+typedef struct
+{
+	u32 magic;
+	u16 version;
+	u16 recSize;
+	u16 regSize;
+	u16 regNr;
+	u32 count; // records in the file
+	u32 lost; // records overwritten or being written at dump time
+	uint64_t startUs;
+	uint64_t dumpUs;
+} TraceHdrType;
+
+#ifndef PLCPI_CLI
+typedef struct
+{
+	uint64_t seq; // record index + 1 when published, 0 while written
+	TraceRecType rec;
+} TraceSlotType;
+
+int gTraceOn = 0;
+static uint64_t gTraceHead = 0;
+static uint64_t gTraceStartUs = 0;
+static TraceSlotType gTraceRing[TRACE_RING_SIZE];
+static TraceRegType gTraceReg[TRACE_REG_NR];
+static pthread_once_t gTraceOnce = PTHREAD_ONCE_INIT;
+static const char *gTraceFile = NULL;
+
+/**
+ * Clear the ring and the histograms and start recording, call it while the
+ * bus is idle
+ */
+void traceStart(void)
+{
+	__atomic_store_n(&gTraceOn, 0, __ATOMIC_SEQ_CST);
+	memset(gTraceRing, 0, sizeof(gTraceRing));
+	memset(gTraceReg, 0, sizeof(gTraceReg));
+	gTraceHead = 0;
+	gTraceStartUs = getTimeUs();
+	__atomic_store_n(&gTraceOn, 1, __ATOMIC_SEQ_CST);
+}
+
+void traceStop(void)
+{
+	__atomic_store_n(&gTraceOn, 0, __ATOMIC_SEQ_CST);
+}
+
+static void traceExit(void)
+{
+	traceDump(gTraceFile);
+}
+
+static void traceEnv(void)
+{
+	const char *path = envGet(TRACE_ENV);
+
+	if ( (NULL == path) || (0 == *path))
+	{
+		return;
+	}
+	gTraceFile = path;
+	traceStart();
+	atexit(traceExit);
+}
+
+/**
+ * Start the trace once per process if PLCPI_TRACE name a trace file, the
+ * file is written at exit. The variable is ignored when plcpi runs setuid
+ */
+void traceEnvInit(void)
+{
+	pthread_once(&gTraceOnce, traceEnv);
+}
+
+static void traceRegAdd(TraceRegType *r, uint32_t durUs, int err)
+{
+	uint32_t max = __atomic_load_n(&r->maxUs, __ATOMIC_RELAXED);
+
+	__atomic_fetch_add(&r->bucket[histBucket(durUs)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&r->count, 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&r->sumUs, durUs, __ATOMIC_RELAXED);
+	if (err)
+	{
+		__atomic_fetch_add(&r->errors, 1, __ATOMIC_RELAXED);
+	}
+	while ( (durUs > max)
+		&& !__atomic_compare_exchange_n(&r->maxUs, &max, durUs, 1,
+			__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * Record one transaction
+ * Params:
+ * 	startUs - getTimeUs() before the transaction
+ * 	err - errno of the failed transaction, 0 on success
+ */
+void traceAdd(int dev, int reg, int len, int dir, uint64_t startUs, int err)
+{
+	DevCtxType *ctx = devGet(dev);
+	TraceSlotType *s = NULL;
+	uint64_t idx = 0;
+	uint32_t durUs = (uint32_t) (getTimeUs() - startUs);
+
+	if (!traceOn())
+	{
+		return;
+	}
+	traceRegAdd(&gTraceReg[reg & 0xff], durUs, err);
+
+	idx = __atomic_fetch_add(&gTraceHead, 1, __ATOMIC_RELAXED);
+	s = &gTraceRing[idx & (TRACE_RING_SIZE - 1)];
+	__atomic_store_n(&s->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	s->rec.us = startUs;
+	s->rec.durUs = durUs;
+	s->rec.len = (uint16_t)len;
+	s->rec.bus = ctx ? (uint8_t)ctx->bus : 0xff;
+	s->rec.addr = ctx ? (uint8_t)ctx->addr : 0xff;
+	s->rec.reg = (uint8_t)reg;
+	s->rec.dir = (uint8_t)dir;
+	s->rec.err = (int16_t)err;
+	__atomic_store_n(&s->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Copy of the histogram of the transactions starting at a register
+ */
+int traceRegGet(int reg, TraceRegType *r)
+{
+	if ( (NULL == r) || (reg < 0) || (reg >= TRACE_REG_NR))
+	{
+		return ERROR;
+	}
+	memcpy(r, &gTraceReg[reg], sizeof(TraceRegType));
+	return OK;
+}
+
+/**
+ * Write the ring and the histograms in a trace file, the recording goes on
+ */
+int traceDump(const char *path)
+{
+	TraceHdrType hdr;
+	TraceRecType rec;
+	TraceSlotType *s = NULL;
+	uint64_t head = 0;
+	uint64_t idx = 0;
+	uint64_t seq = 0;
+	uid_t euid = 0;
+	int fd = -1;
+	int ret = OK;
+
+	if (NULL == path)
+	{
+		return ERROR;
+	}
+	// the file is written with the rights of the user, never through a link
+	euid = privDrop();
+	if (euid == (uid_t)-1)
+	{
+		return ERROR;
+	}
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+	if ( (privRestore(euid) != OK) && (fd >= 0))
+	{
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0)
+	{
+		return ERROR;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.recSize = sizeof(TraceRecType);
+	hdr.regSize = sizeof(TraceRegType);
+	hdr.regNr = TRACE_REG_NR;
+	hdr.startUs = gTraceStartUs;
+	hdr.dumpUs = getTimeUs();
+	head = __atomic_load_n(&gTraceHead, __ATOMIC_ACQUIRE);
+	idx = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+	hdr.lost = (u32)idx;
+	// the header is written again with the final counts
+	if (lseek(fd, sizeof(hdr), SEEK_SET) < 0)
+	{
+		close(fd);
+		return ERROR;
+	}
+	for (; idx < head; idx++)
+	{
+		s = &gTraceRing[idx & (TRACE_RING_SIZE - 1)];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		memcpy(&rec, &s->rec, sizeof(rec));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if ( (seq != idx + 1) || (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq))
+		{
+			hdr.lost++;
+			continue;
+		}
+		if (sizeof(rec) != write(fd, &rec, sizeof(rec)))
+		{
+			ret = ERROR;
+			break;
+		}
+		hdr.count++;
+	}
+	if ( (ret != OK)
+		|| (sizeof(gTraceReg) != write(fd, gTraceReg, sizeof(gTraceReg)))
+		|| (sizeof(hdr) != pwrite(fd, &hdr, sizeof(hdr), 0)))
+	{
+		ret = ERROR;
+	}
+	close(fd);
+	return ret;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+static const char *gTraceDir[] = {"rd", "wr", "wr+rd"};
+
+/**
+ * Registers sorted by the bus time they used, descending
+ */
+static void traceSort(TraceRegType *reg, int *order)
+{
+	int i = 0;
+	int j = 0;
+	int k = 0;
+
+	for (i = 0; i < TRACE_REG_NR; i++)
+	{
+		order[i] = i;
+	}
+	for (i = 1; i < TRACE_REG_NR; i++)
+	{
+		k = order[i];
+		for (j = i; (j > 0) && (reg[order[j - 1]].sumUs < reg[k].sumUs); j--)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = k;
+	}
+}
+
+/**
+ * Display a trace file: the registers that use the bus most and the last
+ * recorded transactions
+ * Params: <file> [<records>]
+ */
+int doTrace(int argc, char *argv[])
+{
+	static TraceRegType reg[TRACE_REG_NR];
+	int order[TRACE_REG_NR];
+	TraceHdrType hdr;
+	TraceRecType rec;
+	TraceRegType *r = NULL;
+	HistType h;
+	uint64_t total = 0;
+	int show = 0;
+	int fd = -1;
+	u32 i = 0;
+
+	if ( (argc != 3) && (argc != 4))
+	{
+		return ARG_CNT_ERR;
+	}
+	if (argc == 4)
+	{
+		show = atoi(argv[3]);
+		if (show < 0)
+		{
+			printf("Invalid records number!\n");
+			return ARG_ERR;
+		}
+	}
+	fd = open(argv[2], O_RDONLY);
+	if ( (fd < 0)
+		|| (sizeof(TraceHdrType) != pread(fd, &hdr, sizeof(TraceHdrType), 0))
+		|| (hdr.magic != TRACE_MAGIC) || (hdr.version != TRACE_VERSION)
+		|| (hdr.recSize != sizeof(TraceRecType))
+		|| (hdr.regSize != sizeof(TraceRegType)) || (hdr.regNr != TRACE_REG_NR)
+		|| (sizeof(reg)
+			!= pread(fd, reg, sizeof(reg),
+				(off_t) (sizeof(TraceHdrType) + (size_t)hdr.count * hdr.recSize))))
+	{
+		printf("Invalid trace file \"%s\"!\n", argv[2]);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return ERROR;
+	}
+	for (i = 0; i < TRACE_REG_NR; i++)
+	{
+		total += reg[i].sumUs;
+	}
+	printf("%u records, %u lost, trace span %0.3f s, bus busy %0.3f s\n",
+		(unsigned int)hdr.count, (unsigned int)hdr.lost,
+		(double) (hdr.dumpUs - hdr.startUs) / 1000000, (double)total / 1000000);
+	traceSort(reg, order);
+	printf("reg    count   errors   bus time    mean     p50     p99     max (us)\n");
+	for (i = 0; i < TRACE_REG_NR; i++)
+	{
+		r = &reg[order[i]];
+		if (r->count == 0)
+		{
+			break;
+		}
+		memset(&h, 0, sizeof(h));
+		memcpy(h.bucket, r->bucket, sizeof(h.bucket));
+		h.count = r->count;
+		h.max = r->maxUs;
+		h.sum = r->sumUs;
+		printf("0x%02x %7u %8u %9.1f%% %7.0f %7u %7u %7u\n", order[i],
+			(unsigned int)r->count, (unsigned int)r->errors,
+			total ? (double)r->sumUs * 100 / (double)total : 0,
+			(double)r->sumUs / r->count, histPercentile(&h, 50),
+			histPercentile(&h, 99), (unsigned int)r->maxUs);
+	}
+	if ((u32)show > hdr.count)
+	{
+		show = (int)hdr.count;
+	}
+	for (i = hdr.count - (u32)show; i < hdr.count; i++)
+	{
+		if (sizeof(rec)
+			!= pread(fd, &rec, sizeof(rec),
+				(off_t) (sizeof(TraceHdrType) + (size_t)i * hdr.recSize)))
+		{
+			break;
+		}
+		printf("%12.3f ms bus %u addr 0x%02x reg 0x%02x %-5s %4u bytes %6u us %s\n",
+			(double) (rec.us - hdr.startUs) / 1000, rec.bus, rec.addr, rec.reg,
+			rec.dir < 3 ? gTraceDir[rec.dir] : "?", rec.len,
+			(unsigned int)rec.durUs, rec.err ? strerror(rec.err) : "");
+	}
+	close(fd);
+	return OK;
+}
+#endif // PLCPI_LIB
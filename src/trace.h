@@ -0,0 +1,59 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <stdint.h>
+
+#include "hist.h"
+
+#define TRACE_RING_SIZE 4096 // records, power of 2
+#define TRACE_REG_NR 256
+#define TRACE_ENV "PLCPI_TRACE" // trace file written at exit when set
+
+typedef enum
+{
+	TRACE_READ = 0,
+	TRACE_WRITE,
+	TRACE_WRITE_READ, // write and read back in one transaction
+} TraceDirType;
+
+typedef struct
+{
+	uint64_t us; // transaction start
+	uint32_t durUs;
+	uint16_t len; // data bytes, register addresses excluded
+	uint8_t bus;
+	uint8_t addr; // slave address
+	uint8_t reg; // first register
+	uint8_t dir; // TraceDirType
+	int16_t err; // errno, 0 on success
+} TraceRecType;
+
+/*
+ * Latency histogram of the transactions starting at one register, the
+ * buckets are the hist.c ones
+ */
+typedef struct
+{
+	uint32_t bucket[HIST_BUCKETS];
+	uint32_t count;
+	uint32_t errors;
+	uint32_t maxUs;
+	uint64_t sumUs;
+} TraceRegType;
+
+extern int gTraceOn;
+
+static inline int traceOn(void)
+{
+	return __atomic_load_n(&gTraceOn, __ATOMIC_RELAXED);
+}
+
+void traceEnvInit(void);
+void traceStart(void);
+void traceStop(void);
+void traceAdd(int dev, int reg, int len, int dir, uint64_t startUs, int err);
+int traceDump(const char *path);
+int traceRegGet(int reg, TraceRegType *r);
+int doTrace(int argc, char *argv[]);
+
+#endif //TRACE_H_
@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "comm.h"
+#include "plcpi.h"
+
+/*
+ * Register transaction groups: the register accesses queued between txInit()
+ * and txCommit() are merged in the largest contiguous blocks and executed in
+ * as few I2C transactions as possible. All the writes are executed before the
+ * reads, so a read see the values written in the same group. The write blocks
+ * are chained in one I2C transaction, every read block is a transaction of its
+ * own (an address write and a read, the read message must be the last one on
+ * most adapters); the caller holds the bus lock for the whole commit.
+ */
+
+void txInit(TxType *tx, int dev)
+{
+	if (NULL == tx)
+	{
+		return;
+	}
+	memset(tx, 0, sizeof(TxType));
+	tx->dev = dev;
+}
+
+static int txQueue(TxType *tx, int isRead, int add, u8 *buff, int size)
+{
+	TxOpType *op = NULL;
+
+	if ( (NULL == tx) || (NULL == buff) || (add < 0) || (size < 1)
+		|| (add + size > TX_MEM_SIZE) || (tx->count >= TX_OP_MAX))
+	{
+		return ERROR;
+	}
+	op = &tx->op[tx->count];
+	op->isRead = (u8)isRead;
+	op->add = (u8)add;
+	op->size = (u16)size;
+	op->buff = isRead ? buff : NULL;
+	if (isRead)
+	{
+		memset(&tx->rdMask[add], 1, size);
+	}
+	else
+	{
+		memcpy(&tx->wrVal[add], buff, size);
+		memset(&tx->wrMask[add], 1, size);
+	}
+	return tx->count++;
+}
+
+/**
+ * Queue a register write, the data is copied
+ * Return the operation index
+ */
+int txWrite(TxType *tx, int add, const u8 *buff, int size)
+{
+	return txQueue(tx, 0, add, (u8*)buff, size);
+}
+
+/**
+ * Queue a register read, buff is filled on commit
+ * Return the operation index
+ */
+int txRead(TxType *tx, int add, u8 *buff, int size)
+{
+	return txQueue(tx, 1, add, buff, size);
+}
+
+static int txBlocksGet(const u8 *mask, u8 *val, I2cBlockType *blk)
+{
+	int count = 0;
+	int add = 0;
+
+	for (add = 0; add < TX_MEM_SIZE; add++)
+	{
+		if (!mask[add])
+		{
+			continue;
+		}
+		if ( (count > 0) && (blk[count - 1].add + blk[count - 1].size == add))
+		{
+			blk[count - 1].size++;
+			continue;
+		}
+		blk[count].add = add;
+		blk[count].buff = &val[add];
+		blk[count].size = 1;
+		count++;
+	}
+	return count;
+}
+
+/**
+ * Execute the blocks, as many writes as fit in one I2C transaction at a time,
+ * the reads one block per transaction
+ * Params:
+ * 	done - set for every byte transferred
+ */
+static int txTransfer(TxType *tx, int isRead, I2cBlockType *blk, int count,
+	u8 *done)
+{
+	int first = 0;
+	int n = 0;
+	int bytes = 0;
+	int i = 0;
+	int ret = OK;
+
+	while (first < count)
+	{
+		n = 0;
+		bytes = 0;
+		while ( (first + n < count) && (n < (isRead ? 1 : I2C_BLOCKS_MAX))
+			&& (bytes + blk[first + n].size + 1 <= I2C_BLOCKS_SIZE_MAX))
+		{
+			bytes += blk[first + n].size + 1;
+			n++;
+		}
+		tx->xfers++;
+		if (OK
+			== (isRead ? i2cMem8ReadBlocks(tx->dev, &blk[first], n) :
+				i2cMem8WriteBlocks(tx->dev, &blk[first], n)))
+		{
+			for (i = first; i < first + n; i++)
+			{
+				memset(&done[blk[i].add], 1, blk[i].size);
+			}
+		}
+		else
+		{
+			ret = ERROR;
+		}
+		first += n;
+	}
+	return ret;
+}
+
+static int txOpDone(const u8 *done, TxOpType *op)
+{
+	int i = 0;
+
+	for (i = op->add; i < op->add + op->size; i++)
+	{
+		if (!done[i])
+		{
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Execute the queued operations, the group is empty after the commit
+ * Params:
+ * 	result - OK or ERROR for every queued operation, can be NULL
+ * Return OK if all the operations succeeded
+ */
+int txCommit(TxType *tx, int *result)
+{
+	I2cBlockType blk[TX_MEM_SIZE / 2 + 1];
+	u8 rdVal[TX_MEM_SIZE];
+	u8 wrDone[TX_MEM_SIZE];
+	u8 rdDone[TX_MEM_SIZE];
+	TxOpType *op = NULL;
+	int count = 0;
+	int ret = OK;
+	int i = 0;
+
+	if (NULL == tx)
+	{
+		return ERROR;
+	}
+	memset(wrDone, 0, sizeof(wrDone));
+	memset(rdDone, 0, sizeof(rdDone));
+	tx->xfers = 0;
+
+	count = txBlocksGet(tx->wrMask, tx->wrVal, blk);
+	txTransfer(tx, 0, blk, count, wrDone);
+	count = txBlocksGet(tx->rdMask, rdVal, blk);
+	txTransfer(tx, 1, blk, count, rdDone);
+
+	for (i = 0; i < tx->count; i++)
+	{
+		op = &tx->op[i];
+		if (txOpDone(op->isRead ? rdDone : wrDone, op))
+		{
+			if (op->isRead)
+			{
+				memcpy(op->buff, &rdVal[op->add], op->size);
+			}
+			if (result)
+			{
+				result[i] = OK;
+			}
+			continue;
+		}
+		if (result)
+		{
+			result[i] = ERROR;
+		}
+		ret = ERROR;
+	}
+
+	// keep the output shadows in step with the registers
+	if (wrDone[I2C_MEM_RELAY_VAL_ADD])
+	{
+		devShadowSet(tx->dev, DEV_SHADOW_RELAY, tx->wrVal[I2C_MEM_RELAY_VAL_ADD]);
+	}
+	if (wrDone[I2C_MEM_GPIO_VAL_ADD])
+	{
+		devShadowSet(tx->dev, DEV_SHADOW_GPIO, tx->wrVal[I2C_MEM_GPIO_VAL_ADD]);
+	}
+	if (rdDone[I2C_MEM_RELAY_VAL_ADD])
+	{
+		devShadowSet(tx->dev, DEV_SHADOW_RELAY, rdVal[I2C_MEM_RELAY_VAL_ADD]);
+	}
+	if (rdDone[I2C_MEM_GPIO_VAL_ADD])
+	{
+		devShadowSet(tx->dev, DEV_SHADOW_GPIO, rdVal[I2C_MEM_GPIO_VAL_ADD]);
+	}
+
+	count = tx->xfers;
+	txInit(tx, tx->dev);
+	tx->xfers = count;
+	return ret;
+}
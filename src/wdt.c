@@ -0,0 +1,439 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "comm.h"
+#include "plcpi.h"
+#include "thread.h"
+
+#define WDT_KA_DEFAULT_PERCENT 50
+#define WDT_KA_JITTER_PERCENT 10 // spread the reloads of many boards
+#define WDT_KA_REFRESH 16 // re-read the period and reset count every this many reloads
+
+#ifndef PLCPI_CLI
+int wdtReload(int dev)
+{
+	u8 buff[1] = {WDT_RESET_SIGNATURE};
+
+	return i2cMem8Write(dev, I2C_MEM_WDT_RESET_ADD, buff, 1);
+}
+
+static int wdtWordSet(int dev, int add, int val)
+{
+	u8 buff[2];
+	u16 raw = 0;
+
+	if ( (val < 0) || (val > WDT_PERIOD_MAX))
+	{
+		return ERROR;
+	}
+	raw = (u16)val;
+	memcpy(buff, &raw, 2);
+	return i2cMem8Write(dev, add, buff, 2);
+}
+
+static int wdtWordGet(int dev, int add, int *val)
+{
+	u8 buff[2];
+	u16 raw = 0;
+
+	if (NULL == val)
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, add, buff, 2))
+	{
+		return ERROR;
+	}
+	memcpy(&raw, buff, 2);
+	*val = raw;
+	return OK;
+}
+
+int wdtPeriodSet(int dev, int period)
+{
+	return wdtWordSet(dev, I2C_MEM_WDT_INTERVAL_SET_ADD, period);
+}
+
+int wdtPeriodGet(int dev, int *period)
+{
+	return wdtWordGet(dev, I2C_MEM_WDT_INTERVAL_GET_ADD, period);
+}
+
+int wdtInitPeriodSet(int dev, int period)
+{
+	return wdtWordSet(dev, I2C_MEM_WDT_INIT_INTERVAL_SET_ADD, period);
+}
+
+int wdtInitPeriodGet(int dev, int *period)
+{
+	return wdtWordGet(dev, I2C_MEM_WDT_INIT_INTERVAL_GET_ADD, period);
+}
+
+int wdtOffIntervalSet(int dev, int interval)
+{
+	u8 buff[4];
+	u32 raw = 0;
+
+	if ( (interval < 2) || (interval > WDT_MAX_OFF_INTERVAL_S))
+	{
+		return ERROR;
+	}
+	raw = (u32)interval;
+	memcpy(buff, &raw, 4);
+	return i2cMem8Write(dev, I2C_MEM_WDT_POWER_OFF_INTERVAL_SET_ADD, buff, 4);
+}
+
+int wdtOffIntervalGet(int dev, int *interval)
+{
+	u8 buff[4];
+	u32 raw = 0;
+
+	if (NULL == interval)
+	{
+		return ERROR;
+	}
+	if (OK != i2cMem8Read(dev, I2C_MEM_WDT_POWER_OFF_INTERVAL_GET_ADD, buff, 4))
+	{
+		return ERROR;
+	}
+	memcpy(&raw, buff, 4);
+	*interval = (int)raw;
+	return OK;
+}
+
+int wdtResetCountGet(int dev, int *count)
+{
+	return wdtWordGet(dev, I2C_MEM_WDT_RESET_COUNT_ADD, count);
+}
+
+int wdtResetCountClear(int dev)
+{
+	u8 buff[1] = {WDT_RESET_SIGNATURE};
+
+	return i2cMem8Write(dev, I2C_MEM_WDT_CLEAR_RESET_COUNT_ADD, buff, 1);
+}
+
+/*
+ * The jitter only brings the reload earlier, and the reload is due early
+ * enough to be serviced before the period expires even if the caller gets to
+ * it one slack later
+ */
+static void wdtKaSchedule(WdtKaType *ka, uint64_t now)
+{
+	uint64_t periodUs = (uint64_t)ka->periodS * 1000000;
+	uint64_t interval = periodUs / 100 * (uint64_t)ka->percent;
+	uint64_t latest = 0;
+	int jitter = rand_r(&ka->seed) % (WDT_KA_JITTER_PERCENT + 1);
+
+	interval = interval * (uint64_t) (100 - jitter) / 100;
+	if (periodUs > (uint64_t)ka->slackUs)
+	{
+		latest = periodUs - (uint64_t)ka->slackUs;
+	}
+	if (interval > latest)
+	{
+		interval = latest;
+	}
+	ka->nextUs = now + interval;
+}
+
+/**
+ * Prepare the keep alive of one board
+ * Params:
+ * 	ka - keep alive state
+ * 	dev - I2C port
+ * 	percent - reload after this part of the watchdog period [10..90]
+ * 	slackUs - longest delay between the due time and the wdtKaService() call,
+ * 		the polling period of the caller
+ */
+int wdtKaInit(WdtKaType *ka, int dev, int percent, int slackUs)
+{
+	if ( (NULL == ka) || (percent < 10) || (percent > 90) || (slackUs < 0))
+	{
+		return ERROR;
+	}
+	memset(ka, 0, sizeof(WdtKaType));
+	ka->dev = dev;
+	ka->percent = percent;
+	ka->slackUs = slackUs;
+	ka->seed = (unsigned int)getTimeUs() ^ (unsigned int)getpid();
+	if ( (OK != wdtPeriodGet(dev, &ka->periodS)) || (ka->periodS <= 0))
+	{
+		return ERROR;
+	}
+	if (OK != wdtReload(dev))
+	{
+		return ERROR;
+	}
+	ka->reloads++;
+	wdtKaSchedule(ka, getTimeUs());
+	return OK;
+}
+
+/**
+ * Reload the watchdog if it is due, meant to be called from a polling loop
+ * so the reload share the bus session with the other transfers
+ * Return 1 if the watchdog was reloaded, 0 if not due, ERROR on fail
+ */
+int wdtKaService(WdtKaType *ka, uint64_t now)
+{
+	int period = 0;
+
+	if (NULL == ka)
+	{
+		return ERROR;
+	}
+	if (now < ka->nextUs)
+	{
+		return 0;
+	}
+	if (OK != wdtReload(ka->dev))
+	{
+		return ERROR;
+	}
+	ka->reloads++;
+	if (0 == (ka->reloads % WDT_KA_REFRESH))
+	{
+		if ( (OK == wdtPeriodGet(ka->dev, &period)) && (period > 0))
+		{
+			ka->periodS = period;
+		}
+	}
+	wdtKaSchedule(ka, now);
+	return 1;
+}
+#endif // PLCPI_CLI
+
+#ifndef PLCPI_LIB
+/**
+ * Write the keep alive status in text metrics format, replaced atomically
+ */
+static void wdtKaStatusWrite(const char *name, int bus, int stack,
+	WdtKaType *ka, int resetCount)
+{
+	char tmp[256];
+	FILE *f = NULL;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	f = fopen(tmp, "w");
+	if (NULL == f)
+	{
+		return;
+	}
+	fprintf(f, "plcpi_wdt_reset_count{bus=\"%d\",stack=\"%d\"} %d\n", bus,
+		stack, resetCount);
+	fprintf(f, "plcpi_wdt_period_seconds{bus=\"%d\",stack=\"%d\"} %d\n", bus,
+		stack, ka->periodS);
+	fprintf(f, "plcpi_wdt_reloads_total{bus=\"%d\",stack=\"%d\"} %u\n", bus,
+		stack, ka->reloads);
+	fclose(f);
+	rename(tmp, name);
+}
+
+int doWdtReload(int argc, char *argv[])
+{
+	int dev = 0;
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != wdtReload(dev))
+	{
+		printf("Fail to write watchdog reset key!\n");
+		return ERROR;
+	}
+	return OK;
+}
+
+static int wdtValueWrite(int argc, char *argv[], int (*pSet)(int, int))
+{
+	int dev = 0;
+
+	if (argc != 4)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != pSet(dev, atoi(argv[3])))
+	{
+		printf("Fail to write watchdog value, check the range!\n");
+		return ERROR;
+	}
+	printf("done\n");
+	return OK;
+}
+
+static int wdtValueRead(int argc, char *argv[], int (*pGet)(int, int*))
+{
+	int dev = 0;
+	int val = 0;
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != pGet(dev, &val))
+	{
+		printf("Fail to read!\n");
+		return ERROR;
+	}
+	printf("%d\n", val);
+	return OK;
+}
+
+int doWdtPeriodWrite(int argc, char *argv[])
+{
+	return wdtValueWrite(argc, argv, wdtPeriodSet);
+}
+
+int doWdtPeriodRead(int argc, char *argv[])
+{
+	return wdtValueRead(argc, argv, wdtPeriodGet);
+}
+
+int doWdtInitPeriodWrite(int argc, char *argv[])
+{
+	return wdtValueWrite(argc, argv, wdtInitPeriodSet);
+}
+
+int doWdtInitPeriodRead(int argc, char *argv[])
+{
+	return wdtValueRead(argc, argv, wdtInitPeriodGet);
+}
+
+int doWdtOffPeriodWrite(int argc, char *argv[])
+{
+	return wdtValueWrite(argc, argv, wdtOffIntervalSet);
+}
+
+int doWdtOffPeriodRead(int argc, char *argv[])
+{
+	return wdtValueRead(argc, argv, wdtOffIntervalGet);
+}
+
+int doWdtResetCountRead(int argc, char *argv[])
+{
+	return wdtValueRead(argc, argv, wdtResetCountGet);
+}
+
+int doWdtResetCountClear(int argc, char *argv[])
+{
+	int dev = 0;
+
+	if (argc != 3)
+	{
+		return ARG_CNT_ERR;
+	}
+	dev = doBoardInit(atoi(argv[1]));
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if (OK != wdtResetCountClear(dev))
+	{
+		printf("Fail to clear the reset count!\n");
+		return ERROR;
+	}
+	printf("done\n");
+	return OK;
+}
+
+int doWdtKeepAlive(int argc, char *argv[])
+{
+	int dev = 0;
+	int stack = 0;
+	int percent = WDT_KA_DEFAULT_PERCENT;
+	int resetCount = 0;
+	int ret = 0;
+	char *status = NULL;
+	uint64_t now = 0;
+	WdtKaType ka;
+
+	if ( (argc < 3) || (argc > 5))
+	{
+		return ARG_CNT_ERR;
+	}
+	stack = atoi(argv[1]);
+	if (argc > 3)
+	{
+		percent = atoi(argv[3]);
+		if ( (percent < 10) || (percent > 90))
+		{
+			printf("Invalid reload percent [10..90]!\n");
+			return ARG_ERR;
+		}
+	}
+	if (argc > 4)
+	{
+		status = argv[4];
+	}
+	dev = doBoardInit(stack);
+	if (dev <= 0)
+	{
+		return ERROR;
+	}
+	if ( (OK != wdtKaInit(&ka, dev, percent, 0))
+		|| (OK != wdtResetCountGet(dev, &resetCount)))
+	{
+		printf("Fail to start the watchdog keep alive!\n");
+		return ERROR;
+	}
+	printf("Watchdog period %d s, reset count %d\n", ka.periodS, resetCount);
+	fflush(stdout);
+	if (status)
+	{
+		wdtKaStatusWrite(status, devGet(dev)->bus, stack, &ka, resetCount);
+	}
+	while (1)
+	{
+		// do not keep the other plcpi processes out of the bus while sleeping
+		busUnlock(devGet(dev)->bus);
+		now = getTimeUs();
+		if (ka.nextUs > now + 1000000)
+		{
+			busyWaitUs(1000000);
+		}
+		else if (ka.nextUs > now)
+		{
+			busyWaitUs((int) (ka.nextUs - now));
+		}
+		busLock(devGet(dev)->bus);
+		ret = wdtKaService(&ka, getTimeUs());
+		if (ERROR == ret)
+		{
+			printf("Fail to reload the watchdog!\n");
+			fflush(stdout);
+			// retry soon, the board reset only when the whole period expires
+			ka.nextUs = getTimeUs() + 1000000;
+			continue;
+		}
+		if ( (ret == 1) && (0 == (ka.reloads % WDT_KA_REFRESH)))
+		{
+			if ( (OK == wdtResetCountGet(dev, &resetCount)) && status)
+			{
+				wdtKaStatusWrite(status, devGet(dev)->bus, stack, &ka,
+					resetCount);
+			}
+		}
+	}
+	return OK;
+}
+#endif // PLCPI_LIB